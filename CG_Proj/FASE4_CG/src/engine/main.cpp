@@ -1,7 +1,21 @@
+#define _USE_MATH_DEFINES
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
-#include "tinyxml2.h"
+#include "primitives.h"
+#include <algorithm>
+#include <cctype>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <iomanip>
+#include <map>
 #ifdef __APPLE__
 #include <GLUT/glut.h>
 #include <GL/gl.h>
@@ -10,10 +24,38 @@
 #include <GL/glew.h>
 #include <GL/glut.h>
 #endif
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+// windows.h defines these as empty macros, which would swallow the projection's near and far
+#undef near
+#undef far
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#else
+#include <filesystem>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ENGINE_SSE2
+#include <emmintrin.h>
+#endif
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 struct Window {
@@ -69,11 +111,11 @@ struct Color {
 };
 
 struct Material {
-    Color diffuse;
-    Color ambient;
-    Color specular;
-    Color emissive;
-    float shininess;
+    Color diffuse = { 200 / 255.0f, 200 / 255.0f, 200 / 255.0f };
+    Color ambient = { 50 / 255.0f, 50 / 255.0f, 50 / 255.0f };
+    Color specular = { 0.0f, 0.0f, 0.0f };
+    Color emissive = { 0.0f, 0.0f, 0.0f };
+    float shininess = 0.0f;
 };
 
 struct Light {
@@ -86,15 +128,77 @@ struct Light {
     Color specular;
 };
 
-struct Model {
+// Object-space bounding volumes: an AABB plus a bounding sphere. Empty while radius is negative.
+struct Bounds {
+    Point3D min{ 0, 0, 0 };
+    Point3D max{ 0, 0, 0 };
+    Point3D center{ 0, 0, 0 };
+    float radius = -1.0f;
+};
+
+// Compact vertex data as written by "generator quantize": unorm16 positions inside the AABB,
+// octahedral snorm16 normals and unorm16 UVs inside the UV bounds (16 bytes per vertex).
+struct QuantizedVertices {
+    Point3D boundsMin, boundsMax;
+    Vector2 uvMin, uvMax;
+    std::vector<uint16_t> positions;
+    std::vector<int16_t> normals;
+    std::vector<uint16_t> texCoords;
+};
+
+// Planar stores all positions, then all normals, then all texcoords; interleaved stores each
+// vertex's attributes side by side so a vertex fetch touches one cache line.
+enum VertexLayout { LAYOUT_PLANAR, LAYOUT_INTERLEAVED };
+
+VertexLayout vertexLayout = LAYOUT_PLANAR;
+
+// Geometry loaded from one .3d file. Every model that names the same file shares its Mesh,
+// so each file is parsed and uploaded once.
+struct Mesh {
     std::string name;
+    unsigned int id = 0;
     std::vector<Point3D> vertices;
     std::vector<Vector3> normals;
     std::vector<Vector2> texCoords;
-    GLuint vboId;
-    GLuint vaoId;
+    std::vector<unsigned int> indices;
+    GLuint vboId = 0;
+    GLuint vaoId = 0;
+    GLuint iboId = 0;
+    bool pooled = false;
+    GLint firstVertex = 0;
+    GLuint firstIndex = 0;
+    bool quantized = false;
+    QuantizedVertices packed;
+    // Bezier patches for the tessellation program: vertices holds 16 control points per patch and nothing else
+    bool patches = false;
+    VertexLayout layout = LAYOUT_PLANAR;
+    GLsizei stride = 0;
+    size_t attributeOffsets[3] = { 0, 0, 0 };
+    Bounds bounds;
+    // Fixed at upload, so drawing does not depend on the CPU arrays still being there
+    size_t vertexCount = 0;
+    size_t indexCount = 0;
+    size_t gpuBytes = 0;
+};
+
+struct Texture {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    unsigned char* pixels = nullptr;
+    GLuint id = 0;
+    // Above 1 when pixels hold a whole mip chain, level 0 first, as read from a scene snapshot
+    int levels = 1;
+    bool mapped = false;
+};
+
+struct Model {
+    std::string name;
+    std::shared_ptr<Mesh> mesh;
     Material material; 
-    GLuint textureId;
+    std::string textureFile;
+    GLuint textureId = 0;
+    unsigned int materialId = 0;
 };
 
 struct Translate {
@@ -122,17 +226,52 @@ struct Transform {
     bool hasScale = false;
 };
 
+// Move-only, so a subtree can never be deep-copied by accident; the parser builds each group
+// in place inside a children vector sized up front.
 struct Group {
     Transform transform;
     std::vector<Model> models;
     std::vector<Group> children;
+    Bounds bounds;
+    size_t modelCount = 0;
+
+    Group() = default;
+    Group(const Group&) = delete;
+    Group& operator=(const Group&) = delete;
+    Group(Group&&) = default;
+    Group& operator=(Group&&) = default;
+};
+
+// Where a top-level group came from: a hash of its XML content and the mesh and texture files
+// it names. Hot reload uses these to keep groups whose source did not change.
+struct GroupSource {
+    uint64_t hash = 0;
+    std::vector<std::string> files;
+    bool loaded = false;
+    bool baked = false;
+};
+
+// The file's camera position in the spherical form the keyboard controls move. Loading only
+// records it; the GL thread copies it into alfa, beta and radius.
+struct CameraOrbit {
+    bool parsed = false;
+    float alfa = 0.0f;
+    float beta = 0.5f;
+    float radius = 100.0f;
 };
 
 struct World {
     Window window;
     Camera camera;
+    CameraOrbit orbit;
     std::vector<Group> groups;
+    std::vector<GroupSource> groupSources;
     std::vector<Light> lights;
+    std::vector<Material> materials;
+    // Index into materials by the material's bytes
+    std::unordered_map<std::string, unsigned int> materialIds;
+    std::unordered_map<std::string, std::shared_ptr<Mesh>> meshes;
+    std::unordered_map<std::string, Texture> textures;
 };
 
 World worldConfig;
@@ -144,6 +283,212 @@ float rotationZ = 0.0f;
 float alfa = 0.0f, beta = 0.5f, radius = 100.0f;
 float camX, camY, camZ;
 
+void applyCameraOrbit(const CameraOrbit& orbit) {
+    if (!orbit.parsed) return;
+    alfa = orbit.alfa;
+    beta = orbit.beta;
+    radius = orbit.radius;
+}
+
+// Seconds since start, sampled once per frame so every group animates from the same instant
+float frameTime = 0.0f;
+
+struct FrameStats {
+    size_t drawCalls = 0;
+    size_t instances = 0;
+    size_t culled = 0;
+    size_t occluded = 0;
+    size_t bindsSaved = 0;
+    size_t stateFiltered = 0;
+};
+
+FrameStats frameStats;
+
+// Shadow copy of the capabilities and bindings the draw code toggles. Requests for a value GL
+// already holds are dropped and counted instead of reaching the driver. Code that changes this
+// state without going through the cache (glPopAttrib) has to restore or invalidate it.
+struct GLStateCache {
+    enum Value : unsigned char { UNKNOWN, OFF, ON };
+
+    std::unordered_map<GLenum, Value> capabilities;
+    GLuint texture = ~0u;
+    GLuint program = ~0u;
+    GLuint vertexArray = ~0u;
+
+    void set(GLenum capability, bool enabled) {
+        Value& current = capabilities[capability];
+        Value wanted = enabled ? ON : OFF;
+        if (current == wanted) {
+            ++frameStats.stateFiltered;
+            return;
+        }
+        if (enabled) glEnable(capability);
+        else glDisable(capability);
+        current = wanted;
+    }
+
+    void enable(GLenum capability) { set(capability, true); }
+    void disable(GLenum capability) { set(capability, false); }
+
+    void bindTexture(GLuint id) {
+        if (id == texture) {
+            ++frameStats.stateFiltered;
+            return;
+        }
+        glBindTexture(GL_TEXTURE_2D, id);
+        texture = id;
+    }
+
+    void useProgram(GLuint id) {
+        if (id == program) {
+            ++frameStats.stateFiltered;
+            return;
+        }
+        glUseProgram(id);
+        program = id;
+    }
+
+    void bindVertexArray(GLuint id) {
+        if (id == vertexArray) {
+            ++frameStats.stateFiltered;
+            return;
+        }
+        glBindVertexArray(id);
+        vertexArray = id;
+    }
+
+    void invalidate() {
+        capabilities.clear();
+        texture = program = vertexArray = ~0u;
+    }
+};
+
+GLStateCache glState;
+
+// Streaming memory for data rebuilt every frame: instance matrices and materials, indirect
+// commands and curve vertices. One persistently mapped buffer is split into a region per frame
+// in flight. A frame takes space from its region with an atomic bump, so any thread may allocate,
+// and fences the region when it ends. Before a region is reused its fence is waited on, but that
+// fence is two frames old and has normally signalled long before.
+class FrameRing {
+public:
+    static const int REGIONS = 3;
+
+    GLuint buffer() const { return id; }
+
+    void beginFrame() {
+        if (!mapped || growRequested) {
+            size_t size = mapped ? regionSize * 2 : size_t(4) << 20;
+            destroy();
+            create(size);
+            growRequested = false;
+        }
+        region = (region + 1) % REGIONS;
+        waitFence(region);
+        head = 0;
+    }
+
+    void endFrame() {
+        if (!mapped) return;
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    // Mapped memory for bytes, with offset set to where it lives in buffer(). Returns null when
+    // the region is full; the caller uploads the old way and the next frame gets a bigger ring.
+    void* allocate(size_t bytes, size_t& offset) {
+        if (!mapped) return nullptr;
+        size_t size = (bytes + 15) & ~size_t(15);
+        size_t start = head.fetch_add(size);
+        if (start + size > regionSize) {
+            growRequested = true;
+            return nullptr;
+        }
+        offset = region * regionSize + start;
+        return mapped + offset;
+    }
+
+private:
+    void create(size_t size) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &id);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+        glBufferStorage(GL_COPY_WRITE_BUFFER, size * REGIONS, nullptr, flags);
+        mapped = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size * REGIONS, flags));
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        regionSize = mapped ? size : 0;
+    }
+
+    void destroy() {
+        if (!id) return;
+        for (int i = 0; i < REGIONS; ++i) waitFence(i);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &id);
+        id = 0;
+        mapped = nullptr;
+    }
+
+    void waitFence(int index) {
+        if (!fences[index]) return;
+        while (glClientWaitSync(fences[index], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+        glDeleteSync(fences[index]);
+        fences[index] = nullptr;
+    }
+
+    GLuint id = 0;
+    unsigned char* mapped = nullptr;
+    size_t regionSize = 0;
+    int region = 0;
+    std::atomic<size_t> head{ 0 };
+    std::atomic<bool> growRequested{ false };
+    GLsync fences[REGIONS] = {};
+};
+
+bool useFrameRing = true;
+FrameRing frameRing;
+
+// Frames are drawn only when something can change the picture: animation, input, a reload, or
+// occlusion results that are still settling. With nothing to draw the idle callback takes itself
+// out, so GLUT blocks waiting for events; otherwise it sleeps until the next frame slot of
+// targetFrameRate (0 draws as fast as possible).
+int targetFrameRate = 60;
+bool sceneAnimated = false;
+bool windowVisible = true;
+bool redrawRequested = true;
+std::chrono::steady_clock::time_point lastFrameStart;
+
+void myIdleFunc() {
+    if (!windowVisible || (!redrawRequested && !sceneAnimated)) {
+        glutIdleFunc(nullptr);
+        return;
+    }
+
+    if (targetFrameRate > 0) {
+        std::this_thread::sleep_until(lastFrameStart + std::chrono::microseconds(1000000 / targetFrameRate));
+    }
+    lastFrameStart = std::chrono::steady_clock::now();
+    redrawRequested = false;
+    glutPostRedisplay();
+}
+
+void requestRedraw() {
+    redrawRequested = true;
+    glutIdleFunc(myIdleFunc);
+}
+
+void visibilityChanged(int state) {
+    windowVisible = state == GLUT_VISIBLE;
+    if (windowVisible) requestRedraw();
+}
+bool useInstancing = true;
+bool useCulling = true;
+bool useGeometryPool = true;
+bool useMultiDraw = true;
+bool useStaticBaking = true;
+// Patch primitives are kept as control points and tessellated on the GPU when GL 4.0 is there
+bool useTessellation = true;
+
 void spherical2Cartesian() {
     camX = radius * cos(beta) * sin(alfa);
     camY = radius * sin(beta);
@@ -175,16 +520,380 @@ void interpolateCatmullRom(const std::vector<Point3D>& points, float t, Point3D&
     pos.z = catmullRom(localT, points[p0].z, points[p1].z, points[p2].z, points[p3].z);
 }
 
-void drawCatmullRomCurve(const std::vector<Point3D>& points) {
-    glColor3f(1.0f, 1.0f, 1.0f);
-    glBegin(GL_LINE_STRIP);
+std::vector<Point3D> sampleCatmullRom(const std::vector<Point3D>& points) {
+    std::vector<Point3D> strip;
     for (float t = 0; t <= 1.0; t += 0.01) {
         Point3D pos;
         interpolateCatmullRom(points, t, pos);
-        glVertex3f(pos.x, pos.y, pos.z);
+        strip.push_back(pos);
     }
-    glEnd();
+    return strip;
+}
+
+void drawCatmullRomCurve(const std::vector<Point3D>& points) {
     glColor3f(1.0f, 1.0f, 1.0f);
+    std::vector<Point3D> strip = sampleCatmullRom(points);
+
+    size_t offset = 0;
+    void* data = useFrameRing ? frameRing.allocate(strip.size() * sizeof(Point3D), offset) : nullptr;
+    if (data) {
+        memcpy(data, strip.data(), strip.size() * sizeof(Point3D));
+        glState.bindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, frameRing.buffer());
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, 0, reinterpret_cast<void*>(offset));
+        glDrawArrays(GL_LINE_STRIP, 0, static_cast<GLsizei>(strip.size()));
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    else {
+        glBegin(GL_LINE_STRIP);
+        for (const Point3D& pos : strip) glVertex3f(pos.x, pos.y, pos.z);
+        glEnd();
+    }
+    glColor3f(1.0f, 1.0f, 1.0f);
+}
+
+// Column-major 4x4 matrix, laid out like the GL matrix stack so it can go to glMultMatrixf as is
+struct Mat4 {
+    float m[16];
+};
+
+Mat4 identityMatrix() {
+    Mat4 result = { { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 } };
+    return result;
+}
+
+Mat4 multiply(const Mat4& a, const Mat4& b) {
+    Mat4 result;
+    for (int column = 0; column < 4; ++column) {
+        for (int row = 0; row < 4; ++row) {
+            result.m[column * 4 + row] = a.m[row] * b.m[column * 4] + a.m[4 + row] * b.m[column * 4 + 1]
+                + a.m[8 + row] * b.m[column * 4 + 2] + a.m[12 + row] * b.m[column * 4 + 3];
+        }
+    }
+    return result;
+}
+
+Mat4 translationMatrix(float x, float y, float z) {
+    Mat4 result = identityMatrix();
+    result.m[12] = x;
+    result.m[13] = y;
+    result.m[14] = z;
+    return result;
+}
+
+Mat4 scaleMatrix(float x, float y, float z) {
+    Mat4 result = identityMatrix();
+    result.m[0] = x;
+    result.m[5] = y;
+    result.m[10] = z;
+    return result;
+}
+
+// Same matrix glRotatef builds, including treating a zero axis as no rotation
+Mat4 rotationMatrix(float angle, float x, float y, float z) {
+    float length = std::sqrt(x * x + y * y + z * z);
+    if (length < 1e-4f) return identityMatrix();
+    x /= length;
+    y /= length;
+    z /= length;
+
+    float radians = angle * static_cast<float>(M_PI) / 180.0f;
+    float c = std::cos(radians), s = std::sin(radians), t = 1.0f - c;
+    Mat4 result = { {
+        x * x * t + c, y * x * t + z * s, x * z * t - y * s, 0,
+        x * y * t - z * s, y * y * t + c, y * z * t + x * s, 0,
+        x * z * t + y * s, y * z * t - x * s, z * z * t + c, 0,
+        0, 0, 0, 1 } };
+    return result;
+}
+
+Point3D transformPoint(const Mat4& matrix, const Point3D& p) {
+    const float* m = matrix.m;
+    return { m[0] * p.x + m[4] * p.y + m[8] * p.z + m[12],
+        m[1] * p.x + m[5] * p.y + m[9] * p.z + m[13],
+        m[2] * p.x + m[6] * p.y + m[10] * p.z + m[14] };
+}
+
+// Cofactors of the upper 3x3, column-major, returning its determinant
+float cofactorMatrix(const Mat4& matrix, float cofactors[9]) {
+    const float* m = matrix.m;
+    cofactors[0] = m[5] * m[10] - m[6] * m[9];
+    cofactors[1] = m[6] * m[8] - m[4] * m[10];
+    cofactors[2] = m[4] * m[9] - m[5] * m[8];
+    cofactors[3] = m[9] * m[2] - m[10] * m[1];
+    cofactors[4] = m[10] * m[0] - m[8] * m[2];
+    cofactors[5] = m[8] * m[1] - m[9] * m[0];
+    cofactors[6] = m[1] * m[6] - m[2] * m[5];
+    cofactors[7] = m[2] * m[4] - m[0] * m[6];
+    cofactors[8] = m[0] * m[5] - m[1] * m[4];
+    return m[0] * cofactors[0] + m[1] * cofactors[1] + m[2] * cofactors[2];
+}
+
+// Inverse transpose of the upper 3x3 (up to a positive scale, which the shader normalizes away)
+void normalMatrix(const Mat4& matrix, float result[9]) {
+    float cofactors[9];
+    float sign = cofactorMatrix(matrix, cofactors) < 0 ? -1.0f : 1.0f;
+    for (int i = 0; i < 9; ++i) result[i] = cofactors[i] * sign;
+}
+
+// Inverse of a matrix built from scales, rotations and translations only
+Mat4 affineInverse(const Mat4& matrix) {
+    float cofactors[9];
+    float determinant = cofactorMatrix(matrix, cofactors);
+    Mat4 result = identityMatrix();
+    if (std::fabs(determinant) < 1e-12f) return result;
+
+    for (int column = 0; column < 3; ++column) {
+        for (int row = 0; row < 3; ++row) {
+            result.m[column * 4 + row] = cofactors[row * 3 + column] / determinant;
+        }
+    }
+    const float* m = matrix.m;
+    for (int row = 0; row < 3; ++row) {
+        result.m[12 + row] = -(result.m[row] * m[12] + result.m[4 + row] * m[13] + result.m[8 + row] * m[14]);
+    }
+    return result;
+}
+
+float rotationAngle(const Rotate& rotate, float time) {
+    if (rotate.time > 0) {
+        return fmod(time * (360.0f / rotate.time), 360.0f);
+    }
+    return rotate.angle;
+}
+
+Point3D translationAt(const Translate& translate, float time) {
+    if (translate.time > 0 && translate.align) {
+        float t = fmod(time, translate.time) / translate.time;
+        Point3D pos;
+        interpolateCatmullRom(translate.controlPoints, t, pos);
+        return pos;
+    }
+    return translate.controlPoints[0];
+}
+
+float length(const Point3D& p) {
+    return std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+}
+
+Point3D subtract(const Point3D& a, const Point3D& b) {
+    return { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+Point3D cross(const Point3D& a, const Point3D& b) {
+    return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+float dot(const Point3D& a, const Point3D& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+Point3D normalize(const Point3D& p) {
+    float size = length(p);
+    return size > 0.0f ? Point3D{ p.x / size, p.y / size, p.z / size } : p;
+}
+
+// The matrices gluPerspective and gluLookAt multiply in
+Mat4 perspectiveMatrix(float fov, float aspect, float zNear, float zFar) {
+    float f = 1.0f / std::tan(fov * static_cast<float>(M_PI) / 360.0f);
+    Mat4 result = { { f / aspect, 0, 0, 0,
+        0, f, 0, 0,
+        0, 0, (zFar + zNear) / (zNear - zFar), -1,
+        0, 0, 2 * zFar * zNear / (zNear - zFar), 0 } };
+    return result;
+}
+
+Mat4 lookAtMatrix(const Point3D& eye, const Point3D& center, const Point3D& up) {
+    Point3D f = normalize(subtract(center, eye));
+    Point3D s = normalize(cross(f, up));
+    Point3D u = cross(s, f);
+    Mat4 result = { { s.x, u.x, -f.x, 0,
+        s.y, u.y, -f.y, 0,
+        s.z, u.z, -f.z, 0,
+        -dot(s, eye), -dot(u, eye), dot(f, eye), 1 } };
+    return result;
+}
+
+// Grows the sphere of bounds to enclose another sphere; the AABB grows to the sphere's box
+void mergeSphere(Bounds& bounds, const Point3D& center, float radius) {
+    Point3D boxMin{ center.x - radius, center.y - radius, center.z - radius };
+    Point3D boxMax{ center.x + radius, center.y + radius, center.z + radius };
+    if (bounds.radius < 0) {
+        bounds.center = center;
+        bounds.radius = radius;
+        bounds.min = boxMin;
+        bounds.max = boxMax;
+        return;
+    }
+
+    bounds.min = { std::min(bounds.min.x, boxMin.x), std::min(bounds.min.y, boxMin.y), std::min(bounds.min.z, boxMin.z) };
+    bounds.max = { std::max(bounds.max.x, boxMax.x), std::max(bounds.max.y, boxMax.y), std::max(bounds.max.z, boxMax.z) };
+
+    Point3D offset{ center.x - bounds.center.x, center.y - bounds.center.y, center.z - bounds.center.z };
+    float distance = length(offset);
+    if (distance + radius <= bounds.radius) return;
+    if (distance + bounds.radius <= radius) {
+        bounds.center = center;
+        bounds.radius = radius;
+        return;
+    }
+
+    float merged = (distance + bounds.radius + radius) * 0.5f;
+    float shift = (merged - bounds.radius) / distance;
+    bounds.center = { bounds.center.x + offset.x * shift, bounds.center.y + offset.y * shift, bounds.center.z + offset.z * shift };
+    bounds.radius = merged;
+}
+
+// Bounds of a group's contents as seen from its parent, over every pose its animated
+// translate and rotate can reach, so they hold without being recomputed each frame.
+Bounds sweptBounds(const Transform& transform, const Bounds& content) {
+    Bounds swept;
+    if (content.radius < 0) return swept;
+
+    Point3D center = content.center;
+    float radius = content.radius;
+
+    const Translate& translate = transform.translate;
+    if (translate.active && !translate.controlPoints.empty()) {
+        if (translate.time > 0 && translate.align) {
+            const int samples = 256;
+            Bounds path;
+            Point3D previous;
+            float longestStep = 0.0f;
+            for (int i = 0; i <= samples; ++i) {
+                Point3D pos;
+                interpolateCatmullRom(translate.controlPoints, static_cast<float>(i) / samples, pos);
+                if (i > 0) {
+                    longestStep = std::max(longestStep, length({ pos.x - previous.x, pos.y - previous.y, pos.z - previous.z }));
+                }
+                mergeSphere(path, { pos.x + center.x, pos.y + center.y, pos.z + center.z }, 0.0f);
+                previous = pos;
+            }
+            center = path.center;
+            radius += path.radius + longestStep;
+        }
+        else {
+            const Point3D& pos = translate.controlPoints[0];
+            center = { center.x + pos.x, center.y + pos.y, center.z + pos.z };
+        }
+    }
+
+    const Rotate& rotate = transform.rotate;
+    float axisLength = length(rotate.axis);
+    if (rotate.active && axisLength > 1e-4f) {
+        if (rotate.time > 0) {
+            // A full turn sweeps the center around the axis: keep its projection on the axis
+            Point3D axis{ rotate.axis.x / axisLength, rotate.axis.y / axisLength, rotate.axis.z / axisLength };
+            float along = center.x * axis.x + center.y * axis.y + center.z * axis.z;
+            Point3D projected{ axis.x * along, axis.y * along, axis.z * along };
+            radius += length({ center.x - projected.x, center.y - projected.y, center.z - projected.z });
+            center = projected;
+        }
+        else {
+            center = transformPoint(rotationMatrix(rotate.angle, rotate.axis.x, rotate.axis.y, rotate.axis.z), center);
+        }
+    }
+
+    if (transform.hasScale) {
+        const Point3D& scale = transform.scale;
+        center = { center.x * scale.x, center.y * scale.y, center.z * scale.z };
+        radius *= std::max(std::fabs(scale.x), std::max(std::fabs(scale.y), std::fabs(scale.z)));
+    }
+
+    mergeSphere(swept, center, radius);
+    return swept;
+}
+
+// Fills group.bounds (in the space the group's models are drawn in) from its meshes and the
+// swept bounds of its children.
+void computeGroupBounds(Group& group) {
+    group.bounds = Bounds();
+    group.modelCount = 0;
+
+    for (const Model& model : group.models) {
+        if (!model.mesh) continue;
+        ++group.modelCount;
+        if (model.mesh->bounds.radius >= 0) {
+            mergeSphere(group.bounds, model.mesh->bounds.center, model.mesh->bounds.radius);
+        }
+    }
+
+    for (Group& child : group.children) {
+        computeGroupBounds(child);
+        group.modelCount += child.modelCount;
+        Bounds swept = sweptBounds(child.transform, child.bounds);
+        if (swept.radius >= 0) {
+            mergeSphere(group.bounds, swept.center, swept.radius);
+        }
+    }
+}
+
+// Planes (a, b, c, d) with the inside where ax + by + cz + d >= 0
+struct Frustum {
+    float planes[6][4];
+};
+
+// Extracts the clip planes of a projection * modelview matrix, in that matrix's input space
+Frustum frustumFromMatrix(const Mat4& matrix) {
+    const float* m = matrix.m;
+    Frustum frustum;
+    for (int i = 0; i < 6; ++i) {
+        int row = i / 2;
+        float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+        float* plane = frustum.planes[i];
+        for (int column = 0; column < 4; ++column) {
+            plane[column] = m[column * 4 + 3] + sign * m[column * 4 + row];
+        }
+        float norm = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        for (int k = 0; k < 4; ++k) plane[k] /= norm;
+    }
+    return frustum;
+}
+
+bool sphereInFrustum(const Frustum& frustum, const Mat4& world, const Bounds& bounds) {
+    if (bounds.radius < 0) return false;
+
+    const float* m = world.m;
+    Point3D center = transformPoint(world, bounds.center);
+    float scale = std::sqrt(std::max(m[0] * m[0] + m[1] * m[1] + m[2] * m[2],
+        std::max(m[4] * m[4] + m[5] * m[5] + m[6] * m[6], m[8] * m[8] + m[9] * m[9] + m[10] * m[10])));
+    float radius = bounds.radius * scale;
+
+    for (const float* plane : frustum.planes) {
+        if (plane[0] * center.x + plane[1] * center.y + plane[2] * center.z + plane[3] < -radius) return false;
+    }
+    return true;
+}
+
+// Center and half size of the box that encloses the AABB of bounds after the transform
+void transformBox(const Mat4& world, const Bounds& bounds, Point3D& center, Point3D& extent) {
+    const float* m = world.m;
+    Point3D localCenter{ (bounds.min.x + bounds.max.x) * 0.5f, (bounds.min.y + bounds.max.y) * 0.5f, (bounds.min.z + bounds.max.z) * 0.5f };
+    Point3D halfSize{ (bounds.max.x - bounds.min.x) * 0.5f, (bounds.max.y - bounds.min.y) * 0.5f, (bounds.max.z - bounds.min.z) * 0.5f };
+
+    center = transformPoint(world, localCenter);
+    extent = {
+        std::fabs(m[0]) * halfSize.x + std::fabs(m[4]) * halfSize.y + std::fabs(m[8]) * halfSize.z,
+        std::fabs(m[1]) * halfSize.x + std::fabs(m[5]) * halfSize.y + std::fabs(m[9]) * halfSize.z,
+        std::fabs(m[2]) * halfSize.x + std::fabs(m[6]) * halfSize.y + std::fabs(m[10]) * halfSize.z };
+}
+
+bool boxInFrustum(const Frustum& frustum, const Mat4& world, const Bounds& bounds) {
+    Point3D center, extent;
+    transformBox(world, bounds, center, extent);
+
+    for (const float* plane : frustum.planes) {
+        float distance = plane[0] * center.x + plane[1] * center.y + plane[2] * center.z + plane[3];
+        float reach = std::fabs(plane[0]) * extent.x + std::fabs(plane[1]) * extent.y + std::fabs(plane[2]) * extent.z;
+        if (distance + reach < 0) return false;
+    }
+    return true;
+}
+
+bool modelInFrustum(const Frustum& frustum, const Mat4& world, const Mesh& mesh) {
+    return sphereInFrustum(frustum, world, mesh.bounds) && boxInFrustum(frustum, world, mesh.bounds);
 }
 
 void setupCamera(const Camera& camera) {
@@ -199,16 +908,18 @@ void setupCamera(const Camera& camera) {
         camera.up.x, camera.up.y, camera.up.z);
 }
 
+const float lightModelAmbient = 0.1f;
+
 void initializeLighting() {
-    glEnable(GL_LIGHTING);
-    glEnable(GL_NORMALIZE);
-    float globalAmbient[] = { 0.1f, 0.1f, 0.1f, 1.0f };
+    glState.enable(GL_LIGHTING);
+    glState.enable(GL_NORMALIZE);
+    float globalAmbient[] = { lightModelAmbient, lightModelAmbient, lightModelAmbient, 1.0f };
     glLightModelfv(GL_LIGHT_MODEL_AMBIENT, globalAmbient);
 
     for (size_t i = 0; i < worldConfig.lights.size(); i++) {
         Light& light = worldConfig.lights[i];
         int lightId = GL_LIGHT0 + i;
-        glEnable(lightId);
+        glState.enable(lightId);
 
         GLfloat ambient[] = { light.ambient.r, light.ambient.g, light.ambient.b, 1.0f };
         GLfloat diffuse[] = { light.diffuse.r, light.diffuse.g, light.diffuse.b, 1.0f };
@@ -245,520 +956,5028 @@ void applyMaterial(const Material& material) {
     glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, shininess[0]);
 }
 
-GLuint loadTexture(const std::string& filename) {
-    int width, height, nrChannels;
-    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrChannels, 0);
-    if (!data) {
+bool decodeTexture(const std::string& filename, Texture& texture) {
+    texture.pixels = stbi_load(filename.c_str(), &texture.width, &texture.height, &texture.channels, 0);
+    if (!texture.pixels) {
         std::cerr << "Failed to load texture: " << filename << std::endl;
-        return 0;
+        return false;
     }
+    return true;
+}
+
+void uploadTexture(const std::string& filename, Texture& texture) {
+    if (!texture.pixels) return;
 
     GLuint textureID;
     glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glTexImage2D(GL_TEXTURE_2D, 0, (nrChannels == 4 ? GL_RGBA : GL_RGB), width, height, 0, (nrChannels == 4 ? GL_RGBA : GL_RGB), GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    glState.bindTexture(textureID);
+    GLenum format = texture.channels == 4 ? GL_RGBA : GL_RGB;
+    if (texture.levels > 1) {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        const unsigned char* level = texture.pixels;
+        int width = texture.width, height = texture.height;
+        for (int i = 0; i < texture.levels; ++i) {
+            glTexImage2D(GL_TEXTURE_2D, i, format, width, height, 0, format, GL_UNSIGNED_BYTE, level);
+            level += size_t(width) * height * texture.channels;
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    else {
+        glTexImage2D(GL_TEXTURE_2D, 0, format, texture.width, texture.height, 0, format, GL_UNSIGNED_BYTE, texture.pixels);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
 
-    stbi_image_free(data);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    if (!texture.mapped) stbi_image_free(texture.pixels);
+    texture.pixels = nullptr;
+    texture.id = textureID;
+    glState.bindTexture(0);
     std::cout << "Texture loaded successfully: " << filename << " (ID=" << textureID << ")" << std::endl;
-    return textureID;
 }
 
-void renderModel(const Model& model) {
-    glPushMatrix();
-    glBindVertexArray(model.vaoId);
+enum ProgramFlags {
+    PROGRAM_QUANTIZED = 1 << 0,
+    PROGRAM_INSTANCED = 1 << 1,
+    PROGRAM_PATCHES = 1 << 2,
+};
 
-    glEnable(GL_LIGHTING);
-    applyMaterial(model.material);
+struct ShaderProgram {
+    GLuint id = 0;
+    GLint boundsMin = -1;
+    GLint boundsExtent = -1;
+    GLint uvMin = -1;
+    GLint uvExtent = -1;
+    GLint lightCount = -1;
+    GLint useTexture = -1;
+    GLint tessellationScale = -1;
+};
 
-    if (model.textureId > 0) {
-        glEnable(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, model.textureId);
-        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-    }
+// Programs stand in for the fixed-function pipeline only where it cannot read our vertex data,
+// so the lighting below reproduces GL's per-vertex model from the glLight/glMaterial state.
+const char* lightingShaderSource = R"(
+uniform int lightCount;
 
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glEnableClientState(GL_NORMAL_ARRAY);
-    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+struct SurfaceMaterial {
+    vec4 diffuse;
+    vec4 ambient;
+    vec4 specular;
+    vec4 emission;
+    float shininess;
+};
 
-    glBindBuffer(GL_ARRAY_BUFFER, model.vboId);
-    glVertexPointer(3, GL_FLOAT, 0, (void*)0);
-    glNormalPointer(GL_FLOAT, 0, (void*)(model.vertices.size() * sizeof(Point3D)));
-    glTexCoordPointer(2, GL_FLOAT, 0, (void*)((model.vertices.size() + model.normals.size()) * sizeof(Point3D)));
+vec4 fixedFunctionLighting(vec3 eyePosition, vec3 n, SurfaceMaterial material) {
+    vec4 color = material.emission + material.ambient * gl_LightModel.ambient;
+    for (int i = 0; i < 8; ++i) {
+        if (i >= lightCount) break;
 
-    glDisable(GL_CULL_FACE);
-    glDrawArrays(GL_TRIANGLES, 0, model.vertices.size());
-    glEnable(GL_CULL_FACE);
+        vec3 l;
+        float attenuation = 1.0;
+        if (gl_LightSource[i].position.w == 0.0) {
+            l = normalize(gl_LightSource[i].position.xyz);
+        }
+        else {
+            vec3 d = gl_LightSource[i].position.xyz - eyePosition;
+            float dist = length(d);
+            l = d / dist;
+            attenuation = 1.0 / (gl_LightSource[i].constantAttenuation + gl_LightSource[i].linearAttenuation * dist
+                + gl_LightSource[i].quadraticAttenuation * dist * dist);
+            if (gl_LightSource[i].spotCutoff <= 90.0) {
+                float spot = dot(-l, normalize(gl_LightSource[i].spotDirection));
+                attenuation *= spot >= gl_LightSource[i].spotCosCutoff ? pow(max(spot, 0.0), gl_LightSource[i].spotExponent) : 0.0;
+            }
+        }
 
-    if (model.textureId > 0) {
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glDisable(GL_TEXTURE_2D);
+        float diffuse = max(dot(n, l), 0.0);
+        vec4 lit = material.ambient * gl_LightSource[i].ambient + diffuse * material.diffuse * gl_LightSource[i].diffuse;
+        if (diffuse > 0.0) {
+            vec3 h = normalize(l + vec3(0.0, 0.0, 1.0));
+            lit += pow(max(dot(n, h), 0.0), material.shininess) * material.specular * gl_LightSource[i].specular;
+        }
+        color += attenuation * lit;
     }
+    color.a = material.diffuse.a;
+    return clamp(color, 0.0, 1.0);
+}
+)";
+
+const char* vertexShaderSource = R"(
+attribute vec4 position;
+attribute vec4 normal;
+attribute vec2 texCoord;
+
+#ifdef INSTANCED
+attribute mat4 instanceMatrix;
+attribute mat3 instanceNormalMatrix;
+attribute vec4 instanceDiffuse;
+attribute vec4 instanceAmbient;
+attribute vec4 instanceSpecular;
+attribute vec4 instanceEmissive;
+#endif
 
-    glDisableClientState(GL_VERTEX_ARRAY);
-    glDisableClientState(GL_NORMAL_ARRAY);
-    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-    glBindVertexArray(0);
-    glPopMatrix();
+uniform vec3 boundsMin;
+uniform vec3 boundsExtent;
+uniform vec2 uvMin;
+uniform vec2 uvExtent;
+
+varying vec2 uv;
+
+vec3 octahedralDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
 }
 
+void main() {
+#ifdef QUANTIZED
+    vec3 p = boundsMin + position.xyz * boundsExtent;
+    vec3 n = octahedralDecode(normal.xy);
+    uv = uvMin + texCoord * uvExtent;
+#else
+    vec3 p = position.xyz;
+    vec3 n = normal.xyz;
+    uv = texCoord;
+#endif
+#ifdef INSTANCED
+    vec4 eyePosition = gl_ModelViewMatrix * (instanceMatrix * vec4(p, 1.0));
+    n = gl_NormalMatrix * (instanceNormalMatrix * n);
+    SurfaceMaterial material = SurfaceMaterial(instanceDiffuse, instanceAmbient, instanceSpecular,
+        vec4(instanceEmissive.rgb, 1.0), instanceEmissive.w);
+#else
+    vec4 eyePosition = gl_ModelViewMatrix * vec4(p, 1.0);
+    n = gl_NormalMatrix * n;
+    SurfaceMaterial material = SurfaceMaterial(gl_FrontMaterial.diffuse, gl_FrontMaterial.ambient,
+        gl_FrontMaterial.specular, gl_FrontMaterial.emission, gl_FrontMaterial.shininess);
+#endif
+    gl_FrontColor = fixedFunctionLighting(eyePosition.xyz, normalize(n), material);
+    gl_Position = gl_ProjectionMatrix * eyePosition;
+}
+)";
 
-void renderGroup(const Group& group) {
-    glPushMatrix();
+// Bicubic Bezier patches, 16 control points each in the order of the patch file. The vertex
+// stage passes the points through; the control stage picks how finely to cut each patch edge.
+const char* patchVertexShaderSource = R"(
+in vec4 position;
 
-    if (group.transform.hasScale) {
-        glScalef(group.transform.scale.x, group.transform.scale.y, group.transform.scale.z);
+void main() {
+    gl_Position = vec4(position.xyz, 1.0);
+}
+)";
+
+// Each edge is cut into about one segment per patchSegmentPixels of its projected length, from
+// its eye-space length and distance. Edges are measured on their own 4 control points only, so
+// patches that share an edge agree on it and no cracks open between them.
+const float patchSegmentPixels = 8.0f;
+
+const char* patchControlShaderSource = R"(
+layout(vertices = 16) out;
+
+uniform float tessellationScale;
+
+float edgeLevel(int i0, int i1, int i2, int i3) {
+    vec3 p0 = (gl_ModelViewMatrix * gl_in[i0].gl_Position).xyz;
+    vec3 p1 = (gl_ModelViewMatrix * gl_in[i1].gl_Position).xyz;
+    vec3 p2 = (gl_ModelViewMatrix * gl_in[i2].gl_Position).xyz;
+    vec3 p3 = (gl_ModelViewMatrix * gl_in[i3].gl_Position).xyz;
+    float size = distance(p1, p2) + (distance(p0, p1) + distance(p2, p3));
+    vec3 middle = ((p0 + p3) + 3.0 * (p1 + p2)) / 8.0;
+    return clamp(tessellationScale * size / max(length(middle), 1e-4), 1.0, float(gl_MaxTessGenLevel));
+}
+
+void main() {
+    gl_out[gl_InvocationID].gl_Position = gl_in[gl_InvocationID].gl_Position;
+    if (gl_InvocationID == 0) {
+        gl_TessLevelOuter[0] = edgeLevel(0, 1, 2, 3);
+        gl_TessLevelOuter[1] = edgeLevel(0, 4, 8, 12);
+        gl_TessLevelOuter[2] = edgeLevel(12, 13, 14, 15);
+        gl_TessLevelOuter[3] = edgeLevel(3, 7, 11, 15);
+        gl_TessLevelInner[0] = max(gl_TessLevelOuter[1], gl_TessLevelOuter[3]);
+        gl_TessLevelInner[1] = max(gl_TessLevelOuter[0], gl_TessLevelOuter[2]);
     }
+}
+)";
 
-    if (group.transform.rotate.active) {
-        float angle = group.transform.rotate.angle;
-        if (group.transform.rotate.time > 0) {
-            float currentTime = glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
-            angle = fmod(currentTime * (360.0f / group.transform.rotate.time), 360.0f);
+// Same surface, normal and texture coordinates as primitives::buildPatches
+const char* patchEvaluationShaderSource = R"(
+layout(quads, equal_spacing, ccw) in;
+
+out vec2 uv;
+
+vec4 bernstein(float t) {
+    float s = 1.0 - t;
+    return vec4(s * s * s, 3.0 * t * s * s, 3.0 * t * t * s, t * t * t);
+}
+
+vec4 bernsteinDerivative(float t) {
+    float s = 1.0 - t;
+    return vec4(-3.0 * s * s, 3.0 * s * s - 6.0 * t * s, 6.0 * t * s - 3.0 * t * t, 3.0 * t * t);
+}
+
+void main() {
+    float u = gl_TessCoord.x;
+    float v = gl_TessCoord.y;
+    vec4 bu = bernstein(u), bv = bernstein(v);
+    vec4 du = bernsteinDerivative(u), dv = bernsteinDerivative(v);
+
+    vec3 p = vec3(0.0), tangentU = vec3(0.0), tangentV = vec3(0.0);
+    for (int a = 0; a < 4; ++a) {
+        for (int b = 0; b < 4; ++b) {
+            vec3 point = gl_in[a * 4 + b].gl_Position.xyz;
+            p += bu[a] * bv[b] * point;
+            tangentU += du[a] * bv[b] * point;
+            tangentV += bu[a] * dv[b] * point;
         }
-        glRotatef(angle, group.transform.rotate.axis.x, group.transform.rotate.axis.y, group.transform.rotate.axis.z);
     }
+    vec3 n = cross(tangentU, tangentV);
+    n = dot(n, n) > 0.0 ? normalize(n) : vec3(0.0, 1.0, 0.0);
+    uv = vec2(u, 1.0 - v);
+
+    vec4 eyePosition = gl_ModelViewMatrix * vec4(p, 1.0);
+    SurfaceMaterial material = SurfaceMaterial(gl_FrontMaterial.diffuse, gl_FrontMaterial.ambient,
+        gl_FrontMaterial.specular, gl_FrontMaterial.emission, gl_FrontMaterial.shininess);
+    gl_FrontColor = fixedFunctionLighting(eyePosition.xyz, normalize(gl_NormalMatrix * n), material);
+    gl_Position = gl_ProjectionMatrix * eyePosition;
+}
+)";
 
-    if (group.transform.translate.active && !group.transform.translate.controlPoints.empty()) {
-        drawCatmullRomCurve(group.transform.translate.controlPoints);
+const char* fragmentShaderSource = R"(
+uniform sampler2D texture0;
+uniform int useTexture;
 
-        if (group.transform.translate.time > 0 && group.transform.translate.align) {
-            float t = fmod(glutGet(GLUT_ELAPSED_TIME) / 1000.0f, group.transform.translate.time) / group.transform.translate.time;
-            Point3D pos;
-            interpolateCatmullRom(group.transform.translate.controlPoints, t, pos);
-            glTranslatef(pos.x, pos.y, pos.z);
-        }
-        else {
-            glTranslatef(group.transform.translate.controlPoints[0].x,
-                group.transform.translate.controlPoints[0].y,
-                group.transform.translate.controlPoints[0].z);
-        }
+varying vec2 uv;
+
+void main() {
+    gl_FragColor = useTexture != 0 ? gl_Color * texture2D(texture0, uv) : gl_Color;
+}
+)";
+
+GLuint compileShader(GLenum type, const std::string& source) {
+    GLuint shader = glCreateShader(type);
+    const char* text = source.c_str();
+    glShaderSource(shader, 1, &text, nullptr);
+    glCompileShader(shader);
+
+    GLint status;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status) {
+        char log[2048];
+        glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        std::cerr << "Erro ao compilar shader: " << log << std::endl;
+        glDeleteShader(shader);
+        return 0;
     }
+    return shader;
+}
 
-    for (const Model& model : group.models) {
-        renderModel(model);
+ShaderProgram createProgram(unsigned int flags) {
+    // Tessellation stages need GLSL 4.00; its compatibility profile still sees the glLight state
+    std::string header = flags & PROGRAM_PATCHES ? "#version 400 compatibility\n" : "#version 120\n";
+    if (flags & PROGRAM_QUANTIZED) header += "#define QUANTIZED\n";
+    if (flags & PROGRAM_INSTANCED) header += "#define INSTANCED\n";
+
+    ShaderProgram program;
+    std::vector<GLuint> shaders;
+    if (flags & PROGRAM_PATCHES) {
+        shaders.push_back(compileShader(GL_VERTEX_SHADER, header + patchVertexShaderSource));
+        shaders.push_back(compileShader(GL_TESS_CONTROL_SHADER, header + patchControlShaderSource));
+        shaders.push_back(compileShader(GL_TESS_EVALUATION_SHADER, header + lightingShaderSource + patchEvaluationShaderSource));
+    }
+    else {
+        shaders.push_back(compileShader(GL_VERTEX_SHADER, header + lightingShaderSource + vertexShaderSource));
+    }
+    shaders.push_back(compileShader(GL_FRAGMENT_SHADER, header + fragmentShaderSource));
+    if (std::find(shaders.begin(), shaders.end(), 0u) != shaders.end()) {
+        for (GLuint shader : shaders) glDeleteShader(shader);
+        return program;
     }
 
-    for (const Group& child : group.children) {
-        renderGroup(child);
+    program.id = glCreateProgram();
+    for (GLuint shader : shaders) glAttachShader(program.id, shader);
+    glBindAttribLocation(program.id, 0, "position");
+    glBindAttribLocation(program.id, 1, "normal");
+    glBindAttribLocation(program.id, 2, "texCoord");
+    if (flags & PROGRAM_INSTANCED) {
+        glBindAttribLocation(program.id, 3, "instanceMatrix");
+        glBindAttribLocation(program.id, 7, "instanceNormalMatrix");
+        glBindAttribLocation(program.id, 10, "instanceDiffuse");
+        glBindAttribLocation(program.id, 11, "instanceAmbient");
+        glBindAttribLocation(program.id, 12, "instanceSpecular");
+        glBindAttribLocation(program.id, 13, "instanceEmissive");
+    }
+    glLinkProgram(program.id);
+    for (GLuint shader : shaders) glDeleteShader(shader);
+
+    GLint status;
+    glGetProgramiv(program.id, GL_LINK_STATUS, &status);
+    if (!status) {
+        char log[2048];
+        glGetProgramInfoLog(program.id, sizeof(log), nullptr, log);
+        std::cerr << "Erro ao ligar programa: " << log << std::endl;
+        glDeleteProgram(program.id);
+        program.id = 0;
+        return program;
     }
 
-    glPopMatrix();
+    program.boundsMin = glGetUniformLocation(program.id, "boundsMin");
+    program.boundsExtent = glGetUniformLocation(program.id, "boundsExtent");
+    program.uvMin = glGetUniformLocation(program.id, "uvMin");
+    program.uvExtent = glGetUniformLocation(program.id, "uvExtent");
+    program.lightCount = glGetUniformLocation(program.id, "lightCount");
+    program.useTexture = glGetUniformLocation(program.id, "useTexture");
+    program.tessellationScale = glGetUniformLocation(program.id, "tessellationScale");
+
+    glState.useProgram(program.id);
+    glUniform1i(glGetUniformLocation(program.id, "texture0"), 0);
+    glState.useProgram(0);
+    return program;
 }
 
-void drawAxes() {
-    glDisable(GL_LIGHTING);
-    glDisable(GL_TEXTURE_2D);
-    glBegin(GL_LINES);
+const ShaderProgram& getProgram(unsigned int flags) {
+    static std::unordered_map<unsigned int, ShaderProgram> programs;
+    auto found = programs.find(flags);
+    if (found == programs.end()) {
+        found = programs.emplace(flags, createProgram(flags)).first;
+    }
+    return found->second;
+}
+
+// The program a mesh cannot be drawn without, or 0 when fixed-function can draw it
+unsigned int programFlags(const Mesh& mesh) {
+    if (mesh.patches) return PROGRAM_PATCHES;
+    return mesh.quantized ? PROGRAM_QUANTIZED : 0;
+}
+
+void bindModelProgram(const Model& model, unsigned int flags = 0) {
+    const Mesh& mesh = *model.mesh;
+    flags |= programFlags(mesh);
+    const ShaderProgram& program = getProgram(flags);
+    glState.useProgram(program.id);
+    glUniform1i(program.lightCount, static_cast<GLint>(worldConfig.lights.size()));
+    glUniform1i(program.useTexture, model.textureId > 0 ? 1 : 0);
+
+    if (mesh.quantized) {
+        const QuantizedVertices& packed = mesh.packed;
+        glUniform3f(program.boundsMin, packed.boundsMin.x, packed.boundsMin.y, packed.boundsMin.z);
+        glUniform3f(program.boundsExtent, packed.boundsMax.x - packed.boundsMin.x,
+            packed.boundsMax.y - packed.boundsMin.y, packed.boundsMax.z - packed.boundsMin.z);
+        glUniform2f(program.uvMin, packed.uvMin.u, packed.uvMin.v);
+        glUniform2f(program.uvExtent, packed.uvMax.u - packed.uvMin.u, packed.uvMax.v - packed.uvMin.v);
+    }
+    if (mesh.patches) {
+        // The viewport reshape last set, which also covers renders into other targets
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        const Camera& camera = worldConfig.camera;
+        float pixelsPerUnit = viewport[3] / (2.0f * std::tan(camera.projection.fov * static_cast<float>(M_PI) / 360.0f));
+        glUniform1f(program.tessellationScale, pixelsPerUnit / patchSegmentPixels);
+    }
+}
+
+// Every float mesh is suballocated from one vertex buffer and one index buffer with a single
+// interleaved format behind a single VAO, so going from mesh to mesh binds nothing and the
+// instanced path can submit a whole frame with a few multi-draw calls.
+struct GeometryPool {
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    GLuint ibo = 0;
+    size_t vertexCount = 0;
+    size_t vertexCapacity = 0;
+    size_t indexCount = 0;
+    size_t indexCapacity = 0;
+    // Ranges below the counts that unloaded meshes gave back, start -> length, never adjacent
+    std::map<size_t, size_t> freeVertices;
+    std::map<size_t, size_t> freeIndices;
+};
+
+// First fit among the freed ranges; false when none is long enough
+bool takeRange(std::map<size_t, size_t>& ranges, size_t count, size_t& start) {
+    for (auto it = ranges.begin(); it != ranges.end(); ++it) {
+        if (it->second < count) continue;
+        start = it->first;
+        size_t rest = it->second - count;
+        ranges.erase(it);
+        if (rest > 0) ranges[start + count] = rest;
+        return true;
+    }
+    return false;
+}
+
+// Merges the range with its free neighbours; one that reaches the end lowers used instead
+void releaseRange(std::map<size_t, size_t>& ranges, size_t& used, size_t start, size_t count) {
+    if (count == 0) return;
+    auto next = ranges.find(start + count);
+    if (next != ranges.end()) {
+        count += next->second;
+        ranges.erase(next);
+    }
+    auto previous = ranges.lower_bound(start);
+    if (previous != ranges.begin() && std::prev(previous)->first + std::prev(previous)->second == start) {
+        --previous;
+        start = previous->first;
+        count += previous->second;
+        ranges.erase(previous);
+    }
+    if (start + count == used) used = start;
+    else ranges[start] = count;
+}
+
+struct PoolVertex {
+    Point3D position;
+    Vector3 normal;
+    Vector2 texCoord;
+};
+
+GeometryPool geometryPool;
+
+// Pooled meshes are drawn from their place in the shared buffers, the rest from offset zero
+void drawMesh(const Mesh& mesh) {
+    const void* indexOffset = reinterpret_cast<const void*>(mesh.firstIndex * sizeof(unsigned int));
+    if (mesh.patches) {
+        glPatchParameteri(GL_PATCH_VERTICES, 16);
+        glDrawArrays(GL_PATCHES, 0, static_cast<GLsizei>(mesh.vertexCount));
+    }
+    else if (mesh.iboId && mesh.pooled) {
+        glDrawElementsBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(mesh.indexCount), GL_UNSIGNED_INT, indexOffset, mesh.firstVertex);
+    }
+    else if (mesh.iboId) {
+        glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(mesh.indexCount), GL_UNSIGNED_INT, nullptr);
+    }
+    else {
+        glDrawArrays(GL_TRIANGLES, mesh.firstVertex, static_cast<GLsizei>(mesh.vertexCount));
+    }
+}
+
+void drawMeshInstanced(const Mesh& mesh, GLsizei instances) {
+    const void* indexOffset = reinterpret_cast<const void*>(mesh.firstIndex * sizeof(unsigned int));
+    if (mesh.iboId) {
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(mesh.indexCount), GL_UNSIGNED_INT,
+            indexOffset, instances, mesh.firstVertex);
+    }
+    else {
+        glDrawArraysInstanced(GL_TRIANGLES, mesh.firstVertex, static_cast<GLsizei>(mesh.vertexCount), instances);
+    }
+}
+
+// CPU copies stay in float for drawNormals and anything else reading them
+void unpackVertex(Mesh& mesh, size_t v) {
+    const QuantizedVertices& packed = mesh.packed;
+    const uint16_t* position = &packed.positions[v * 4];
+    int ox = packed.normals[v * 2], oy = packed.normals[v * 2 + 1];
+    unsigned int u = packed.texCoords[v * 2], t = packed.texCoords[v * 2 + 1];
+
+    Point3D vertex{
+        packed.boundsMin.x + (packed.boundsMax.x - packed.boundsMin.x) * position[0] / 65535.0f,
+        packed.boundsMin.y + (packed.boundsMax.y - packed.boundsMin.y) * position[1] / 65535.0f,
+        packed.boundsMin.z + (packed.boundsMax.z - packed.boundsMin.z) * position[2] / 65535.0f
+    };
+    float ex = std::max(ox / 32767.0f, -1.0f), ey = std::max(oy / 32767.0f, -1.0f);
+    Vector3 normal{ ex, ey, 1.0f - std::fabs(ex) - std::fabs(ey) };
+    if (normal.z < 0) {
+        float nx = (1.0f - std::fabs(ey)) * (ex >= 0 ? 1.0f : -1.0f);
+        float ny = (1.0f - std::fabs(ex)) * (ey >= 0 ? 1.0f : -1.0f);
+        normal.x = nx;
+        normal.y = ny;
+    }
+    float length = std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+    normal = { normal.x / length, normal.y / length, normal.z / length };
+    Vector2 texCoord{
+        packed.uvMin.u + (packed.uvMax.u - packed.uvMin.u) * u / 65535.0f,
+        packed.uvMin.v + (packed.uvMax.v - packed.uvMin.v) * t / 65535.0f
+    };
+
+    mesh.vertices.push_back(vertex);
+    mesh.normals.push_back(normal);
+    mesh.texCoords.push_back(texCoord);
+}
+
+// Residency: once a scene is loaded and baked, the GPU buffers are the only copy of its vertex
+// data. Drawing and culling need just the counts and bounds kept on the Mesh; picking, baking
+// and the normals view call pageInGeometry, which reads the buffers back into the CPU arrays,
+// and release what it paged in once they are done.
+bool keepCpuGeometry = false;
+
+size_t cpuGeometryBytes(const Mesh& mesh) {
+    const QuantizedVertices& packed = mesh.packed;
+    return mesh.vertices.capacity() * sizeof(Point3D) + mesh.normals.capacity() * sizeof(Vector3)
+        + mesh.texCoords.capacity() * sizeof(Vector2) + mesh.indices.capacity() * sizeof(unsigned int)
+        + packed.positions.capacity() * sizeof(uint16_t) + packed.normals.capacity() * sizeof(int16_t)
+        + packed.texCoords.capacity() * sizeof(uint16_t);
+}
+
+void releaseCpuGeometry(Mesh& mesh) {
+    if (keepCpuGeometry || mesh.vboId == 0) return;
+    std::vector<Point3D>().swap(mesh.vertices);
+    std::vector<Vector3>().swap(mesh.normals);
+    std::vector<Vector2>().swap(mesh.texCoords);
+    std::vector<unsigned int>().swap(mesh.indices);
+    std::vector<uint16_t>().swap(mesh.packed.positions);
+    std::vector<int16_t>().swap(mesh.packed.normals);
+    std::vector<uint16_t>().swap(mesh.packed.texCoords);
+}
+
+// Clears pending GL errors, so readbackFailed reports only those raised after it
+void beginReadback() {
+    while (glGetError() != GL_NO_ERROR) {}
+}
+
+bool readbackFailed() {
+    bool failed = false;
+    while (glGetError() != GL_NO_ERROR) failed = true;
+    return failed;
+}
+
+// Leaves the mesh empty if GL rejects the readback, e.g. when called between glBegin and glEnd.
+// True only when it read the arrays back, so the caller knows to release them again.
+bool pageInGeometry(Mesh& mesh) {
+    if (mesh.vertexCount == 0 || !mesh.vertices.empty()) return false;
+
+    beginReadback();
+    if (mesh.patches) {
+        std::vector<Point3D> points(mesh.vertexCount);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.vboId);
+        glGetBufferSubData(GL_ARRAY_BUFFER, 0, mesh.vertexCount * sizeof(Point3D), points.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        if (readbackFailed()) {
+            std::cerr << "Erro ao ler a geometria da GPU: " << mesh.name << std::endl;
+            return false;
+        }
+        mesh.vertices = std::move(points);
+        return true;
+    }
+
+    // Pooled meshes are interleaved PoolVertex records starting at firstVertex
+    const size_t sizes[3] = {
+        mesh.quantized ? 4 * sizeof(uint16_t) : sizeof(Point3D),
+        mesh.quantized ? 2 * sizeof(int16_t) : sizeof(Vector3),
+        mesh.quantized ? 2 * sizeof(uint16_t) : sizeof(Vector2)
+    };
+    size_t strides[3], end = 0;
+    for (int a = 0; a < 3; ++a) {
+        strides[a] = mesh.stride ? mesh.stride : sizes[a];
+        end = std::max(end, mesh.attributeOffsets[a] + (mesh.vertexCount - 1) * strides[a] + sizes[a]);
+    }
+    size_t base = mesh.pooled ? mesh.firstVertex * sizeof(PoolVertex) : 0;
+    std::vector<unsigned char> data(end);
+    std::vector<unsigned int> indices(mesh.indexCount);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vboId);
+    glGetBufferSubData(GL_ARRAY_BUFFER, base, end, data.data());
+    if (mesh.indexCount > 0) {
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.iboId);
+        glGetBufferSubData(GL_ARRAY_BUFFER, mesh.firstIndex * sizeof(unsigned int), mesh.indexCount * sizeof(unsigned int), indices.data());
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    if (readbackFailed()) {
+        std::cerr << "Erro ao ler a geometria da GPU: " << mesh.name << std::endl;
+        return false;
+    }
+    mesh.indices = std::move(indices);
+
+    if (mesh.quantized) {
+        QuantizedVertices& packed = mesh.packed;
+        packed.positions.resize(mesh.vertexCount * 4);
+        packed.normals.resize(mesh.vertexCount * 2);
+        packed.texCoords.resize(mesh.vertexCount * 2);
+        void* targets[3] = { packed.positions.data(), packed.normals.data(), packed.texCoords.data() };
+        for (size_t v = 0; v < mesh.vertexCount; ++v) {
+            for (int a = 0; a < 3; ++a) {
+                memcpy(static_cast<unsigned char*>(targets[a]) + v * sizes[a], &data[mesh.attributeOffsets[a] + v * strides[a]], sizes[a]);
+            }
+        }
+        for (size_t v = 0; v < mesh.vertexCount; ++v) unpackVertex(mesh, v);
+        return true;
+    }
+
+    mesh.vertices.resize(mesh.vertexCount);
+    mesh.normals.resize(mesh.vertexCount);
+    mesh.texCoords.resize(mesh.vertexCount);
+    void* targets[3] = { mesh.vertices.data(), mesh.normals.data(), mesh.texCoords.data() };
+    for (size_t v = 0; v < mesh.vertexCount; ++v) {
+        for (int a = 0; a < 3; ++a) {
+            memcpy(static_cast<unsigned char*>(targets[a]) + v * sizes[a], &data[mesh.attributeOffsets[a] + v * strides[a]], sizes[a]);
+        }
+    }
+    return true;
+}
+
+void renderModel(const Model& model) {
+    if (!model.mesh) return;
+    const Mesh& mesh = *model.mesh;
+
+    glPushMatrix();
+    glState.bindVertexArray(mesh.vaoId);
+
+    glState.enable(GL_LIGHTING);
+    applyMaterial(model.material);
+
+    if (model.textureId > 0) {
+        glState.enable(GL_TEXTURE_2D);
+        glState.bindTexture(model.textureId);
+        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    }
+    else {
+        glState.disable(GL_TEXTURE_2D);
+    }
+
+    if (programFlags(mesh)) {
+        bindModelProgram(model);
+    }
+    else {
+        glState.useProgram(0);
+    }
+
+    // Culling, texture, program and VAO are left as set: consecutive draws of the same kind
+    // then cost no state changes at all
+    glState.disable(GL_CULL_FACE);
+    drawMesh(mesh);
+    ++frameStats.drawCalls;
+    ++frameStats.instances;
+    glPopMatrix();
+}
+
+
+struct DrawItem {
+    Mat4 world;
+    const Model* model;
+};
+
+// A queued draw: the sort key and the index of the DrawItem it stands for. Keys order draws by
+// program, then texture, then material, then mesh, so neighbours share as much GL state as possible.
+struct DrawPacket {
+    uint64_t key;
+    uint32_t item;
+};
+
+uint64_t makeSortKey(unsigned int program, GLuint texture, unsigned int material, unsigned int mesh) {
+    return (uint64_t(program & 0xF) << 60) | (uint64_t(texture & 0xFFFFF) << 40)
+        | (uint64_t(material & 0xFFFFF) << 20) | uint64_t(mesh & 0xFFFFF);
+}
+
+// Stable LSD radix sort on bytes; passes over bytes that every key shares are skipped
+void radixSort(std::vector<DrawPacket>& packets) {
+    std::vector<DrawPacket> scratch(packets.size());
+    for (int shift = 0; shift < 64; shift += 8) {
+        size_t counts[256] = {};
+        for (const DrawPacket& packet : packets) ++counts[(packet.key >> shift) & 0xFF];
+        if (counts[(packets.empty() ? 0 : packets[0].key >> shift) & 0xFF] == packets.size()) continue;
+
+        size_t offset = 0;
+        for (size_t& count : counts) {
+            size_t bucket = count;
+            count = offset;
+            offset += bucket;
+        }
+        for (const DrawPacket& packet : packets) scratch[counts[(packet.key >> shift) & 0xFF]++] = packet;
+        packets.swap(scratch);
+    }
+}
+
+struct RenderQueue {
+    std::vector<DrawItem> items;
+    std::vector<DrawPacket> packets;
+
+    void push(uint64_t key, const DrawItem& item) {
+        packets.push_back({ key, static_cast<uint32_t>(items.size()) });
+        items.push_back(item);
+    }
+};
+
+// Draws the queue in key order with the fixed-function pipeline (or the program the mesh needs),
+// changing texture, material, program and vertex array only when they differ from the last draw.
+// Item matrices are complete modelviews.
+void submitQueue(RenderQueue& queue) {
+    if (queue.packets.empty()) return;
+    radixSort(queue.packets);
+
+    glPushMatrix();
+    glState.enable(GL_LIGHTING);
+    glState.disable(GL_CULL_FACE);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+    const Mesh* currentMesh = nullptr;
+    GLuint currentTexture = ~0u;
+    unsigned int currentMaterial = ~0u;
+    GLuint currentProgram = ~0u;
+    size_t binds = 0;
+
+    for (const DrawPacket& packet : queue.packets) {
+        const DrawItem& item = queue.items[packet.item];
+        const Model& model = *item.model;
+        const Mesh& mesh = *model.mesh;
+
+        bool textureChanged = model.textureId != currentTexture;
+        if (textureChanged) {
+            if (model.textureId > 0) {
+                glState.enable(GL_TEXTURE_2D);
+                glState.bindTexture(model.textureId);
+            }
+            else {
+                glState.bindTexture(0);
+                glState.disable(GL_TEXTURE_2D);
+            }
+            currentTexture = model.textureId;
+            ++binds;
+        }
+
+        if (model.materialId != currentMaterial) {
+            applyMaterial(model.material);
+            currentMaterial = model.materialId;
+            ++binds;
+        }
+
+        bool meshChanged = &mesh != currentMesh;
+        if (meshChanged) {
+            glState.bindVertexArray(mesh.vaoId);
+            currentMesh = &mesh;
+            ++binds;
+        }
+
+        unsigned int flags = programFlags(mesh);
+        GLuint program = flags ? getProgram(flags).id : 0;
+        if (flags && (program != currentProgram || meshChanged || textureChanged)) {
+            bindModelProgram(model);
+            ++binds;
+        }
+        else if (program != currentProgram) {
+            glState.useProgram(program);
+            ++binds;
+        }
+        currentProgram = program;
+
+        glLoadMatrixf(item.world.m);
+        drawMesh(mesh);
+        ++frameStats.drawCalls;
+        ++frameStats.instances;
+    }
+    frameStats.bindsSaved += queue.packets.size() * 4 - binds;
+
+    glState.useProgram(0);
+    glState.bindVertexArray(0);
+    glState.bindTexture(0);
+    glState.disable(GL_TEXTURE_2D);
+    glState.enable(GL_CULL_FACE);
+    glPopMatrix();
+}
+
+// Walks the hierarchy on the GL matrix stack, drawing the translate curves as it goes and
+// queueing every model that survives frustum culling with its modelview.
+void queueGroup(const Group& group, const Frustum* frustum, RenderQueue& queue) {
+    glPushMatrix();
+
+    if (group.transform.hasScale) {
+        glScalef(group.transform.scale.x, group.transform.scale.y, group.transform.scale.z);
+    }
+
+    if (group.transform.rotate.active) {
+        float angle = rotationAngle(group.transform.rotate, frameTime);
+        glRotatef(angle, group.transform.rotate.axis.x, group.transform.rotate.axis.y, group.transform.rotate.axis.z);
+    }
+
+    if (group.transform.translate.active && !group.transform.translate.controlPoints.empty()) {
+        drawCatmullRomCurve(group.transform.translate.controlPoints);
+
+        Point3D pos = translationAt(group.transform.translate, frameTime);
+        glTranslatef(pos.x, pos.y, pos.z);
+    }
+
+    Mat4 modelView;
+    glGetFloatv(GL_MODELVIEW_MATRIX, modelView.m);
+    if (frustum && !sphereInFrustum(*frustum, modelView, group.bounds)) {
+        frameStats.culled += group.modelCount;
+        glPopMatrix();
+        return;
+    }
+
+    for (const Model& model : group.models) {
+        if (!model.mesh) continue;
+        if (frustum && !modelInFrustum(*frustum, modelView, *model.mesh)) {
+            ++frameStats.culled;
+            continue;
+        }
+        GLuint program = programFlags(*model.mesh);
+        queue.push(makeSortKey(program, model.textureId, model.materialId, model.mesh->id), { modelView, &model });
+    }
+
+    for (const Group& child : group.children) {
+        queueGroup(child, frustum, queue);
+    }
+
+    glPopMatrix();
+}
+
+// Work-stealing pool. Each worker owns a deque: it pushes and pops its own jobs at the back and
+// steals from the front of the others when it runs dry. The thread calling wait() takes part too,
+// using queue 0, so with no spare cores everything simply runs inline.
+class JobSystem {
+public:
+    explicit JobSystem(unsigned int workers) : queues(workers + 1) {
+        for (auto& queue : queues) queue = std::make_unique<WorkQueue>();
+        for (unsigned int i = 1; i <= workers; ++i) {
+            threads.emplace_back([this, i]() { workerLoop(i); });
+        }
+    }
+
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            running = false;
+        }
+        wakeUp.notify_all();
+        for (std::thread& thread : threads) thread.join();
+    }
+
+    unsigned int workerCount() const {
+        return static_cast<unsigned int>(queues.size());
+    }
+
+    void submit(std::function<void()> job) {
+        unsigned int index = currentQueue < queues.size() ? currentQueue : 0;
+        pending.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            queues[index]->jobs.push_back(std::move(job));
+        }
+        // Counted under sleepMutex, so a worker about to sleep either sees the job or gets the notify
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queued.fetch_add(1);
+        wakeUp.notify_one();
+    }
+
+    void wait() {
+        unsigned int previous = currentQueue;
+        if (currentQueue >= queues.size()) currentQueue = 0;
+
+        std::function<void()> job;
+        while (pending.load() > 0) {
+            if (take(currentQueue, job)) run(job);
+            else std::this_thread::yield();
+        }
+        currentQueue = previous;
+    }
+
+private:
+    struct WorkQueue {
+        std::deque<std::function<void()>> jobs;
+        std::mutex mutex;
+    };
+
+    static thread_local unsigned int currentQueue;
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<int> pending{ 0 };
+    // Jobs sitting in the queues, which idle workers sleep until there are
+    std::atomic<int> queued{ 0 };
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    bool running = true;
+
+    bool take(unsigned int index, std::function<void()>& job) {
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            if (!queues[index]->jobs.empty()) {
+                job = std::move(queues[index]->jobs.back());
+                queues[index]->jobs.pop_back();
+                queued.fetch_sub(1);
+                return true;
+            }
+        }
+        for (size_t offset = 1; offset < queues.size(); ++offset) {
+            WorkQueue& victim = *queues[(index + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty()) {
+                job = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+                queued.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(std::function<void()>& job) {
+        job();
+        job = nullptr;
+        pending.fetch_sub(1);
+    }
+
+    void workerLoop(unsigned int index) {
+        currentQueue = index;
+        std::function<void()> job;
+        while (true) {
+            if (take(index, job)) {
+                run(job);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wakeUp.wait(lock, [this]() { return !running || queued.load() > 0; });
+            if (!running) return;
+        }
+    }
+};
+
+thread_local unsigned int JobSystem::currentQueue = ~0u;
+
+JobSystem& getJobSystem() {
+    static JobSystem jobSystem(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return jobSystem;
+}
+
+struct CurveItem {
+    Mat4 world;
+    const std::vector<Point3D>* controlPoints;
+};
+
+// A model placed in the world for the current frame, with its world-space AABB
+struct SceneObject {
+    Mat4 world;
+    const Model* model;
+    Point3D min, max;
+};
+
+// Applies a group's transform on top of its parent's world matrix, recording its curve
+Mat4 placeGroup(const Group& group, const Mat4& parent, std::vector<CurveItem>& curves) {
+    Mat4 world = parent;
+    const Transform& transform = group.transform;
+
+    if (transform.hasScale) {
+        world = multiply(world, scaleMatrix(transform.scale.x, transform.scale.y, transform.scale.z));
+    }
+
+    if (transform.rotate.active) {
+        world = multiply(world, rotationMatrix(rotationAngle(transform.rotate, frameTime),
+            transform.rotate.axis.x, transform.rotate.axis.y, transform.rotate.axis.z));
+    }
+
+    if (transform.translate.active && !transform.translate.controlPoints.empty()) {
+        curves.push_back({ world, &transform.translate.controlPoints });
+        Point3D pos = translationAt(transform.translate, frameTime);
+        world = multiply(world, translationMatrix(pos.x, pos.y, pos.z));
+    }
+    return world;
+}
+
+void placeModels(const Group& group, const Mat4& world, std::vector<SceneObject>& objects) {
+    for (const Model& model : group.models) {
+        if (!model.mesh || model.mesh->bounds.radius < 0) continue;
+        Point3D center, extent;
+        transformBox(world, model.mesh->bounds, center, extent);
+        objects.push_back({ world, &model,
+            { center.x - extent.x, center.y - extent.y, center.z - extent.z },
+            { center.x + extent.x, center.y + extent.y, center.z + extent.z } });
+    }
+}
+
+// Walks the hierarchy the same way queueGroup does, but accumulates the transforms on the CPU
+// and records every model with its world box instead of drawing it.
+void updateGroup(const Group& group, const Mat4& parent, std::vector<SceneObject>& objects, std::vector<CurveItem>& curves) {
+    Mat4 world = placeGroup(group, parent, curves);
+    placeModels(group, world, objects);
+
+    for (const Group& child : group.children) {
+        updateGroup(child, world, objects, curves);
+    }
+}
+
+// Below these sizes the scene is updated and queried on the calling thread alone
+const size_t PARALLEL_UPDATE_MODELS = 1024;
+const size_t PARALLEL_QUERY_NODES = 4096;
+
+// Bounding volume hierarchy over the world-space boxes of the scene objects. It is built with a
+// binned SAH and refitted every frame; when animation has made the refitted tree much worse than
+// the one that was built, it is rebuilt.
+class BVH {
+public:
+    void update(const std::vector<SceneObject>& objects) {
+        bool resized = objects.size() != boxes.size();
+        boxes.resize(objects.size());
+        for (size_t i = 0; i < objects.size(); ++i) {
+            boxes[i] = { objects[i].min, objects[i].max };
+        }
+
+        if (resized || nodes.empty()) {
+            build();
+            return;
+        }
+        refit();
+        if (cost() > builtCost * 1.5f) build();
+    }
+
+    // Appends the indices of the objects whose boxes touch the frustum
+    void queryFrustum(const Frustum& frustum, std::vector<size_t>& result) const {
+        if (nodes.empty()) return;
+        queryFrustum(0, frustum, result);
+    }
+
+    // Same result, in the same order, with the subtrees a few levels below the root queried as
+    // separate jobs into lists of their own
+    void queryFrustum(const Frustum& frustum, std::vector<size_t>& result, JobSystem& jobs) const {
+        if (nodes.size() < PARALLEL_QUERY_NODES || jobs.workerCount() <= 1) {
+            queryFrustum(frustum, result);
+            return;
+        }
+
+        int depth = 0;
+        while ((1u << depth) < jobs.workerCount() * 4) ++depth;
+        std::vector<int> roots;
+        collectSubtrees(0, depth, roots);
+
+        std::vector<std::vector<size_t>> lists(roots.size());
+        for (size_t i = 0; i < roots.size(); ++i) {
+            jobs.submit([this, &frustum, &roots, &lists, i]() { queryFrustum(roots[i], frustum, lists[i]); });
+        }
+        jobs.wait();
+        for (const std::vector<size_t>& list : lists) result.insert(result.end(), list.begin(), list.end());
+    }
+
+    // Appends the indices of the objects whose boxes touch the sphere
+    void queryRange(const Point3D& center, float radius, std::vector<size_t>& result) const {
+        if (nodes.empty()) return;
+        std::vector<int> stack{ 0 };
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            if (boxDistanceSquared(node.min, node.max, center) > radius * radius) continue;
+            if (node.count > 0) {
+                result.insert(result.end(), order.begin() + node.first, order.begin() + node.first + node.count);
+            }
+            else {
+                stack.push_back(node.left);
+                stack.push_back(node.left + 1);
+            }
+        }
+    }
+
+    // Finds the closest object hit by origin + t * direction. hitObject refines a box hit into an
+    // exact one, lowering distance and returning true when the object is hit closer than it.
+    // Returns the object index, or -1 when nothing is hit.
+    int raycast(const Point3D& origin, const Point3D& direction,
+        const std::function<bool(size_t, float&)>& hitObject, float& distance) const {
+        int closest = -1;
+        distance = std::numeric_limits<float>::max();
+        if (nodes.empty()) return closest;
+
+        Point3D inverse{ 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+        std::vector<int> stack{ 0 };
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            if (!rayHitsBox(origin, inverse, node.min, node.max, distance)) continue;
+            if (node.count > 0) {
+                for (int i = node.first; i < node.first + node.count; ++i) {
+                    if (hitObject(order[i], distance)) closest = static_cast<int>(order[i]);
+                }
+            }
+            else {
+                stack.push_back(node.left);
+                stack.push_back(node.left + 1);
+            }
+        }
+        return closest;
+    }
+
+private:
+    struct Node {
+        Point3D min, max;
+        int left = -1;   // inner nodes: children are left and left + 1
+        int first = 0;   // leaves: range of order
+        int count = 0;
+    };
+
+    struct Box {
+        Point3D min, max;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<size_t> order;
+    std::vector<Box> boxes;
+    float builtCost = 0.0f;
+
+    static float surfaceArea(const Point3D& min, const Point3D& max) {
+        float x = max.x - min.x, y = max.y - min.y, z = max.z - min.z;
+        return 2.0f * (x * y + y * z + z * x);
+    }
+
+    static void grow(Point3D& min, Point3D& max, const Point3D& otherMin, const Point3D& otherMax) {
+        min = { std::min(min.x, otherMin.x), std::min(min.y, otherMin.y), std::min(min.z, otherMin.z) };
+        max = { std::max(max.x, otherMax.x), std::max(max.y, otherMax.y), std::max(max.z, otherMax.z) };
+    }
+
+    static float axisValue(const Point3D& p, int axis) {
+        return axis == 0 ? p.x : (axis == 1 ? p.y : p.z);
+    }
+
+    static Point3D boxCenter(const Box& box) {
+        return { (box.min.x + box.max.x) * 0.5f, (box.min.y + box.max.y) * 0.5f, (box.min.z + box.max.z) * 0.5f };
+    }
+
+    static float boxDistanceSquared(const Point3D& min, const Point3D& max, const Point3D& p) {
+        float dx = std::max(std::max(min.x - p.x, 0.0f), p.x - max.x);
+        float dy = std::max(std::max(min.y - p.y, 0.0f), p.y - max.y);
+        float dz = std::max(std::max(min.z - p.z, 0.0f), p.z - max.z);
+        return dx * dx + dy * dy + dz * dz;
+    }
+
+    static bool rayHitsBox(const Point3D& origin, const Point3D& inverse, const Point3D& min, const Point3D& max, float limit) {
+        float tx1 = (min.x - origin.x) * inverse.x, tx2 = (max.x - origin.x) * inverse.x;
+        float ty1 = (min.y - origin.y) * inverse.y, ty2 = (max.y - origin.y) * inverse.y;
+        float tz1 = (min.z - origin.z) * inverse.z, tz2 = (max.z - origin.z) * inverse.z;
+        float tNear = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::min(tz1, tz2));
+        float tFar = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::max(tz1, tz2));
+        return tFar >= std::max(tNear, 0.0f) && tNear <= limit;
+    }
+
+    // Sum of node areas relative to the root, weighted by what each node holds
+    float cost() const {
+        float rootArea = std::max(surfaceArea(nodes[0].min, nodes[0].max), 1e-12f);
+        float total = 0.0f;
+        for (const Node& node : nodes) {
+            total += surfaceArea(node.min, node.max) / rootArea * (node.count > 0 ? node.count : 1);
+        }
+        return total;
+    }
+
+    void build() {
+        nodes.clear();
+        order.resize(boxes.size());
+        for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+        if (boxes.empty()) return;
+
+        nodes.reserve(boxes.size() * 2);
+        nodes.push_back(Node());
+        nodes[0].count = static_cast<int>(boxes.size());
+        subdivide(0);
+        builtCost = cost();
+    }
+
+    void fitNode(Node& node) const {
+        const Box& firstObject = boxes[order[node.first]];
+        node.min = firstObject.min;
+        node.max = firstObject.max;
+        for (int i = node.first + 1; i < node.first + node.count; ++i) {
+            grow(node.min, node.max, boxes[order[i]].min, boxes[order[i]].max);
+        }
+    }
+
+    void subdivide(int index) {
+        fitNode(nodes[index]);
+        if (nodes[index].count <= 2) return;
+
+        const int binCount = 12;
+        const int first = nodes[index].first, count = nodes[index].count;
+
+        Point3D centroidMin = boxCenter(boxes[order[first]]), centroidMax = centroidMin;
+        for (int i = first + 1; i < first + count; ++i) {
+            Point3D center = boxCenter(boxes[order[i]]);
+            grow(centroidMin, centroidMax, center, center);
+        }
+
+        int bestAxis = -1, bestSplit = 0;
+        float bestCost = surfaceArea(nodes[index].min, nodes[index].max) * count;
+        for (int axis = 0; axis < 3; ++axis) {
+            float low = axisValue(centroidMin, axis), high = axisValue(centroidMax, axis);
+            if (high - low < 1e-6f) continue;
+            float scale = binCount / (high - low);
+
+            struct Bin { Point3D min, max; int count = 0; } bins[binCount];
+            for (int i = first; i < first + count; ++i) {
+                const Box& object = boxes[order[i]];
+                float centroid = (axisValue(object.min, axis) + axisValue(object.max, axis)) * 0.5f;
+                Bin& bin = bins[std::min(binCount - 1, static_cast<int>((centroid - low) * scale))];
+                if (bin.count++ == 0) {
+                    bin.min = object.min;
+                    bin.max = object.max;
+                }
+                else grow(bin.min, bin.max, object.min, object.max);
+            }
+
+            // Sweep from the right to get the cost of every split plane in one pass each way
+            float rightArea[binCount];
+            int rightCount[binCount];
+            Point3D boxMin, boxMax;
+            int running = 0;
+            for (int b = binCount - 1; b > 0; --b) {
+                if (bins[b].count > 0) {
+                    if (running == 0) { boxMin = bins[b].min; boxMax = bins[b].max; }
+                    else grow(boxMin, boxMax, bins[b].min, bins[b].max);
+                    running += bins[b].count;
+                }
+                rightCount[b] = running;
+                rightArea[b] = running > 0 ? surfaceArea(boxMin, boxMax) : 0.0f;
+            }
+
+            running = 0;
+            for (int b = 0; b < binCount - 1; ++b) {
+                if (bins[b].count > 0) {
+                    if (running == 0) { boxMin = bins[b].min; boxMax = bins[b].max; }
+                    else grow(boxMin, boxMax, bins[b].min, bins[b].max);
+                    running += bins[b].count;
+                }
+                if (running == 0 || rightCount[b + 1] == 0) continue;
+                float splitCost = surfaceArea(boxMin, boxMax) * running + rightArea[b + 1] * rightCount[b + 1];
+                if (splitCost < bestCost) {
+                    bestCost = splitCost;
+                    bestAxis = axis;
+                    bestSplit = b + 1;
+                }
+            }
+        }
+        if (bestAxis < 0) return;
+
+        float low = axisValue(centroidMin, bestAxis);
+        float scale = binCount / (axisValue(centroidMax, bestAxis) - low);
+        auto middle = std::partition(order.begin() + first, order.begin() + first + count, [&](size_t object) {
+            float centroid = (axisValue(boxes[object].min, bestAxis) + axisValue(boxes[object].max, bestAxis)) * 0.5f;
+            return std::min(binCount - 1, static_cast<int>((centroid - low) * scale)) < bestSplit;
+        });
+        int leftCount = static_cast<int>(middle - (order.begin() + first));
+        if (leftCount == 0 || leftCount == count) return;
+
+        int left = static_cast<int>(nodes.size());
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+        nodes[left].first = first;
+        nodes[left].count = leftCount;
+        nodes[left + 1].first = first + leftCount;
+        nodes[left + 1].count = count - leftCount;
+        nodes[index].left = left;
+        nodes[index].count = 0;
+
+        subdivide(left);
+        subdivide(left + 1);
+    }
+
+    // Children are always stored after their parent, so one backwards pass refits bottom-up
+    void refit() {
+        for (size_t i = nodes.size(); i-- > 0;) {
+            Node& node = nodes[i];
+            if (node.count > 0) {
+                fitNode(node);
+            }
+            else {
+                node.min = nodes[node.left].min;
+                node.max = nodes[node.left].max;
+                grow(node.min, node.max, nodes[node.left + 1].min, nodes[node.left + 1].max);
+            }
+        }
+    }
+
+    void collectSubtrees(int index, int depth, std::vector<int>& roots) const {
+        if (depth == 0 || nodes[index].count > 0) {
+            roots.push_back(index);
+            return;
+        }
+        collectSubtrees(nodes[index].left, depth - 1, roots);
+        collectSubtrees(nodes[index].left + 1, depth - 1, roots);
+    }
+
+    void appendSubtree(int index, std::vector<size_t>& result) const {
+        const Node& node = nodes[index];
+        if (node.count > 0) {
+            result.insert(result.end(), order.begin() + node.first, order.begin() + node.first + node.count);
+            return;
+        }
+        appendSubtree(node.left, result);
+        appendSubtree(node.left + 1, result);
+    }
+
+    enum Containment { OUTSIDE, INTERSECTING, INSIDE };
+
+    static Containment classify(const Frustum& frustum, const Point3D& min, const Point3D& max) {
+        Point3D center{ (min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f, (min.z + max.z) * 0.5f };
+        Point3D extent{ (max.x - min.x) * 0.5f, (max.y - min.y) * 0.5f, (max.z - min.z) * 0.5f };
+
+        Containment result = INSIDE;
+        for (const float* plane : frustum.planes) {
+            float distance = plane[0] * center.x + plane[1] * center.y + plane[2] * center.z + plane[3];
+            float reach = std::fabs(plane[0]) * extent.x + std::fabs(plane[1]) * extent.y + std::fabs(plane[2]) * extent.z;
+            if (distance + reach < 0) return OUTSIDE;
+            if (distance - reach < 0) result = INTERSECTING;
+        }
+        return result;
+    }
+
+    void queryFrustum(int index, const Frustum& frustum, std::vector<size_t>& result) const {
+        const Node& node = nodes[index];
+        Containment containment = classify(frustum, node.min, node.max);
+        if (containment == OUTSIDE) return;
+        if (containment == INSIDE) {
+            appendSubtree(index, result);
+            return;
+        }
+
+        if (node.count > 0) {
+            for (int i = node.first; i < node.first + node.count; ++i) {
+                if (classify(frustum, boxes[order[i]].min, boxes[order[i]].max) != OUTSIDE) result.push_back(order[i]);
+            }
+            return;
+        }
+        queryFrustum(node.left, frustum, result);
+        queryFrustum(node.left + 1, frustum, result);
+    }
+};
+
+std::vector<SceneObject> sceneObjects;
+BVH sceneBVH;
+
+std::vector<CurveItem> sceneCurves;
+
+Mat4 cameraProjection = identityMatrix();
+Mat4 cameraView = identityMatrix();
+
+struct UpdateJob {
+    const Group* group;
+    Mat4 parent;
+    std::vector<SceneObject> objects;
+    std::vector<CurveItem> curves;
+
+    UpdateJob(const Group* group, const Mat4& parent) : group(group), parent(parent) {}
+};
+
+// Places every model for the current frame and brings the BVH up to date. Large scenes are cut
+// into subtrees that the job system places in parallel, each into lists of its own; the lists
+// are joined in a fixed order, so an object keeps its index from one frame to the next.
+void updateScene() {
+    sceneObjects.clear();
+    sceneCurves.clear();
+    JobSystem& jobs = getJobSystem();
+
+    size_t modelCount = 0;
+    for (const auto& group : worldConfig.groups) modelCount += group.modelCount;
+    if (jobs.workerCount() <= 1 || modelCount < PARALLEL_UPDATE_MODELS) {
+        for (const auto& group : worldConfig.groups) {
+            updateGroup(group, identityMatrix(), sceneObjects, sceneCurves);
+        }
+        sceneBVH.update(sceneObjects);
+        return;
+    }
+
+    // Keep splitting the largest subtree until there are a few jobs per worker. The groups split
+    // along the way are placed here, ahead of the jobs.
+    std::vector<UpdateJob> updates;
+    for (const auto& group : worldConfig.groups) updates.emplace_back(&group, identityMatrix());
+    while (updates.size() < jobs.workerCount() * 4) {
+        size_t largest = updates.size();
+        for (size_t i = 0; i < updates.size(); ++i) {
+            const Group& group = *updates[i].group;
+            if (group.children.empty()) continue;
+            if (largest == updates.size() || group.modelCount > updates[largest].group->modelCount) largest = i;
+        }
+        if (largest == updates.size() || updates[largest].group->modelCount < PARALLEL_UPDATE_MODELS / 8) break;
+
+        const Group& group = *updates[largest].group;
+        Mat4 world = placeGroup(group, updates[largest].parent, sceneCurves);
+        placeModels(group, world, sceneObjects);
+        std::vector<UpdateJob> children;
+        for (const Group& child : group.children) children.emplace_back(&child, world);
+        updates.erase(updates.begin() + largest);
+        updates.insert(updates.begin() + largest, children.begin(), children.end());
+    }
+
+    for (UpdateJob& update : updates) {
+        UpdateJob* job = &update;
+        jobs.submit([job]() { updateGroup(*job->group, job->parent, job->objects, job->curves); });
+    }
+    jobs.wait();
+
+    for (const UpdateJob& update : updates) {
+        sceneObjects.insert(sceneObjects.end(), update.objects.begin(), update.objects.end());
+        sceneCurves.insert(sceneCurves.end(), update.curves.begin(), update.curves.end());
+    }
+    sceneBVH.update(sceneObjects);
+}
+
+// Moller-Trumbore: lowers distance to the hit of origin + t * direction with abc, if there is a closer one
+bool rayHitsTriangle(const Point3D& a, const Point3D& b, const Point3D& c, const Point3D& origin, const Point3D& direction, float& distance) {
+    Point3D edge1 = subtract(b, a), edge2 = subtract(c, a);
+    Point3D p = cross(direction, edge2);
+    float determinant = dot(edge1, p);
+    if (std::fabs(determinant) < 1e-12f) return false;
+
+    float inverse = 1.0f / determinant;
+    Point3D s = subtract(origin, a);
+    float u = dot(s, p) * inverse;
+    if (u < 0.0f || u > 1.0f) return false;
+    Point3D q = cross(s, edge1);
+    float v = dot(direction, q) * inverse;
+    if (v < 0.0f || u + v > 1.0f) return false;
+
+    float t = dot(edge2, q) * inverse;
+    if (t <= 0.0f || t >= distance) return false;
+    distance = t;
+    return true;
+}
+
+// Patches are tested against their control nets, which the surface stays close to
+bool rayHitsPatches(const Mesh& mesh, const Point3D& origin, const Point3D& direction, float& distance) {
+    bool hit = false;
+    for (size_t first = 0; first + 16 <= mesh.vertices.size(); first += 16) {
+        const Point3D* points = &mesh.vertices[first];
+        for (int a = 0; a < 3; ++a) {
+            for (int b = 0; b < 3; ++b) {
+                const Point3D& p00 = points[a * 4 + b];
+                const Point3D& p01 = points[a * 4 + b + 1];
+                const Point3D& p10 = points[(a + 1) * 4 + b];
+                const Point3D& p11 = points[(a + 1) * 4 + b + 1];
+                if (rayHitsTriangle(p00, p10, p01, origin, direction, distance)) hit = true;
+                if (rayHitsTriangle(p10, p11, p01, origin, direction, distance)) hit = true;
+            }
+        }
+    }
+    return hit;
+}
+
+// Closest hit of origin + t * direction with the mesh's triangles, if below distance
+bool rayHitsMesh(const Mesh& mesh, const Point3D& origin, const Point3D& direction, float& distance) {
+    if (mesh.patches) return rayHitsPatches(mesh, origin, direction, distance);
+
+    bool hit = false;
+    size_t count = mesh.indices.empty() ? mesh.vertices.size() : mesh.indices.size();
+    for (size_t i = 0; i + 2 < count; i += 3) {
+        const Point3D& a = mesh.vertices[mesh.indices.empty() ? i : mesh.indices[i]];
+        const Point3D& b = mesh.vertices[mesh.indices.empty() ? i + 1 : mesh.indices[i + 1]];
+        const Point3D& c = mesh.vertices[mesh.indices.empty() ? i + 2 : mesh.indices[i + 2]];
+        if (rayHitsTriangle(a, b, c, origin, direction, distance)) hit = true;
+    }
+    return hit;
+}
+
+// Casts a ray from the camera through the window pixel and reports the closest model it hits
+void pickModel(int x, int y) {
+    if (!useInstancing) updateScene();
+
+    GLdouble modelView[16], projection[16];
+    for (int i = 0; i < 16; ++i) {
+        modelView[i] = cameraView.m[i];
+        projection[i] = cameraProjection.m[i];
+    }
+    GLint viewport[4] = { 0, 0, worldConfig.window.width, worldConfig.window.height };
+    GLdouble nearX, nearY, nearZ, farX, farY, farZ;
+    gluUnProject(x, viewport[3] - y, 0.0, modelView, projection, viewport, &nearX, &nearY, &nearZ);
+    gluUnProject(x, viewport[3] - y, 1.0, modelView, projection, viewport, &farX, &farY, &farZ);
+
+    Point3D origin{ float(nearX), float(nearY), float(nearZ) };
+    Point3D direction{ float(farX - nearX), float(farY - nearY), float(farZ - nearZ) };
+
+    float distance;
+    std::vector<Mesh*> paged;
+    int picked = sceneBVH.raycast(origin, direction, [&](size_t index, float& closest) {
+        const SceneObject& object = sceneObjects[index];
+        Mat4 inverse = affineInverse(object.world);
+        Point3D localOrigin = transformPoint(inverse, origin);
+        Point3D localEnd = transformPoint(inverse, { origin.x + direction.x, origin.y + direction.y, origin.z + direction.z });
+        if (pageInGeometry(*object.model->mesh)) paged.push_back(object.model->mesh.get());
+        return rayHitsMesh(*object.model->mesh, localOrigin, subtract(localEnd, localOrigin), closest);
+    }, distance);
+    for (Mesh* mesh : paged) releaseCpuGeometry(*mesh);
+
+    if (picked < 0) {
+        std::cout << "Picked nothing" << std::endl;
+        return;
+    }
+
+    const Model& model = *sceneObjects[picked].model;
+    Point3D hit{ origin.x + direction.x * distance, origin.y + direction.y * distance, origin.z + direction.z * distance };
+    std::vector<size_t> nearby;
+    sceneBVH.queryRange(hit, model.mesh->bounds.radius * 4.0f, nearby);
+    size_t others = std::count_if(nearby.begin(), nearby.end(), [&](size_t index) { return index != size_t(picked); });
+    std::cout << "Picked " << model.name << (model.textureFile.empty() ? "" : " (" + model.textureFile + ")")
+        << " at " << hit << ", " << others << " other models nearby" << std::endl;
+}
+
+struct InstanceData {
+    float world[16];
+    float normalMatrix[9];
+    float diffuse[4];
+    float ambient[4];
+    float specular[4];
+    float emissive[4];  // w holds the shininess
+};
+
+GLuint instanceVBO = 0;
+
+void setInstanceAttributes(GLuint buffer, size_t base) {
+    struct { GLuint location; GLint components; size_t offset; } attributes[] = {
+        { 3, 4, offsetof(InstanceData, world) },
+        { 4, 4, offsetof(InstanceData, world) + 4 * sizeof(float) },
+        { 5, 4, offsetof(InstanceData, world) + 8 * sizeof(float) },
+        { 6, 4, offsetof(InstanceData, world) + 12 * sizeof(float) },
+        { 7, 3, offsetof(InstanceData, normalMatrix) },
+        { 8, 3, offsetof(InstanceData, normalMatrix) + 3 * sizeof(float) },
+        { 9, 3, offsetof(InstanceData, normalMatrix) + 6 * sizeof(float) },
+        { 10, 4, offsetof(InstanceData, diffuse) },
+        { 11, 4, offsetof(InstanceData, ambient) },
+        { 12, 4, offsetof(InstanceData, specular) },
+        { 13, 4, offsetof(InstanceData, emissive) },
+    };
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (const auto& attribute : attributes) {
+        glEnableVertexAttribArray(attribute.location);
+        glVertexAttribPointer(attribute.location, attribute.components, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+            reinterpret_cast<void*>(base + attribute.offset));
+        glVertexAttribDivisor(attribute.location, 1);
+    }
+}
+
+void disableInstanceAttributes() {
+    for (GLuint location = 3; location <= 13; ++location) {
+        glVertexAttribDivisor(location, 0);
+        glDisableVertexAttribArray(location);
+    }
+}
+
+struct DrawArraysIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint first;
+    GLuint baseInstance;
+};
+
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// A run of indirect commands that share a texture and index mode, issued by one call
+struct MultiDraw {
+    const Model* model;
+    bool indexed;
+    size_t first;
+    size_t count;
+};
+
+GLuint indirectBuffer = 0;
+
+// Every model that shares a mesh and texture is drawn by one instanced call, with its world
+// matrix and material read per instance. Batches of pooled meshes go further: they become
+// indirect commands, and all the commands of one texture are issued by a single multi-draw call.
+void renderInstanced(const std::vector<DrawItem>& items) {
+    if (items.empty()) return;
+    if (!instanceVBO) glGenBuffers(1, &instanceVBO);
+
+    // Material is per instance here, so it stays out of the key and only texture and mesh split batches
+    std::vector<DrawPacket> packets(items.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        const Model& model = *items[i].model;
+        GLuint program = programFlags(*model.mesh);
+        packets[i] = { makeSortKey(program, model.textureId, 0, model.mesh->id), static_cast<uint32_t>(i) };
+    }
+    radixSort(packets);
+
+    std::vector<const DrawItem*> order(items.size());
+    for (size_t i = 0; i < packets.size(); ++i) order[i] = &items[packets[i].item];
+
+    // Instance data is written straight into the frame ring when it has room
+    size_t instanceOffset = 0;
+    GLuint instanceBuffer = frameRing.buffer();
+    std::vector<InstanceData> fallback;
+    InstanceData* instances = useFrameRing
+        ? static_cast<InstanceData*>(frameRing.allocate(order.size() * sizeof(InstanceData), instanceOffset)) : nullptr;
+    if (!instances) {
+        fallback.resize(order.size());
+        instances = fallback.data();
+        instanceOffset = 0;
+        instanceBuffer = instanceVBO;
+    }
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        InstanceData& instance = instances[i];
+        const Material& material = order[i]->model->material;
+        memcpy(instance.world, order[i]->world.m, sizeof(instance.world));
+        normalMatrix(order[i]->world, instance.normalMatrix);
+        float diffuse[4] = { material.diffuse.r, material.diffuse.g, material.diffuse.b, 1.0f };
+        float ambient[4] = { material.ambient.r, material.ambient.g, material.ambient.b, 1.0f };
+        float specular[4] = { material.specular.r, material.specular.g, material.specular.b, 1.0f };
+        float emissive[4] = { material.emissive.r, material.emissive.g, material.emissive.b, material.shininess };
+        memcpy(instance.diffuse, diffuse, sizeof(diffuse));
+        memcpy(instance.ambient, ambient, sizeof(ambient));
+        memcpy(instance.specular, specular, sizeof(specular));
+        memcpy(instance.emissive, emissive, sizeof(emissive));
+    }
+
+    if (!fallback.empty()) {
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, fallback.size() * sizeof(InstanceData), fallback.data(), GL_STREAM_DRAW);
+    }
+
+    glState.disable(GL_CULL_FACE);
+    glActiveTexture(GL_TEXTURE0);
+
+    const Mesh* currentMesh = nullptr;
+    GLuint currentTexture = ~0u;
+    size_t binds = 0;
+
+    // A command's baseInstance points the instance attributes at its batch's slice of the
+    // instance buffer, which is how each draw of a multi-draw finds its own data
+    std::vector<DrawArraysIndirectCommand> arrayCommands;
+    std::vector<DrawElementsIndirectCommand> elementCommands;
+    std::vector<MultiDraw> multiDraws;
+    size_t openArrays = SIZE_MAX, openElements = SIZE_MAX;
+
+    size_t begin = 0;
+    while (begin < order.size()) {
+        const Model& model = *order[begin]->model;
+        const Mesh& mesh = *model.mesh;
+        size_t end = begin + 1;
+        while (end < order.size() && order[end]->model->mesh.get() == &mesh && order[end]->model->textureId == model.textureId) {
+            ++end;
+        }
+        GLsizei count = static_cast<GLsizei>(end - begin);
+        frameStats.instances += count;
+
+        // The tessellation program reads no instance attributes, so patches are drawn one model at a time
+        if (mesh.patches) {
+            glState.bindVertexArray(mesh.vaoId);
+            glState.bindTexture(model.textureId);
+            bindModelProgram(model);
+            binds += 3;
+            for (size_t i = begin; i < end; ++i) {
+                glPushMatrix();
+                glMultMatrixf(order[i]->world.m);
+                applyMaterial(order[i]->model->material);
+                drawMesh(mesh);
+                glPopMatrix();
+                ++frameStats.drawCalls;
+            }
+            currentMesh = &mesh;
+            currentTexture = model.textureId;
+            begin = end;
+            continue;
+        }
+
+        if (useMultiDraw && mesh.pooled) {
+            bool indexed = mesh.iboId != 0;
+            size_t& open = indexed ? openElements : openArrays;
+            if (open == SIZE_MAX || multiDraws[open].model->textureId != model.textureId) {
+                open = multiDraws.size();
+                multiDraws.push_back({ &model, indexed, indexed ? elementCommands.size() : arrayCommands.size(), 0 });
+            }
+            ++multiDraws[open].count;
+
+            GLuint baseInstance = static_cast<GLuint>(begin);
+            if (indexed) {
+                elementCommands.push_back({ static_cast<GLuint>(mesh.indexCount), static_cast<GLuint>(count),
+                    mesh.firstIndex, mesh.firstVertex, baseInstance });
+            }
+            else {
+                arrayCommands.push_back({ static_cast<GLuint>(mesh.vertexCount), static_cast<GLuint>(count),
+                    static_cast<GLuint>(mesh.firstVertex), baseInstance });
+            }
+            begin = end;
+            continue;
+        }
+
+        bool meshChanged = &mesh != currentMesh;
+        if (meshChanged) {
+            glState.bindVertexArray(mesh.vaoId);
+            ++binds;
+        }
+        setInstanceAttributes(instanceBuffer, instanceOffset + begin * sizeof(InstanceData));
+        if (meshChanged || model.textureId != currentTexture) {
+            bindModelProgram(model, PROGRAM_INSTANCED);
+            ++binds;
+        }
+        if (model.textureId != currentTexture) {
+            glState.bindTexture(model.textureId);
+            ++binds;
+        }
+        currentMesh = &mesh;
+        currentTexture = model.textureId;
+
+        drawMeshInstanced(mesh, count);
+        ++frameStats.drawCalls;
+
+        disableInstanceAttributes();
+        begin = end;
+    }
+
+    if (!multiDraws.empty()) {
+        size_t arrayBytes = arrayCommands.size() * sizeof(DrawArraysIndirectCommand);
+        size_t elementBytes = elementCommands.size() * sizeof(DrawElementsIndirectCommand);
+        size_t commandOffset = 0;
+        unsigned char* commands = useFrameRing
+            ? static_cast<unsigned char*>(frameRing.allocate(arrayBytes + elementBytes, commandOffset)) : nullptr;
+        if (commands) {
+            memcpy(commands, arrayCommands.data(), arrayBytes);
+            memcpy(commands + arrayBytes, elementCommands.data(), elementBytes);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, frameRing.buffer());
+        }
+        else {
+            if (!indirectBuffer) glGenBuffers(1, &indirectBuffer);
+            commandOffset = 0;
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, arrayBytes + elementBytes, nullptr, GL_STREAM_DRAW);
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, arrayBytes, arrayCommands.data());
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, arrayBytes, elementBytes, elementCommands.data());
+        }
+
+        glState.bindVertexArray(geometryPool.vao);
+        setInstanceAttributes(instanceBuffer, instanceOffset);
+        ++binds;
+
+        // The per-batch draws above may have left another program bound
+        currentTexture = ~0u;
+        for (const MultiDraw& draw : multiDraws) {
+            if (draw.model->textureId != currentTexture) {
+                bindModelProgram(*draw.model, PROGRAM_INSTANCED);
+                glState.bindTexture(draw.model->textureId);
+                currentTexture = draw.model->textureId;
+                binds += 2;
+            }
+            if (draw.indexed) {
+                glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                    reinterpret_cast<const void*>(commandOffset + arrayBytes + draw.first * sizeof(DrawElementsIndirectCommand)),
+                    static_cast<GLsizei>(draw.count), 0);
+            }
+            else {
+                glMultiDrawArraysIndirect(GL_TRIANGLES,
+                    reinterpret_cast<const void*>(commandOffset + draw.first * sizeof(DrawArraysIndirectCommand)),
+                    static_cast<GLsizei>(draw.count), 0);
+            }
+            ++frameStats.drawCalls;
+        }
+
+        disableInstanceAttributes();
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+    frameStats.bindsSaved += order.size() * 3 - binds;
+
+    glState.bindTexture(0);
+    glState.useProgram(0);
+    glState.bindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glState.enable(GL_CULL_FACE);
+}
+
+void drawCurves(const std::vector<CurveItem>& curves) {
+    for (const CurveItem& curve : curves) {
+        glPushMatrix();
+        glMultMatrixf(curve.world.m);
+        drawCatmullRomCurve(*curve.controlPoints);
+        glPopMatrix();
+    }
+}
+
+// Occlusion culling with hardware queries and one frame of latency: after a frame is drawn, the
+// bounding box of every small object that was in the frustum is tested against its depth
+// buffer, and objects whose box produced no samples are skipped the next frame. Objects that
+// cover much of the screen are occluders: never tested, and drawn before everything else.
+bool useOcclusion = true;
+const float occluderScreenFraction = 0.1f;
+
+std::vector<GLuint> occlusionQueries;
+std::vector<unsigned char> occlusionVisible;
+std::vector<size_t> pendingQueries;
+GLuint occlusionBoxVAO = 0;
+GLuint occlusionBoxVBO = 0;
+
+// Reads what the queries issued last frame found; objects without a finished query count as visible.
+// Returns false while results are missing or changed, since the next frame may then look different.
+bool readOcclusionResults() {
+    if (occlusionQueries.size() != sceneObjects.size()) {
+        if (!occlusionQueries.empty()) glDeleteQueries(static_cast<GLsizei>(occlusionQueries.size()), occlusionQueries.data());
+        occlusionQueries.assign(sceneObjects.size(), 0);
+        if (!occlusionQueries.empty()) glGenQueries(static_cast<GLsizei>(occlusionQueries.size()), occlusionQueries.data());
+        pendingQueries.clear();
+    }
+
+    std::vector<unsigned char> previous;
+    previous.swap(occlusionVisible);
+    occlusionVisible.assign(sceneObjects.size(), 1);
+    bool settled = true;
+    for (size_t index : pendingQueries) {
+        GLuint available = 0;
+        glGetQueryObjectuiv(occlusionQueries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            settled = false;
+            continue;
+        }
+
+        GLuint anySamples = 0;
+        glGetQueryObjectuiv(occlusionQueries[index], GL_QUERY_RESULT, &anySamples);
+        occlusionVisible[index] = anySamples != 0;
+    }
+    pendingQueries.clear();
+    return settled && occlusionVisible == previous;
+}
+
+// Splits the frustum-visible objects into occluders, objects to draw and objects to query
+void classifyOcclusion(const std::vector<size_t>& visible, std::vector<DrawItem>& occluders,
+    std::vector<DrawItem>& items, std::vector<size_t>& tested) {
+    const Camera& camera = worldConfig.camera;
+    Point3D eye{ camera.position.x, camera.position.y, camera.position.z };
+    float pixelsPerUnit = worldConfig.window.height / (2.0f * std::tan(camera.projection.fov * static_cast<float>(M_PI) / 360.0f));
+    float margin = camera.projection.near;
+
+    for (size_t index : visible) {
+        const SceneObject& object = sceneObjects[index];
+        DrawItem item{ object.world, object.model };
+
+        // A box around the eye would be clipped by the near plane and report nothing
+        if (eye.x > object.min.x - margin && eye.x < object.max.x + margin &&
+            eye.y > object.min.y - margin && eye.y < object.max.y + margin &&
+            eye.z > object.min.z - margin && eye.z < object.max.z + margin) {
+            occluders.push_back(item);
+            continue;
+        }
+
+        Point3D center{ (object.min.x + object.max.x) * 0.5f, (object.min.y + object.max.y) * 0.5f, (object.min.z + object.max.z) * 0.5f };
+        float radius = length(subtract(object.max, center));
+        float projected = radius / length(subtract(center, eye)) * pixelsPerUnit;
+        if (projected > occluderScreenFraction * worldConfig.window.height) {
+            occluders.push_back(item);
+            continue;
+        }
+
+        tested.push_back(index);
+        if (occlusionVisible[index]) items.push_back(item);
+        else ++frameStats.occluded;
+    }
+}
+
+// Draws the boxes of the tested objects, depth-tested but invisible, each inside its own query
+void issueOcclusionQueries(const std::vector<size_t>& tested) {
+    if (tested.empty()) return;
+
+    if (!occlusionBoxVAO) {
+        // Unit cube as 12 triangles
+        const float corners[8][3] = { {0,0,0}, {1,0,0}, {1,1,0}, {0,1,0}, {0,0,1}, {1,0,1}, {1,1,1}, {0,1,1} };
+        const int faces[36] = { 0,2,1, 0,3,2, 4,5,6, 4,6,7, 0,1,5, 0,5,4, 3,7,6, 3,6,2, 0,4,7, 0,7,3, 1,2,6, 1,6,5 };
+        float vertices[36 * 3];
+        for (int i = 0; i < 36; ++i) memcpy(&vertices[i * 3], corners[faces[i]], sizeof(corners[0]));
+
+        glGenVertexArrays(1, &occlusionBoxVAO);
+        glState.bindVertexArray(occlusionBoxVAO);
+        glGenBuffers(1, &occlusionBoxVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, occlusionBoxVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, 0, nullptr);
+        glState.bindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // glPopAttrib restores the capabilities behind the cache's back, so its copy is restored with them
+    std::unordered_map<GLenum, GLStateCache::Value> savedCapabilities = glState.capabilities;
+    glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glState.disable(GL_CULL_FACE);
+    glState.disable(GL_LIGHTING);
+    glState.disable(GL_TEXTURE_2D);
+    glState.bindVertexArray(occlusionBoxVAO);
+
+    for (size_t index : tested) {
+        const SceneObject& object = sceneObjects[index];
+        glPushMatrix();
+        glTranslatef(object.min.x, object.min.y, object.min.z);
+        glScalef(object.max.x - object.min.x, object.max.y - object.min.y, object.max.z - object.min.z);
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, occlusionQueries[index]);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        glPopMatrix();
+    }
+
+    glState.bindVertexArray(0);
+    glPopAttrib();
+    glState.capabilities = savedCapabilities;
+    pendingQueries = tested;
+}
+
+void drawAxes() {
+    glState.disable(GL_LIGHTING);
+    glState.disable(GL_TEXTURE_2D);
+    glBegin(GL_LINES);
 
     glColor3f(1.0f, 0.0f, 0.0f);
     glVertex3f(-5.0f, 0.0f, 0.0f);
     glVertex3f(5.0f, 0.0f, 0.0f);
 
-    glColor3f(0.0f, 1.0f, 0.0f);
-    glVertex3f(0.0f, -5.0f, 0.0f);
-    glVertex3f(0.0f, 5.0f, 0.0f);
+    glColor3f(0.0f, 1.0f, 0.0f);
+    glVertex3f(0.0f, -5.0f, 0.0f);
+    glVertex3f(0.0f, 5.0f, 0.0f);
+
+    glColor3f(0.0f, 0.0f, 1.0f);
+    glVertex3f(0.0f, 0.0f, -5.0f);
+    glVertex3f(0.0f, 0.0f, 5.0f);
+    glEnd();
+    glState.enable(GL_LIGHTING);
+    glState.enable(GL_TEXTURE_2D);
+    glColor3f(1.0f, 1.0f, 1.0f);
+}
+
+void drawNormals(const std::vector<Model>& models) {
+    glState.disable(GL_LIGHTING);
+    glColor3f(0.0f, 1.0f, 0.0f);
+
+    // Reading buffers back is not allowed between glBegin and glEnd
+    std::vector<Mesh*> paged;
+    for (const auto& model : models) {
+        if (model.mesh && !model.mesh->patches && pageInGeometry(*model.mesh)) paged.push_back(model.mesh.get());
+    }
+
+    glBegin(GL_LINES);
+    for (const auto& model : models) {
+        // Patch normals only exist on the GPU
+        if (!model.mesh || model.mesh->patches) continue;
+        const Mesh& mesh = *model.mesh;
+        for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+            Point3D vertex = mesh.vertices[i];
+            Vector3 normal = mesh.normals[i];
+
+            glVertex3f(vertex.x, vertex.y, vertex.z);
+            glVertex3f(vertex.x + normal.x * 0.1f, vertex.y + normal.y * 0.1f, vertex.z + normal.z * 0.1f);
+        }
+    }
+    glEnd();
+    for (Mesh* mesh : paged) releaseCpuGeometry(*mesh);
+
+    glState.enable(GL_LIGHTING);
+}
+
+void drawGroupNormals(const Group& group) {
+    drawNormals(group.models);
+
+    for (const Group& child : group.children) {
+        drawGroupNormals(child);
+    }
+}
+
+// Shows the draw call count of the last frame and the frame rate, refreshed once per second
+void updateWindowTitle() {
+    static int frames = 0;
+    static int lastUpdate = 0;
+    ++frames;
+
+    int now = glutGet(GLUT_ELAPSED_TIME);
+    if (now - lastUpdate < 1000) return;
+
+    std::ostringstream title;
+    title << "Engine Application - " << frames * 1000 / (now - lastUpdate) << " fps, "
+        << frameStats.drawCalls << " draw calls, " << frameStats.instances << " instances, " << frameStats.culled << " culled, "
+        << frameStats.occluded << " occluded, " << frameStats.bindsSaved << " binds saved, "
+        << frameStats.stateFiltered << " state changes filtered"
+        << (useInstancing ? " (instancing)" : "") << (useInstancing && useMultiDraw ? " (multi-draw)" : "");
+    glutSetWindowTitle(title.str().c_str());
+    frames = 0;
+    lastUpdate = now;
+}
+
+void display() {
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(worldConfig.camera.projection.fov,
+        (float)worldConfig.window.width / (float)worldConfig.window.height,
+        worldConfig.camera.projection.near,
+        worldConfig.camera.projection.far);
+
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    gluLookAt(worldConfig.camera.position.x, worldConfig.camera.position.y, worldConfig.camera.position.z,
+        worldConfig.camera.lookAt.x, worldConfig.camera.lookAt.y, worldConfig.camera.lookAt.z,
+        worldConfig.camera.up.x, worldConfig.camera.up.y, worldConfig.camera.up.z);
+
+    glState.enable(GL_LIGHTING);
+    drawAxes();
+
+    frameTime = glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
+    frameStats = FrameStats();
+    if (useFrameRing) frameRing.beginFrame();
+
+    Mat4& projection = cameraProjection;
+    Mat4& view = cameraView;
+    glGetFloatv(GL_PROJECTION_MATRIX, projection.m);
+    glGetFloatv(GL_MODELVIEW_MATRIX, view.m);
+
+    if (useInstancing) {
+        updateScene();
+
+        std::vector<size_t> visible;
+        if (useCulling) {
+            sceneBVH.queryFrustum(frustumFromMatrix(multiply(projection, view)), visible, getJobSystem());
+        }
+        else {
+            for (size_t i = 0; i < sceneObjects.size(); ++i) visible.push_back(i);
+        }
+        frameStats.culled = sceneObjects.size() - visible.size();
+
+        std::vector<DrawItem> occluders, items;
+        std::vector<size_t> tested;
+        if (useOcclusion) {
+            if (!readOcclusionResults()) requestRedraw();
+            classifyOcclusion(visible, occluders, items, tested);
+        }
+        else {
+            for (size_t index : visible) {
+                items.push_back({ sceneObjects[index].world, sceneObjects[index].model });
+            }
+        }
+
+        drawCurves(sceneCurves);
+        renderInstanced(occluders);
+        renderInstanced(items);
+        if (useOcclusion) {
+            issueOcclusionQueries(tested);
+        }
+    }
+    else {
+        // queueGroup reads the modelview from GL, which already holds the camera
+        Frustum frustum = frustumFromMatrix(projection);
+        RenderQueue queue;
+        for (const auto& group : worldConfig.groups) {
+            queueGroup(group, useCulling ? &frustum : nullptr, queue);
+        }
+        submitQueue(queue);
+    }
+
+    if (useFrameRing) frameRing.endFrame();
+    glutSwapBuffers();
+    updateWindowTitle();
+}
+
+struct VertexAttribute {
+    GLint components;
+    GLenum type;
+    GLboolean normalized;
+    size_t size;
+    const void* data;
+};
+
+// Resizes buffer to capacity bytes, keeping its first used bytes. The buffer keeps its name, so
+// the pool VAO and the meshes already in it stay valid. The copy targets leave the bound VAO alone.
+void growBuffer(GLuint buffer, size_t used, size_t capacity) {
+    GLuint scratch = 0;
+    if (used > 0) {
+        glGenBuffers(1, &scratch);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, scratch);
+        glBufferData(GL_COPY_WRITE_BUFFER, used, nullptr, GL_STREAM_COPY);
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, GL_STATIC_DRAW);
+
+    if (scratch) {
+        glBindBuffer(GL_COPY_READ_BUFFER, scratch);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+        glDeleteBuffers(1, &scratch);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void addToPool(Mesh& mesh) {
+    GeometryPool& pool = geometryPool;
+    if (!pool.vao) {
+        glGenVertexArrays(1, &pool.vao);
+        glGenBuffers(1, &pool.vbo);
+        glGenBuffers(1, &pool.ibo);
+
+        glState.bindVertexArray(pool.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, pool.vbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.ibo);
+        const size_t offsets[3] = { offsetof(PoolVertex, position), offsetof(PoolVertex, normal), offsetof(PoolVertex, texCoord) };
+        const GLint components[3] = { 3, 3, 2 };
+        for (int a = 0; a < 3; ++a) {
+            glEnableVertexAttribArray(a);
+            glVertexAttribPointer(a, components[a], GL_FLOAT, GL_FALSE, sizeof(PoolVertex), reinterpret_cast<void*>(offsets[a]));
+        }
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glVertexPointer(3, GL_FLOAT, sizeof(PoolVertex), reinterpret_cast<void*>(offsets[0]));
+        glNormalPointer(GL_FLOAT, sizeof(PoolVertex), reinterpret_cast<void*>(offsets[1]));
+        glTexCoordPointer(2, GL_FLOAT, sizeof(PoolVertex), reinterpret_cast<void*>(offsets[2]));
+        glState.bindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    size_t vertexCount = mesh.vertices.size();
+    size_t indexCount = mesh.indices.size();
+    size_t firstVertex = pool.vertexCount, firstIndex = pool.indexCount;
+    if (!takeRange(pool.freeVertices, vertexCount, firstVertex)) {
+        if (pool.vertexCount + vertexCount > pool.vertexCapacity) {
+            size_t capacity = std::max(pool.vertexCount + vertexCount, std::max<size_t>(pool.vertexCapacity * 2, 1 << 16));
+            growBuffer(pool.vbo, pool.vertexCount * sizeof(PoolVertex), capacity * sizeof(PoolVertex));
+            pool.vertexCapacity = capacity;
+        }
+        pool.vertexCount += vertexCount;
+    }
+    if (indexCount > 0 && !takeRange(pool.freeIndices, indexCount, firstIndex)) {
+        if (pool.indexCount + indexCount > pool.indexCapacity) {
+            size_t capacity = std::max(pool.indexCount + indexCount, std::max<size_t>(pool.indexCapacity * 2, 1 << 16));
+            growBuffer(pool.ibo, pool.indexCount * sizeof(unsigned int), capacity * sizeof(unsigned int));
+            pool.indexCapacity = capacity;
+        }
+        pool.indexCount += indexCount;
+    }
+
+    std::vector<PoolVertex> vertices(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        vertices[v] = { mesh.vertices[v], mesh.normals[v], mesh.texCoords[v] };
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, pool.vbo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, firstVertex * sizeof(PoolVertex), vertexCount * sizeof(PoolVertex), vertices.data());
+    if (indexCount > 0) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, pool.ibo);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, firstIndex * sizeof(unsigned int), indexCount * sizeof(unsigned int), mesh.indices.data());
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    mesh.pooled = true;
+    mesh.firstVertex = static_cast<GLint>(firstVertex);
+    mesh.firstIndex = static_cast<GLuint>(firstIndex);
+    mesh.vboId = pool.vbo;
+    mesh.vaoId = pool.vao;
+    mesh.iboId = indexCount > 0 ? pool.ibo : 0;
+    mesh.layout = LAYOUT_INTERLEAVED;
+    mesh.stride = sizeof(PoolVertex);
+    mesh.attributeOffsets[0] = offsetof(PoolVertex, position);
+    mesh.attributeOffsets[1] = offsetof(PoolVertex, normal);
+    mesh.attributeOffsets[2] = offsetof(PoolVertex, texCoord);
+    mesh.gpuBytes = vertexCount * sizeof(PoolVertex) + indexCount * sizeof(unsigned int);
+}
+
+// Control points only, in a buffer of their own: the tessellation program derives the rest
+void initializePatchVBO(Mesh& mesh) {
+    mesh.layout = LAYOUT_PLANAR;
+    mesh.stride = 0;
+    mesh.gpuBytes = mesh.vertices.size() * sizeof(Point3D);
+
+    glGenBuffers(1, &mesh.vboId);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vboId);
+    glBufferData(GL_ARRAY_BUFFER, mesh.gpuBytes, mesh.vertices.data(), GL_STATIC_DRAW);
+
+    glGenVertexArrays(1, &mesh.vaoId);
+    glState.bindVertexArray(mesh.vaoId);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glState.bindVertexArray(0);
+}
+
+void initializeVBO(Mesh& mesh) {
+    mesh.vertexCount = mesh.vertices.size();
+    mesh.indexCount = mesh.indices.size();
+    if (mesh.patches) {
+        initializePatchVBO(mesh);
+        return;
+    }
+    if (useGeometryPool && !mesh.quantized) {
+        addToPool(mesh);
+        return;
+    }
+
+    size_t vertexCount = mesh.vertices.size();
+    VertexAttribute attributes[3];
+    if (mesh.quantized) {
+        attributes[0] = { 4, GL_UNSIGNED_SHORT, GL_TRUE, 4 * sizeof(uint16_t), mesh.packed.positions.data() };
+        attributes[1] = { 2, GL_SHORT, GL_TRUE, 2 * sizeof(int16_t), mesh.packed.normals.data() };
+        attributes[2] = { 2, GL_UNSIGNED_SHORT, GL_TRUE, 2 * sizeof(uint16_t), mesh.packed.texCoords.data() };
+    }
+    else {
+        attributes[0] = { 3, GL_FLOAT, GL_FALSE, sizeof(Point3D), mesh.vertices.data() };
+        attributes[1] = { 3, GL_FLOAT, GL_FALSE, sizeof(Vector3), mesh.normals.data() };
+        attributes[2] = { 2, GL_FLOAT, GL_FALSE, sizeof(Vector2), mesh.texCoords.data() };
+    }
+
+    size_t vertexSize = attributes[0].size + attributes[1].size + attributes[2].size;
+    std::vector<unsigned char> data(vertexCount * vertexSize);
+
+    mesh.layout = vertexLayout;
+    if (mesh.layout == LAYOUT_INTERLEAVED) {
+        mesh.stride = static_cast<GLsizei>(vertexSize);
+        mesh.attributeOffsets[0] = 0;
+        mesh.attributeOffsets[1] = attributes[0].size;
+        mesh.attributeOffsets[2] = attributes[0].size + attributes[1].size;
+        for (size_t v = 0; v < vertexCount; ++v) {
+            for (int a = 0; a < 3; ++a) {
+                memcpy(&data[v * vertexSize + mesh.attributeOffsets[a]],
+                    static_cast<const unsigned char*>(attributes[a].data) + v * attributes[a].size, attributes[a].size);
+            }
+        }
+    }
+    else {
+        mesh.stride = 0;
+        size_t offset = 0;
+        for (int a = 0; a < 3; ++a) {
+            mesh.attributeOffsets[a] = offset;
+            if (vertexCount > 0) memcpy(&data[offset], attributes[a].data, vertexCount * attributes[a].size);
+            offset += vertexCount * attributes[a].size;
+        }
+    }
+
+    glGenBuffers(1, &mesh.vboId);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vboId);
+    glBufferData(GL_ARRAY_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+    mesh.gpuBytes = data.size() + mesh.indices.size() * sizeof(unsigned int);
+
+    glGenVertexArrays(1, &mesh.vaoId);
+    glState.bindVertexArray(mesh.vaoId);
+
+    for (int a = 0; a < 3; ++a) {
+        glEnableVertexAttribArray(a);
+        glVertexAttribPointer(a, attributes[a].components, attributes[a].type, attributes[a].normalized,
+            mesh.stride, reinterpret_cast<void*>(mesh.attributeOffsets[a]));
+    }
+
+    // The fixed-function arrays live in the VAO too, so drawing only needs the VAO bound
+    if (!mesh.quantized) {
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glVertexPointer(3, GL_FLOAT, mesh.stride, reinterpret_cast<void*>(mesh.attributeOffsets[0]));
+        glNormalPointer(GL_FLOAT, mesh.stride, reinterpret_cast<void*>(mesh.attributeOffsets[1]));
+        glTexCoordPointer(2, GL_FLOAT, mesh.stride, reinterpret_cast<void*>(mesh.attributeOffsets[2]));
+    }
+
+    if (!mesh.indices.empty()) {
+        glGenBuffers(1, &mesh.iboId);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.iboId);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(unsigned int), mesh.indices.data(), GL_STATIC_DRAW);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glState.bindVertexArray(0);
+}
+
+void computeMeshBounds(Mesh& mesh) {
+    Bounds& bounds = mesh.bounds;
+    bounds = Bounds();
+    if (mesh.vertices.empty()) return;
+
+    bounds.min = bounds.max = mesh.vertices[0];
+    for (const Point3D& v : mesh.vertices) {
+        bounds.min = { std::min(bounds.min.x, v.x), std::min(bounds.min.y, v.y), std::min(bounds.min.z, v.z) };
+        bounds.max = { std::max(bounds.max.x, v.x), std::max(bounds.max.y, v.y), std::max(bounds.max.z, v.z) };
+    }
+
+    bounds.center = { (bounds.min.x + bounds.max.x) * 0.5f, (bounds.min.y + bounds.max.y) * 0.5f, (bounds.min.z + bounds.max.z) * 0.5f };
+    bounds.radius = 0.0f;
+    for (const Point3D& v : mesh.vertices) {
+        bounds.radius = std::max(bounds.radius, length({ v.x - bounds.center.x, v.y - bounds.center.y, v.z - bounds.center.z }));
+    }
+}
+
+// Parses a .3d file into CPU memory only, so it is safe to call from loader threads
+bool readMesh(const std::string& filename, Mesh& mesh) {
+    std::ifstream file(filename);
+    mesh.name = filename;
+    if (!file.is_open()) {
+        std::cerr << "No foi possvel abrir o arquivo: " << filename << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int totalPoints = 0;
+    size_t totalIndices = 0;
+    if (!std::getline(file, line)) {
+        std::cerr << "Arquivo vazio: " << filename << std::endl;
+        return false;
+    }
+    try {
+        size_t consumed;
+        totalPoints = std::stoi(line, &consumed);
+        std::string layout;
+        std::istringstream(line.substr(consumed)) >> totalIndices >> layout;
+        mesh.quantized = layout == "compact";
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Erro ao converter o nmero total de pontos: " << e.what() << std::endl;
+        return false;
+    }
+
+    char comma, semicolon;
+    QuantizedVertices& packed = mesh.packed;
+    if (mesh.quantized) {
+        std::istringstream bounds(std::getline(file, line) ? line : "");
+        if (!(bounds >> packed.boundsMin.x >> comma >> packed.boundsMin.y >> comma >> packed.boundsMin.z >> semicolon
+            >> packed.boundsMax.x >> comma >> packed.boundsMax.y >> comma >> packed.boundsMax.z >> semicolon
+            >> packed.uvMin.u >> comma >> packed.uvMin.v >> semicolon >> packed.uvMax.u >> comma >> packed.uvMax.v)) {
+            std::cerr << "Erro ao ler os limites do modelo compacto: " << filename << std::endl;
+            return false;
+        }
+    }
+
+    while (std::getline(file, line)) {
+        std::istringstream iss(line);
+
+        if (totalIndices > 0 && mesh.vertices.size() == static_cast<size_t>(totalPoints)) {
+            unsigned int a, b, c;
+            if ((iss >> a >> comma >> b >> comma >> c) && comma == ',' &&
+                a < mesh.vertices.size() && b < mesh.vertices.size() && c < mesh.vertices.size()) {
+                mesh.indices.push_back(a);
+                mesh.indices.push_back(b);
+                mesh.indices.push_back(c);
+            }
+            else {
+                std::cerr << "Erro ao ler a linha do arquivo: " << line << std::endl;
+            }
+            continue;
+        }
+
+        if (mesh.quantized) {
+            unsigned int px, py, pz, u, v;
+            int ox, oy;
+            if ((iss >> px >> comma >> py >> comma >> pz >> semicolon >> ox >> comma >> oy >> semicolon >> u >> comma >> v) &&
+                comma == ',' && semicolon == ';') {
+                packed.positions.insert(packed.positions.end(), { uint16_t(px), uint16_t(py), uint16_t(pz), 0 });
+                packed.normals.insert(packed.normals.end(), { int16_t(ox), int16_t(oy) });
+                packed.texCoords.insert(packed.texCoords.end(), { uint16_t(u), uint16_t(v) });
+                unpackVertex(mesh, packed.texCoords.size() / 2 - 1);
+            }
+            else {
+                std::cerr << "Erro ao ler a linha do arquivo: " << line << std::endl;
+            }
+            continue;
+        }
+
+        Point3D vertex;
+        Vector3 normal;
+        Vector2 texCoord;
+
+        if ((iss >> vertex.x >> comma >> vertex.y >> comma >> vertex.z >> semicolon
+            >> normal.x >> comma >> normal.y >> comma >> normal.z >> semicolon
+            >> texCoord.u >> comma >> texCoord.v) &&
+            comma == ',' && semicolon == ';') {
+            texCoord.v = 1.0f - texCoord.v;
+            mesh.vertices.push_back(vertex);
+            mesh.normals.push_back(normal);
+            mesh.texCoords.push_back(texCoord);
+        }
+        else {
+            std::cerr << "Erro ao ler a linha do arquivo: " << line << std::endl;
+        }
+    }
+
+    file.close();
+    if (mesh.vertices.size() != totalPoints || mesh.indices.size() != totalIndices) {
+        std::cerr << "Aviso: o nmero total de pontos lidos no corresponde ao indicador inicial." << std::endl;
+    }
+
+    computeMeshBounds(mesh);
+    return true;
+}
+
+// Meshes of <model primitive="..."> elements are keyed "primitive:" plus the shape and its
+// parameters instead of a path, so models asking for the same shape share one mesh. A patch
+// key ends with its control point file, since a path may hold spaces.
+const std::string PRIMITIVE_PREFIX = "primitive:";
+
+bool isPrimitive(const std::string& key) {
+    return key.compare(0, PRIMITIVE_PREFIX.size(), PRIMITIVE_PREFIX) == 0;
+}
+
+// The file a mesh is read from, or empty for shapes that need none
+std::string meshSourceFile(const std::string& key) {
+    if (!isPrimitive(key)) return key;
+    std::istringstream parameters(key.substr(PRIMITIVE_PREFIX.size()));
+    std::string type, file;
+    int tessellation;
+    if (!(parameters >> type) || type != "patch" || !(parameters >> tessellation)) return "";
+    std::getline(parameters >> std::ws, file);
+    return file;
+}
+
+// Control points straight from a patch file, 16 per patch, for the tessellation program
+bool readPatchMesh(const std::string& filename, Mesh& mesh) {
+    std::vector<Point3D> points;
+    for (const primitives::Patch& patch : primitives::readPatchesFile(filename.c_str())) {
+        for (const std::vector<float>& point : patch) {
+            if (patch.size() != 16 || point.size() < 3) {
+                std::cerr << "Patch sem 16 pontos de controle em " << filename << std::endl;
+                return false;
+            }
+            points.push_back({ point[0], point[1], point[2] });
+        }
+    }
+    if (points.empty()) return false;
+
+    mesh.vertices = std::move(points);
+    mesh.patches = true;
+    computeMeshBounds(mesh);
+    return true;
+}
+
+// Builds the shape a primitive key names with the generator's own code, without a .3d file
+bool generatePrimitive(const std::string& key, Mesh& mesh) {
+    std::istringstream parameters(key.substr(PRIMITIVE_PREFIX.size()));
+    std::string type;
+    parameters >> type;
+    float radius, height, length;
+    int slices, stacks, divisions, tessellation;
+    primitives::Shape shape;
+    if (type == "sphere" && parameters >> radius >> slices >> stacks) {
+        shape = primitives::generateSphere(radius, slices, stacks);
+    }
+    else if (type == "box" && parameters >> length >> divisions) {
+        shape = primitives::generateBox(length, divisions);
+    }
+    else if (type == "plane" && parameters >> length >> divisions) {
+        shape = primitives::generatePlane(length, divisions);
+    }
+    else if (type == "cone" && parameters >> radius >> height >> slices >> stacks) {
+        shape = primitives::generateCone(radius, height, slices, stacks);
+    }
+    else if (type == "patch" && useTessellation) {
+        if (readPatchMesh(meshSourceFile(key), mesh)) return true;
+    }
+    else if (type == "patch") {
+        shape = primitives::buildPatches(meshSourceFile(key).c_str(), parameters >> tessellation ? tessellation : 1);
+    }
+    if (shape.vertices.empty()) {
+        std::cerr << "Erro ao gerar a primitiva: " << key.substr(PRIMITIVE_PREFIX.size()) << std::endl;
+        return false;
+    }
+
+    size_t count = shape.vertices.size();
+    mesh.vertices.resize(count);
+    mesh.normals.resize(count);
+    mesh.texCoords.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        mesh.vertices[i] = { shape.vertices[i].x, shape.vertices[i].y, shape.vertices[i].z };
+        mesh.normals[i] = { shape.normals[i].x, shape.normals[i].y, shape.normals[i].z };
+        mesh.texCoords[i] = { shape.texCoords[i].u, shape.texCoords[i].v };
+    }
+    computeMeshBounds(mesh);
+    return true;
+}
+
+bool loadMesh(const std::string& key, Mesh& mesh) {
+    return isPrimitive(key) ? generatePrimitive(key, mesh) : readMesh(key, mesh);
+}
+
+std::shared_ptr<Mesh> readModel(const std::string& filename) {
+    std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+    readMesh(filename, *mesh);
+    initializeVBO(*mesh);
+    return mesh;
+}
+
+const std::string basePath = "C:/Users/GIGABYTE/Desktop/teste/teste2/src/src/generator/build/Release/";
+
+// Element and attribute names of the scene format, interned once so the loader compares ids
+enum SceneTag {
+    TAG_OTHER, TAG_WORLD, TAG_WINDOW, TAG_LIGHTS, TAG_LIGHT, TAG_CAMERA, TAG_POSITION, TAG_LOOK_AT, TAG_UP,
+    TAG_PROJECTION, TAG_GROUP, TAG_TRANSFORM, TAG_TRANSLATE, TAG_ROTATE, TAG_SCALE, TAG_POINT, TAG_MODELS,
+    TAG_MODEL, TAG_COLOR, TAG_DIFFUSE, TAG_AMBIENT, TAG_SPECULAR, TAG_EMISSIVE, TAG_SHININESS, TAG_TEXTURE
+};
+
+enum SceneAttribute {
+    ATTR_OTHER, ATTR_WIDTH, ATTR_HEIGHT, ATTR_TYPE, ATTR_POSX, ATTR_POSY, ATTR_POSZ, ATTR_DIRX, ATTR_DIRY, ATTR_DIRZ,
+    ATTR_CUTOFF, ATTR_AMBIENT_R, ATTR_AMBIENT_G, ATTR_AMBIENT_B, ATTR_DIFFUSE_R, ATTR_DIFFUSE_G, ATTR_DIFFUSE_B,
+    ATTR_SPECULAR_R, ATTR_SPECULAR_G, ATTR_SPECULAR_B, ATTR_X, ATTR_Y, ATTR_Z, ATTR_FOV, ATTR_NEAR, ATTR_FAR,
+    ATTR_TIME, ATTR_ALIGN, ATTR_ANGLE, ATTR_FILE, ATTR_R, ATTR_G, ATTR_B, ATTR_VALUE, ATTR_PRIMITIVE, ATTR_RADIUS,
+    ATTR_LENGTH, ATTR_SLICES, ATTR_STACKS, ATTR_DIVISIONS, ATTR_TESSELLATION, ATTR_COUNT
+};
+
+SceneTag internTag(std::string_view name) {
+    static const std::unordered_map<std::string_view, SceneTag> tags = {
+        { "world", TAG_WORLD }, { "window", TAG_WINDOW }, { "lights", TAG_LIGHTS }, { "light", TAG_LIGHT },
+        { "camera", TAG_CAMERA }, { "position", TAG_POSITION }, { "lookAt", TAG_LOOK_AT }, { "up", TAG_UP },
+        { "projection", TAG_PROJECTION }, { "group", TAG_GROUP }, { "transform", TAG_TRANSFORM },
+        { "translate", TAG_TRANSLATE }, { "rotate", TAG_ROTATE }, { "scale", TAG_SCALE }, { "point", TAG_POINT },
+        { "models", TAG_MODELS }, { "model", TAG_MODEL }, { "color", TAG_COLOR }, { "diffuse", TAG_DIFFUSE },
+        { "ambient", TAG_AMBIENT }, { "specular", TAG_SPECULAR }, { "emissive", TAG_EMISSIVE },
+        { "shininess", TAG_SHININESS }, { "texture", TAG_TEXTURE },
+    };
+    auto found = tags.find(name);
+    return found != tags.end() ? found->second : TAG_OTHER;
+}
+
+SceneAttribute internAttribute(std::string_view name) {
+    static const std::unordered_map<std::string_view, SceneAttribute> attributes = {
+        { "width", ATTR_WIDTH }, { "height", ATTR_HEIGHT }, { "type", ATTR_TYPE }, { "posx", ATTR_POSX },
+        { "posy", ATTR_POSY }, { "posz", ATTR_POSZ }, { "dirx", ATTR_DIRX }, { "diry", ATTR_DIRY }, { "dirz", ATTR_DIRZ },
+        { "cutoff", ATTR_CUTOFF }, { "ambientR", ATTR_AMBIENT_R }, { "ambientG", ATTR_AMBIENT_G },
+        { "ambientB", ATTR_AMBIENT_B }, { "diffuseR", ATTR_DIFFUSE_R }, { "diffuseG", ATTR_DIFFUSE_G },
+        { "diffuseB", ATTR_DIFFUSE_B }, { "specularR", ATTR_SPECULAR_R }, { "specularG", ATTR_SPECULAR_G },
+        { "specularB", ATTR_SPECULAR_B }, { "x", ATTR_X }, { "y", ATTR_Y }, { "z", ATTR_Z }, { "fov", ATTR_FOV },
+        { "near", ATTR_NEAR }, { "far", ATTR_FAR }, { "time", ATTR_TIME }, { "align", ATTR_ALIGN },
+        { "angle", ATTR_ANGLE }, { "file", ATTR_FILE }, { "R", ATTR_R }, { "G", ATTR_G }, { "B", ATTR_B },
+        { "value", ATTR_VALUE }, { "primitive", ATTR_PRIMITIVE }, { "radius", ATTR_RADIUS }, { "length", ATTR_LENGTH },
+        { "slices", ATTR_SLICES }, { "stacks", ATTR_STACKS }, { "divisions", ATTR_DIVISIONS },
+        { "tessellation", ATTR_TESSELLATION },
+    };
+    auto found = attributes.find(name);
+    return found != attributes.end() ? found->second : ATTR_OTHER;
+}
+
+// Attribute values of the element being read, by interned name. They point into the loader's
+// read buffer and are only valid during startElement.
+struct SceneAttributes {
+    const char* values[ATTR_COUNT] = {};
+
+    float number(SceneAttribute attribute, float fallback = 0.0f) const {
+        if (!values[attribute]) return fallback;
+        char* end;
+        float value = strtof(values[attribute], &end);
+        return end != values[attribute] ? value : fallback;
+    }
+
+    int integer(SceneAttribute attribute, int fallback = 0) const {
+        return values[attribute] ? static_cast<int>(strtol(values[attribute], nullptr, 10)) : fallback;
+    }
+
+    bool flag(SceneAttribute attribute, bool fallback) const {
+        if (!values[attribute]) return fallback;
+        std::string_view value = values[attribute];
+        if (value == "true" || value == "True" || value == "TRUE" || value == "1") return true;
+        if (value == "false" || value == "False" || value == "FALSE" || value == "0") return false;
+        return fallback;
+    }
+
+    const char* text(SceneAttribute attribute) const { return values[attribute] ? values[attribute] : ""; }
+};
+
+// Builds worldConfig straight from the XML text without a document tree. The file is read in
+// fixed chunks, so memory does not depend on its size, and each start tag goes to startElement
+// with its attributes looked up by id. Where the format allows one element (the first <camera>,
+// <transform> or <color>, ...) later ones are ignored, as the DOM walk used to do.
+class SceneLoader {
+public:
+    explicit SceneLoader(World& world) : world(world) {}
+
+    bool load(const std::string& filename) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "Erro ao abrir o arquivo XML: " << filename << std::endl;
+            return false;
+        }
+
+        std::vector<char> buffer(64 * 1024);
+        size_t begin = 0, end = 0, consumed = 0;
+        // Keeps the unread bytes, moved to the front, and appends more; false once the file is done
+        auto refill = [&]() {
+            consumed += begin;
+            std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+            if (end == buffer.size()) buffer.resize(buffer.size() * 2);
+            file.read(buffer.data() + end, static_cast<std::streamsize>(buffer.size() - end));
+            end += static_cast<size_t>(file.gcount());
+            return file.gcount() > 0;
+        };
+
+        while (true) {
+            const char* next = static_cast<const char*>(std::memchr(buffer.data() + begin, '<', end - begin));
+            if (!next) {
+                begin = end;
+                if (!refill()) break;
+                continue;
+            }
+            begin = next - buffer.data();
+            while (end - begin < 9 && refill()) {}
+
+            std::string_view start(buffer.data() + begin, end - begin);
+            const char* terminator = start.compare(0, 4, "<!--") == 0 ? "-->"
+                : start.compare(0, 9, "<![CDATA[") == 0 ? "]]>" : ">";
+            size_t scan = 1;
+            char quote = 0;
+            size_t close = std::string::npos;
+            while (close == std::string::npos) {
+                for (; scan < end - begin; ++scan) {
+                    char c = buffer[begin + scan];
+                    if (terminator[1] != '\0') {
+                        if (std::string_view(buffer.data() + begin + scan, end - begin - scan).compare(0, 3, terminator) == 0) break;
+                    }
+                    else if (quote) {
+                        if (c == quote) quote = 0;
+                    }
+                    else if (c == '"' || c == '\'') quote = c;
+                    else if (c == '>') break;
+                }
+                if (scan < end - begin) close = scan;
+                else if (!refill()) return fail(filename, consumed + begin);
+                // A "-->" or "]]>" cut by the refill starts again at its first byte
+                else scan -= std::min(scan - 1, std::strlen(terminator) - 1);
+            }
+
+            char* tag = buffer.data() + begin;
+            begin += close + std::strlen(terminator);
+            if (terminator[1] == '\0' && !readTag(tag + 1, tag + close)) return fail(filename, consumed + (tag - buffer.data()));
+        }
+
+        if (!elements.empty()) return fail(filename, consumed + end);
+        if (!worldFound) {
+            std::cerr << "Tag <world> no encontrada." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    struct OpenElement {
+        SceneTag tag;
+        bool active;
+        uint32_t childrenSeen;
+    };
+
+    World& world;
+    std::vector<OpenElement> elements;
+    std::vector<Group*> groups;
+    Model* model = nullptr;
+    bool worldFound = false;
+    bool translateHasChildren = false;
+    uint64_t hash = 0;
+    Point3D translatePoint{ 0, 0, 0 };
+
+    bool fail(const std::string& filename, size_t offset) {
+        std::cerr << "Erro ao analisar o XML: " << filename << " (byte " << offset << ")" << std::endl;
+        return false;
+    }
+
+    // Parses the inside of one tag, between '<' and '>', in place
+    bool readTag(char* text, char* end) {
+        if (text == end) return false;
+        if (*text == '?' || *text == '!') return true;
+        if (*text == '/') {
+            char* name = text + 1;
+            char* nameEnd = name;
+            while (nameEnd < end && !std::isspace(static_cast<unsigned char>(*nameEnd))) ++nameEnd;
+            SceneTag tag = internTag(std::string_view(name, nameEnd - name));
+            if (elements.empty() || elements.back().tag != tag) return false;
+            endElement();
+            return true;
+        }
+
+        bool selfClosing = end[-1] == '/';
+        if (selfClosing) --end;
+        char* nameEnd = text;
+        while (nameEnd < end && !std::isspace(static_cast<unsigned char>(*nameEnd))) ++nameEnd;
+        SceneTag tag = internTag(std::string_view(text, nameEnd - text));
+
+        SceneAttributes attributes;
+        char* cursor = nameEnd;
+        while (true) {
+            while (cursor < end && std::isspace(static_cast<unsigned char>(*cursor))) ++cursor;
+            if (cursor == end) break;
+            char* name = cursor;
+            while (cursor < end && *cursor != '=' && !std::isspace(static_cast<unsigned char>(*cursor))) ++cursor;
+            SceneAttribute attribute = internAttribute(std::string_view(name, cursor - name));
+            while (cursor < end && std::isspace(static_cast<unsigned char>(*cursor))) ++cursor;
+            if (cursor == end || *cursor++ != '=') return false;
+            while (cursor < end && std::isspace(static_cast<unsigned char>(*cursor))) ++cursor;
+            if (cursor == end || (*cursor != '"' && *cursor != '\'')) return false;
+            char quote = *cursor++;
+            char* value = cursor;
+            while (cursor < end && *cursor != quote) ++cursor;
+            if (cursor == end) return false;
+            *cursor++ = '\0';
+            decodeEntities(value);
+            attributes.values[attribute] = value;
+        }
+
+        startElement(tag, attributes);
+        if (selfClosing) endElement();
+        return true;
+    }
+
+    // Replaces the predefined and numeric character references; the result is never longer
+    static void decodeEntities(char* value) {
+        char* out = std::strchr(value, '&');
+        if (!out) return;
+        static const std::pair<const char*, char> entities[] = {
+            { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' }, { "&quot;", '"' }, { "&apos;", '\'' }
+        };
+        for (const char* in = out; *in;) {
+            if (*in == '&') {
+                bool replaced = false;
+                for (const auto& entity : entities) {
+                    size_t length = std::strlen(entity.first);
+                    if (std::strncmp(in, entity.first, length) == 0) {
+                        *out++ = entity.second;
+                        in += length;
+                        replaced = true;
+                        break;
+                    }
+                }
+                if (!replaced && in[1] == '#') {
+                    char* numberEnd;
+                    bool hex = in[2] == 'x' || in[2] == 'X';
+                    long code = strtol(in + (hex ? 3 : 2), &numberEnd, hex ? 16 : 10);
+                    if (*numberEnd == ';' && code > 0 && code < 128) {
+                        *out++ = static_cast<char>(code);
+                        in = numberEnd + 1;
+                        replaced = true;
+                    }
+                }
+                if (replaced) continue;
+            }
+            *out++ = *in++;
+        }
+        *out = '\0';
+    }
+
+    void startElement(SceneTag tag, const SceneAttributes& attributes) {
+        OpenElement* parent = elements.empty() ? nullptr : &elements.back();
+        bool first = true;
+        if (parent) {
+            first = !(parent->childrenSeen & (1u << tag));
+            parent->childrenSeen |= 1u << tag;
+        }
+        SceneTag parentTag = parent ? parent->tag : TAG_OTHER;
+        bool active = parent ? parent->active : !worldFound && tag == TAG_WORLD;
+        if (parentTag == TAG_TRANSLATE && active) translateHasChildren = true;
+
+        if (active && tag == TAG_GROUP && parentTag == TAG_WORLD) {
+            world.groupSources.emplace_back();
+            hash = 14695981039346656037ull;
+        }
+        if (active && (!groups.empty() || tag == TAG_GROUP)) hashElement(tag, attributes);
+
+        if (active) {
+            active = accept(tag, parentTag, first, attributes);
+        }
+        if (tag == TAG_WORLD && active) worldFound = true;
+        elements.push_back({ tag, active, 0 });
+    }
+
+    // Applies one element to the world; false means it and everything inside it are ignored
+    bool accept(SceneTag tag, SceneTag parentTag, bool first, const SceneAttributes& attributes) {
+        Camera& camera = world.camera;
+        switch (parentTag) {
+        case TAG_OTHER:
+            return tag == TAG_WORLD;
+        case TAG_WORLD:
+            if (tag == TAG_WINDOW && first) {
+                world.window.width = attributes.integer(ATTR_WIDTH);
+                world.window.height = attributes.integer(ATTR_HEIGHT);
+                return true;
+            }
+            if ((tag == TAG_LIGHTS || tag == TAG_CAMERA) && first) return true;
+            if (tag == TAG_GROUP) {
+                world.groups.emplace_back();
+                groups.push_back(&world.groups.back());
+                return true;
+            }
+            return false;
+        case TAG_LIGHTS:
+            if (tag == TAG_LIGHT) readLight(attributes);
+            return false;
+        case TAG_CAMERA:
+            if (!first) return false;
+            if (tag == TAG_POSITION) {
+                camera.position = { attributes.number(ATTR_X), attributes.number(ATTR_Y), attributes.number(ATTR_Z) };
+                CameraOrbit& orbit = world.orbit;
+                orbit.parsed = true;
+                orbit.radius = sqrt(camera.position.x * camera.position.x + camera.position.y * camera.position.y + camera.position.z * camera.position.z);
+                orbit.alfa = atan2(camera.position.z, camera.position.x);
+                orbit.beta = asin(camera.position.y / orbit.radius);
+            }
+            else if (tag == TAG_LOOK_AT) {
+                camera.lookAt = { attributes.number(ATTR_X), attributes.number(ATTR_Y), attributes.number(ATTR_Z) };
+            }
+            else if (tag == TAG_UP) {
+                camera.up = { attributes.number(ATTR_X), attributes.number(ATTR_Y), attributes.number(ATTR_Z) };
+            }
+            else if (tag == TAG_PROJECTION) {
+                camera.projection.fov = attributes.number(ATTR_FOV);
+                camera.projection.near = attributes.number(ATTR_NEAR);
+                camera.projection.far = attributes.number(ATTR_FAR);
+            }
+            return false;
+        case TAG_GROUP:
+            if ((tag == TAG_TRANSFORM || tag == TAG_MODELS) && first) return true;
+            if (tag == TAG_GROUP) {
+                Group& parent = *groups.back();
+                parent.children.emplace_back();
+                groups.push_back(&parent.children.back());
+                return true;
+            }
+            return false;
+        case TAG_TRANSFORM:
+            return readTransform(tag, attributes, groups.back()->transform);
+        case TAG_TRANSLATE:
+            if (tag == TAG_POINT) {
+                groups.back()->transform.translate.controlPoints.push_back(
+                    { attributes.number(ATTR_X), attributes.number(ATTR_Y), attributes.number(ATTR_Z) });
+            }
+            return false;
+        case TAG_MODELS:
+            return tag == TAG_MODEL && readModel(attributes);
+        case TAG_MODEL:
+            if (tag == TAG_COLOR && first) return true;
+            if (tag == TAG_TEXTURE && first && attributes.values[ATTR_FILE]) {
+                model->textureFile = basePath + attributes.text(ATTR_FILE);
+                world.textures[model->textureFile];
+                addSourceFile(model->textureFile);
+            }
+            return false;
+        case TAG_COLOR:
+            if (first) readColor(tag, attributes, model->material);
+            return false;
+        default:
+            return false;
+        }
+    }
+
+    void readLight(const SceneAttributes& attributes) {
+        Light light{};
+        light.type = attributes.text(ATTR_TYPE);
+        if (light.type == "point" || light.type == "spot") {
+            light.position = { attributes.number(ATTR_POSX), attributes.number(ATTR_POSY), attributes.number(ATTR_POSZ) };
+        }
+        if (light.type == "directional" || light.type == "spot") {
+            light.direction = { attributes.number(ATTR_DIRX), attributes.number(ATTR_DIRY), attributes.number(ATTR_DIRZ) };
+        }
+        if (light.type == "spot") {
+            light.cutoff = attributes.number(ATTR_CUTOFF, 180.0f);
+        }
+        light.ambient = { attributes.number(ATTR_AMBIENT_R, 0.2f), attributes.number(ATTR_AMBIENT_G, 0.2f), attributes.number(ATTR_AMBIENT_B, 0.2f) };
+        light.diffuse = { attributes.number(ATTR_DIFFUSE_R, 0.8f), attributes.number(ATTR_DIFFUSE_G, 0.8f), attributes.number(ATTR_DIFFUSE_B, 0.8f) };
+        light.specular = { attributes.number(ATTR_SPECULAR_R, 1.0f), attributes.number(ATTR_SPECULAR_G, 1.0f), attributes.number(ATTR_SPECULAR_B, 1.0f) };
+        world.lights.push_back(light);
+    }
+
+    bool readTransform(SceneTag tag, const SceneAttributes& attributes, Transform& transform) {
+        if (tag == TAG_TRANSLATE) {
+            transform.translate.active = true;
+            transform.translate.time = attributes.number(ATTR_TIME);
+            transform.translate.align = attributes.flag(ATTR_ALIGN, false);
+            // A translate without child elements is a single point given by its own attributes
+            translateHasChildren = false;
+            translatePoint = { attributes.number(ATTR_X), attributes.number(ATTR_Y), attributes.number(ATTR_Z) };
+            return true;
+        }
+        if (tag == TAG_ROTATE) {
+            transform.rotate.active = true;
+            transform.rotate.time = attributes.number(ATTR_TIME);
+            transform.rotate.angle = attributes.number(ATTR_ANGLE);
+            transform.rotate.axis = { attributes.number(ATTR_X), attributes.number(ATTR_Y), attributes.number(ATTR_Z) };
+        }
+        else if (tag == TAG_SCALE) {
+            transform.scale = { attributes.number(ATTR_X, 1.0f), attributes.number(ATTR_Y, 1.0f), attributes.number(ATTR_Z, 1.0f) };
+            transform.hasScale = true;
+        }
+        return false;
+    }
+
+    // Only records what to load; files are read later by loadSceneResources
+    bool readModel(const SceneAttributes& attributes) {
+        std::string key;
+        if (attributes.values[ATTR_PRIMITIVE]) key = primitiveKey(attributes);
+        else if (*attributes.text(ATTR_FILE)) key = basePath + attributes.text(ATTR_FILE);
+        if (key.empty()) return false;
+
+        Group& group = *groups.back();
+        group.models.emplace_back();
+        model = &group.models.back();
+        model->name = attributes.values[ATTR_PRIMITIVE] ? attributes.text(ATTR_PRIMITIVE) : attributes.text(ATTR_FILE);
+        std::shared_ptr<Mesh>& mesh = world.meshes[key];
+        if (!mesh) mesh = std::make_shared<Mesh>();
+        model->mesh = mesh;
+        std::string file = meshSourceFile(key);
+        if (!file.empty()) addSourceFile(file);
+        return true;
+    }
+
+    // Parameters left out default to a unit shape, as the generator would be asked for one
+    std::string primitiveKey(const SceneAttributes& attributes) {
+        std::string type = attributes.text(ATTR_PRIMITIVE);
+        auto count = [&](SceneAttribute attribute, int fallback) { return std::max(1, attributes.integer(attribute, fallback)); };
+        std::ostringstream key;
+        key << std::setprecision(9) << PRIMITIVE_PREFIX << type;
+        if (type == "sphere") {
+            key << ' ' << attributes.number(ATTR_RADIUS, 1.0f) << ' ' << count(ATTR_SLICES, 16) << ' ' << count(ATTR_STACKS, 16);
+        }
+        else if (type == "box" || type == "plane") {
+            key << ' ' << attributes.number(ATTR_LENGTH, 1.0f) << ' ' << count(ATTR_DIVISIONS, 1);
+        }
+        else if (type == "cone") {
+            key << ' ' << attributes.number(ATTR_RADIUS, 1.0f) << ' ' << attributes.number(ATTR_HEIGHT, 1.0f) << ' '
+                << count(ATTR_SLICES, 16) << ' ' << count(ATTR_STACKS, 1);
+        }
+        else if (type == "patch" && *attributes.text(ATTR_FILE)) {
+            key << ' ' << count(ATTR_TESSELLATION, 10) << ' ' << basePath << attributes.text(ATTR_FILE);
+        }
+        else {
+            std::cerr << "Primitiva desconhecida: " << type << std::endl;
+            return "";
+        }
+        return key.str();
+    }
 
-    glColor3f(0.0f, 0.0f, 1.0f);
-    glVertex3f(0.0f, 0.0f, -5.0f);
-    glVertex3f(0.0f, 0.0f, 5.0f);
-    glEnd();
-    glEnable(GL_LIGHTING); 
-    glEnable(GL_TEXTURE_2D);
-    glColor3f(1.0f, 1.0f, 1.0f);
+    void readColor(SceneTag tag, const SceneAttributes& attributes, Material& material) {
+        Color color = { attributes.integer(ATTR_R) / 255.0f, attributes.integer(ATTR_G) / 255.0f, attributes.integer(ATTR_B) / 255.0f };
+        switch (tag) {
+        case TAG_DIFFUSE: material.diffuse = color; break;
+        case TAG_AMBIENT: material.ambient = color; break;
+        case TAG_SPECULAR: material.specular = color; break;
+        case TAG_EMISSIVE: material.emissive = color; break;
+        case TAG_SHININESS: material.shininess = attributes.number(ATTR_VALUE); break;
+        default: break;
+        }
+    }
+
+    // FNV-1a over the elements and attribute values of the current top-level group
+    void mix(const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    }
+
+    void hashElement(SceneTag tag, const SceneAttributes& attributes) {
+        unsigned char id = static_cast<unsigned char>(tag);
+        mix(&id, 1);
+        for (int attribute = ATTR_OTHER + 1; attribute < ATTR_COUNT; ++attribute) {
+            if (!attributes.values[attribute]) continue;
+            id = static_cast<unsigned char>(attribute);
+            mix(&id, 1);
+            mix(attributes.values[attribute], std::strlen(attributes.values[attribute]) + 1);
+        }
+    }
+
+    void addSourceFile(const std::string& file) {
+        std::vector<std::string>& files = world.groupSources.back().files;
+        if (std::find(files.begin(), files.end(), file) == files.end()) files.push_back(file);
+    }
+
+    void endElement() {
+        OpenElement element = elements.back();
+        elements.pop_back();
+        if (!element.active) return;
+        if (!groups.empty()) {
+            const unsigned char end = 0xFF;
+            mix(&end, 1);
+            if (element.tag == TAG_GROUP && groups.size() == 1) world.groupSources.back().hash = hash;
+        }
+        // Node counts are unknown until an element closes; then its vectors lose their growth slack
+        if (element.tag == TAG_GROUP) {
+            Group& group = *groups.back();
+            group.children.shrink_to_fit();
+            group.models.shrink_to_fit();
+            groups.pop_back();
+        }
+        else if (element.tag == TAG_WORLD) world.groups.shrink_to_fit();
+        else if (element.tag == TAG_MODEL) model = nullptr;
+        else if (element.tag == TAG_TRANSLATE) {
+            std::vector<Point3D>& points = groups.back()->transform.translate.controlPoints;
+            if (!translateHasChildren) points.push_back(translatePoint);
+            points.shrink_to_fit();
+        }
+    }
+};
+
+// Gives every distinct material of the group a small id for render queue sort keys
+void assignMaterialIds(Group& group, World& world) {
+    for (Model& model : group.models) {
+        std::string key(reinterpret_cast<const char*>(&model.material), sizeof(Material));
+        auto found = world.materialIds.emplace(std::move(key), static_cast<unsigned int>(world.materials.size()));
+        if (found.second) world.materials.push_back(model.material);
+        model.materialId = found.first->second;
+    }
+    for (Group& child : group.children) {
+        assignMaterialIds(child, world);
+    }
+}
+
+void resolveTextures(Group& group, const World& world) {
+    for (Model& model : group.models) {
+        if (model.textureFile.empty()) continue;
+        auto texture = world.textures.find(model.textureFile);
+        model.textureId = texture != world.textures.end() ? texture->second.id : 0;
+    }
+    for (Group& child : group.children) {
+        resolveTextures(child, world);
+    }
+}
+
+// A subtree is static when nothing in it moves: rotations without a period and translations to
+// a single point. Every frame would compute the same matrices for it.
+bool isStaticSubtree(const Group& group) {
+    const Transform& transform = group.transform;
+    if (transform.rotate.active && transform.rotate.time > 0) return false;
+    if (transform.translate.active && transform.translate.controlPoints.size() > 1) return false;
+    for (const Group& child : group.children) {
+        if (!isStaticSubtree(child)) return false;
+    }
+    return true;
+}
+
+// True when some transform in the subtree changes over time
+bool isAnimated(const Group& group) {
+    const Transform& transform = group.transform;
+    if (transform.rotate.active && transform.rotate.time > 0) return true;
+    if (transform.translate.active && transform.translate.time > 0 && transform.translate.align
+        && !transform.translate.controlPoints.empty()) return true;
+    return std::any_of(group.children.begin(), group.children.end(), isAnimated);
+}
+
+struct StaticBatch {
+    Model model;
+    std::shared_ptr<Mesh> mesh;
+};
+
+void appendTransformed(Mesh& target, const Mesh& source, const Mat4& world, const float normals[9]) {
+    unsigned int base = static_cast<unsigned int>(target.vertices.size());
+    for (size_t i = 0; i < source.vertices.size(); ++i) {
+        target.vertices.push_back(transformPoint(world, source.vertices[i]));
+
+        const Vector3& n = source.normals[i];
+        Vector3 normal = { normals[0] * n.x + normals[3] * n.y + normals[6] * n.z,
+            normals[1] * n.x + normals[4] * n.y + normals[7] * n.z,
+            normals[2] * n.x + normals[5] * n.y + normals[8] * n.z };
+        float size = std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+        if (size > 0) normal = { normal.x / size, normal.y / size, normal.z / size };
+        target.normals.push_back(normal);
+        target.texCoords.push_back(source.texCoords[i]);
+    }
+
+    if (source.indices.empty()) {
+        for (size_t i = 0; i < source.vertices.size(); ++i) target.indices.push_back(base + static_cast<unsigned int>(i));
+    }
+    else {
+        for (unsigned int index : source.indices) target.indices.push_back(base + index);
+    }
+}
+
+// Same transform order as queueGroup and updateGroup, evaluated once
+void collectStaticModels(const Group& group, const Mat4& parent, std::unordered_map<uint64_t, StaticBatch>& batches,
+    std::vector<uint64_t>& order) {
+    Mat4 world = parent;
+    const Transform& transform = group.transform;
+    if (transform.hasScale) {
+        world = multiply(world, scaleMatrix(transform.scale.x, transform.scale.y, transform.scale.z));
+    }
+    if (transform.rotate.active) {
+        world = multiply(world, rotationMatrix(transform.rotate.angle, transform.rotate.axis.x, transform.rotate.axis.y, transform.rotate.axis.z));
+    }
+    if (transform.translate.active && !transform.translate.controlPoints.empty()) {
+        Point3D pos = transform.translate.controlPoints[0];
+        world = multiply(world, translationMatrix(pos.x, pos.y, pos.z));
+    }
+
+    float normals[9];
+    normalMatrix(world, normals);
+    for (const Model& model : group.models) {
+        if (!model.mesh) continue;
+        uint64_t key = (uint64_t(model.materialId) << 32) | model.textureId;
+        StaticBatch& batch = batches[key];
+        if (!batch.mesh) {
+            batch.model = model;
+            batch.mesh = std::make_shared<Mesh>();
+            batch.mesh->name = "static batch";
+            order.push_back(key);
+        }
+        pageInGeometry(*model.mesh);
+        appendTransformed(*batch.mesh, *model.mesh, world, normals);
+    }
+
+    for (const Group& child : group.children) {
+        collectStaticModels(child, world, batches, order);
+    }
+}
+
+bool containsPatches(const Group& group) {
+    for (const Model& model : group.models) {
+        if (model.mesh && model.mesh->patches) return true;
+    }
+    return std::any_of(group.children.begin(), group.children.end(), containsPatches);
+}
+
+// Replaces each static subtree by a single group holding one pre-transformed mesh per material
+// and texture pair, in the space of the subtree's parent. Subtrees that would not lose any draws
+// are left alone, as are animated groups and groups holding patches, which cannot be merged into
+// triangles; their children are searched instead. The new meshes are added to uploads without
+// touching GL, so this can run off the GL thread.
+size_t bakeStaticGroups(Group& group, std::vector<Mesh*>& uploads) {
+    if (!isStaticSubtree(group) || containsPatches(group)) {
+        size_t baked = 0;
+        for (Group& child : group.children) baked += bakeStaticGroups(child, uploads);
+        return baked;
+    }
+
+    std::unordered_map<uint64_t, StaticBatch> batches;
+    std::vector<uint64_t> order;
+    collectStaticModels(group, identityMatrix(), batches, order);
+
+    computeGroupBounds(group);
+    size_t models = group.modelCount;
+    if (order.size() >= models) return 0;
+
+    group.models.clear();
+    group.children.clear();
+    group.transform = Transform();
+    group.transform.translate.active = false;
+    group.transform.rotate.active = false;
+
+    for (uint64_t key : order) {
+        StaticBatch& batch = batches[key];
+        computeMeshBounds(*batch.mesh);
+        uploads.push_back(batch.mesh.get());
+
+        Model model = batch.model;
+        model.name = "static batch";
+        model.mesh = batch.mesh;
+        group.models.push_back(model);
+    }
+    return models;
+}
+
+size_t meshCount = 0;
+
+void uploadMesh(Mesh& mesh) {
+    initializeVBO(mesh);
+    mesh.id = static_cast<unsigned int>(++meshCount);
+}
+
+// Meshes and textures not on the GPU yet. Those without CPU data (everything but snapshot
+// contents) are read and decoded on the job system before this returns.
+struct PendingResources {
+    std::vector<Mesh*> meshes;
+    std::vector<std::pair<const std::string*, Texture*>> textures;
+};
+
+PendingResources readSceneResources(World& world) {
+    JobSystem& jobs = getJobSystem();
+    PendingResources pending;
+
+    for (auto& entry : world.meshes) {
+        Mesh* mesh = entry.second.get();
+        if (mesh->vaoId != 0) continue;
+        pending.meshes.push_back(mesh);
+        if (!mesh->vertices.empty()) continue;
+        const std::string* path = &entry.first;
+        jobs.submit([path, mesh]() { loadMesh(*path, *mesh); });
+    }
+
+    for (auto& entry : world.textures) {
+        Texture* texture = &entry.second;
+        if (texture->id != 0) continue;
+        pending.textures.push_back(std::make_pair(&entry.first, texture));
+        if (texture->pixels) continue;
+        const std::string* path = &entry.first;
+        jobs.submit([path, texture]() { decodeTexture(*path, *texture); });
+    }
+
+    jobs.wait();
+    return pending;
+}
+
+// Material ids, texture ids, bounds and static baking for each top-level group. Groups an earlier
+// load already baked (kept by hot reload) are not baked again. Batch meshes go to uploads.
+size_t prepareGroups(World& world, std::vector<Mesh*>& uploads) {
+    size_t baked = 0;
+    world.groupSources.resize(world.groups.size());
+    for (size_t i = 0; i < world.groups.size(); ++i) {
+        Group& group = world.groups[i];
+        GroupSource& source = world.groupSources[i];
+        resolveTextures(group, world);
+        assignMaterialIds(group, world);
+        if (useStaticBaking && !source.loaded) {
+            size_t models = bakeStaticGroups(group, uploads);
+            source.baked = models > 0;
+            baked += models;
+        }
+        source.loaded = true;
+        computeGroupBounds(group);
+    }
+    return baked;
+}
+
+// Every mesh the world draws: file meshes and the batches baking put in their place
+std::vector<Mesh*> collectMeshes(World& world) {
+    std::vector<Mesh*> meshes;
+    std::unordered_set<Mesh*> seen;
+    for (auto& entry : world.meshes) {
+        meshes.push_back(entry.second.get());
+        seen.insert(entry.second.get());
+    }
+    std::function<void(Group&)> visit = [&](Group& group) {
+        for (Model& model : group.models) {
+            if (model.mesh && seen.insert(model.mesh.get()).second) meshes.push_back(model.mesh.get());
+        }
+        for (Group& child : group.children) visit(child);
+    };
+    for (Group& group : world.groups) visit(group);
+    return meshes;
+}
+
+size_t textureGpuBytes(const Texture& texture) {
+    if (texture.id == 0) return 0;
+    size_t bytes = 0;
+    int width = texture.width, height = texture.height;
+    while (true) {
+        bytes += size_t(width) * height * (texture.channels == 4 ? 4 : 3);
+        if (width == 1 && height == 1) break;
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+    return bytes;
+}
+
+// CPU against GPU bytes for every mesh and texture; detailed lists each of them
+void reportMemory(World& world, bool detailed) {
+    size_t cpu = 0, gpu = 0;
+    std::vector<Mesh*> meshes = collectMeshes(world);
+    for (Mesh* mesh : meshes) {
+        size_t meshCpu = cpuGeometryBytes(*mesh);
+        cpu += meshCpu;
+        gpu += mesh->gpuBytes;
+        if (detailed) {
+            std::cout << "  " << mesh->name << ": " << meshCpu / 1024.0 << " KB CPU, " << mesh->gpuBytes / 1024.0
+                << " KB GPU (" << mesh->vertexCount << " vertices, " << mesh->indexCount << " indices)" << std::endl;
+        }
+    }
+    for (auto& entry : world.textures) {
+        size_t textureGpu = textureGpuBytes(entry.second);
+        gpu += textureGpu;
+        if (detailed) {
+            std::cout << "  " << entry.first << ": 0 KB CPU, " << textureGpu / 1024.0 << " KB GPU ("
+                << entry.second.width << "x" << entry.second.height << ")" << std::endl;
+        }
+    }
+    std::cout << "Memory: " << meshes.size() << " meshes and " << world.textures.size() << " textures, "
+        << cpu / 1024.0 << " KB CPU, " << gpu / 1024.0 << " KB GPU" << std::endl;
+}
+
+// Reads every pending mesh and texture of the world on the job system, then does the GL uploads
+// here on the calling (GL) thread, since only it owns the context.
+void loadSceneResources(World& world) {
+    auto start = std::chrono::steady_clock::now();
+    JobSystem& jobs = getJobSystem();
+
+    PendingResources pending = readSceneResources(world);
+    std::vector<Mesh*>& pendingMeshes = pending.meshes;
+    std::vector<std::pair<const std::string*, Texture*>>& pendingTextures = pending.textures;
+
+    for (Mesh* mesh : pendingMeshes) {
+        uploadMesh(*mesh);
+    }
+    for (auto& texture : pendingTextures) {
+        uploadTexture(*texture.first, *texture.second);
+    }
+    std::vector<Mesh*> batches;
+    size_t baked = prepareGroups(world, batches);
+    for (Mesh* mesh : batches) {
+        uploadMesh(*mesh);
+    }
+    for (Mesh* mesh : collectMeshes(world)) {
+        releaseCpuGeometry(*mesh);
+    }
+    sceneAnimated = std::any_of(world.groups.begin(), world.groups.end(), isAnimated);
+    requestRedraw();
+
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Loaded " << pendingMeshes.size() << " meshes and " << pendingTextures.size() << " textures in "
+        << elapsed << " ms using " << jobs.workerCount() << " threads" << std::endl;
+    if (baked > 0) {
+        std::cout << "Baked " << baked << " static models into batched meshes" << std::endl;
+    }
+    reportMemory(world, false);
+}
+
+struct SceneMemory {
+    size_t groups = 0;
+    size_t models = 0;
+    size_t controlPoints = 0;
+    size_t bytes = 0;
+};
+
+// Short strings live inside the object; only a buffer outside it is heap
+size_t stringHeapBytes(const std::string& text) {
+    const char* object = reinterpret_cast<const char*>(&text);
+    bool inside = text.data() >= object && text.data() < object + sizeof(std::string);
+    return inside ? 0 : text.capacity() + 1;
+}
+
+// Heap owned by the scene graph itself: node vectors, control points and model strings.
+// Meshes and textures are shared and not included.
+void measureGroup(const Group& group, SceneMemory& memory) {
+    ++memory.groups;
+    memory.models += group.models.size();
+    memory.controlPoints += group.transform.translate.controlPoints.size();
+    memory.bytes += group.children.capacity() * sizeof(Group) + group.models.capacity() * sizeof(Model)
+        + group.transform.translate.controlPoints.capacity() * sizeof(Point3D);
+    for (const Model& model : group.models) {
+        memory.bytes += stringHeapBytes(model.name) + stringHeapBytes(model.textureFile);
+    }
+    for (const Group& child : group.children) {
+        measureGroup(child, memory);
+    }
+}
+
+void reportSceneMemory(const World& world) {
+    SceneMemory memory;
+    memory.bytes = world.groups.capacity() * sizeof(Group);
+    for (const Group& group : world.groups) {
+        measureGroup(group, memory);
+    }
+    std::cout << "Scene graph: " << memory.groups << " groups, " << memory.models << " models, "
+        << memory.controlPoints << " control points, " << memory.bytes / 1024.0 << " KB" << std::endl;
+}
+
+// The camera as the XML last gave it; the live one in worldConfig follows user input
+Camera parsedCamera;
+
+bool parseSceneFile(const std::string& filename) {
+    auto start = std::chrono::steady_clock::now();
+    World world;
+    if (!SceneLoader(world).load(filename)) return false;
+    worldConfig = std::move(world);
+    parsedCamera = worldConfig.camera;
+    applyCameraOrbit(worldConfig.orbit);
+
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Parsed " << filename << " in " << elapsed << " ms" << std::endl;
+    reportSceneMemory(worldConfig);
+    return true;
+}
+
+void parseXML(const std::string& filename) {
+    if (parseSceneFile(filename)) loadSceneResources(worldConfig);
+}
+
+// Read-only view of a whole file, mapped instead of read so a snapshot costs no copy to open
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& filename) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) {
+            close();
+            return false;
+        }
+        bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        length = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (view == MAP_FAILED) return false;
+        bytes = static_cast<const char*>(view);
+        length = static_cast<size_t>(info.st_size);
+#endif
+        if (!bytes) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (bytes) UnmapViewOfFile(bytes);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (bytes) munmap(const_cast<char*>(bytes), length);
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
+
+// A scene snapshot ("engine --bake") is the resolved scene in one file: window, camera and
+// lights, then every unique mesh with its vertex data and bounds, every texture with its mip
+// chain already built, and the groups in pre-order with models referring to meshes by index.
+// It holds offsets and counts only, never pointers, so it can be mapped at any address.
+// Arrays start on 8-byte boundaries so they can be copied or uploaded straight from the mapping.
+const char SNAPSHOT_MAGIC[8] = { 'C', 'G', 'S', 'C', 'E', 'N', 'E', '\0' };
+const uint32_t SNAPSHOT_VERSION = 1;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t meshCount;
+    uint32_t textureCount;
+    uint32_t lightCount;
+    uint32_t groupCount;
+    Window window;
+    Camera camera;
+    float alfa, beta, radius;
+};
+
+class SnapshotWriter {
+public:
+    template <typename T>
+    void write(const T& value) { append(&value, sizeof(T)); }
+
+    template <typename T>
+    void writeArray(const std::vector<T>& values) {
+        write(uint64_t(values.size()));
+        writeBytes(values.data(), values.size() * sizeof(T));
+    }
+
+    void writeBytes(const void* data, size_t size) {
+        bytes.resize((bytes.size() + 7) & ~size_t(7));
+        append(data, size);
+    }
+
+    void writeString(const std::string& text) {
+        write(uint32_t(text.size()));
+        append(text.data(), text.size());
+    }
+
+    bool save(const std::string& filename) const {
+        std::ofstream file(filename, std::ios::binary);
+        file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        return file.good();
+    }
+
+    size_t size() const { return bytes.size(); }
+
+private:
+    std::vector<char> bytes;
+
+    void append(const void* data, size_t size) {
+        const char* source = static_cast<const char*>(data);
+        bytes.insert(bytes.end(), source, source + size);
+    }
+};
+
+// Walks a mapped snapshot. Every read is bounds checked; after the first failure good() stays
+// false and later reads do nothing, so callers check once at the end.
+class SnapshotReader {
+public:
+    SnapshotReader(const char* data, size_t size) : bytes(data), length(size) {}
+
+    template <typename T>
+    bool read(T& value) {
+        const char* source = take(sizeof(T), false);
+        if (source) std::memcpy(&value, source, sizeof(T));
+        return source != nullptr;
+    }
+
+    template <typename T>
+    bool readArray(std::vector<T>& values) {
+        uint64_t count = 0;
+        if (!read(count) || count > length / sizeof(T)) return fail();
+        const char* source = takeBytes(static_cast<size_t>(count) * sizeof(T));
+        if (!source) return false;
+        values.resize(static_cast<size_t>(count));
+        if (count > 0) std::memcpy(values.data(), source, values.size() * sizeof(T));
+        return true;
+    }
+
+    const char* takeBytes(size_t size) { return take(size, true); }
+
+    bool readString(std::string& text) {
+        uint32_t size = 0;
+        if (!read(size)) return false;
+        const char* source = take(size, false);
+        if (source) text.assign(source, size);
+        return source != nullptr;
+    }
+
+    bool good() const { return ok; }
+    size_t remaining() const { return length - position; }
+
+private:
+    const char* bytes;
+    size_t length;
+    size_t position = 0;
+    bool ok = true;
+
+    bool fail() {
+        ok = false;
+        return false;
+    }
+
+    const char* take(size_t size, bool aligned) {
+        if (!ok) return nullptr;
+        size_t start = aligned ? (position + 7) & ~size_t(7) : position;
+        if (start > length || size > length - start) {
+            fail();
+            return nullptr;
+        }
+        position = start + size;
+        return bytes + start;
+    }
+};
+
+// Box-filtered mip chain down to 1x1, level 0 first, the same reduction glGenerateMipmap does
+std::vector<unsigned char> buildMipChain(const Texture& texture, int& levels) {
+    int channels = texture.channels;
+    int width = texture.width, height = texture.height;
+    std::vector<unsigned char> chain(texture.pixels, texture.pixels + size_t(width) * height * channels);
+    size_t source = 0;
+    levels = 1;
+    while (width > 1 || height > 1) {
+        int nextWidth = std::max(1, width / 2), nextHeight = std::max(1, height / 2);
+        size_t target = chain.size();
+        chain.resize(target + size_t(nextWidth) * nextHeight * channels);
+        for (int y = 0; y < nextHeight; ++y) {
+            int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+            for (int x = 0; x < nextWidth; ++x) {
+                int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+                for (int c = 0; c < channels; ++c) {
+                    unsigned sum = chain[source + (size_t(y0) * width + x0) * channels + c]
+                        + chain[source + (size_t(y0) * width + x1) * channels + c]
+                        + chain[source + (size_t(y1) * width + x0) * channels + c]
+                        + chain[source + (size_t(y1) * width + x1) * channels + c];
+                    chain[target + (size_t(y) * nextWidth + x) * channels + c] = static_cast<unsigned char>((sum + 2) / 4);
+                }
+            }
+        }
+        source = target;
+        width = nextWidth;
+        height = nextHeight;
+        ++levels;
+    }
+    return chain;
+}
+
+void writeSnapshotGroup(SnapshotWriter& out, const Group& group, const std::unordered_map<const Mesh*, uint32_t>& meshIndices) {
+    const Transform& transform = group.transform;
+    out.write(transform.scale);
+    out.write(transform.hasScale);
+    out.write(transform.translate.active);
+    out.write(transform.translate.align);
+    out.write(transform.translate.time);
+    out.writeArray(transform.translate.controlPoints);
+    out.write(transform.rotate.active);
+    out.write(transform.rotate.angle);
+    out.write(transform.rotate.axis);
+    out.write(transform.rotate.time);
+
+    out.write(uint32_t(group.models.size()));
+    for (const Model& model : group.models) {
+        out.writeString(model.name);
+        out.write(meshIndices.at(model.mesh.get()));
+        out.write(model.material);
+        out.writeString(model.textureFile);
+    }
+    out.write(uint32_t(group.children.size()));
+    for (const Group& child : group.children) {
+        writeSnapshotGroup(out, child, meshIndices);
+    }
+}
+
+bool readSnapshotGroup(SnapshotReader& in, Group& group, const std::vector<std::shared_ptr<Mesh>>& meshes, int depth) {
+    Transform& transform = group.transform;
+    in.read(transform.scale);
+    in.read(transform.hasScale);
+    in.read(transform.translate.active);
+    in.read(transform.translate.align);
+    in.read(transform.translate.time);
+    in.readArray(transform.translate.controlPoints);
+    in.read(transform.rotate.active);
+    in.read(transform.rotate.angle);
+    in.read(transform.rotate.axis);
+    in.read(transform.rotate.time);
+
+    uint32_t modelCount = 0;
+    if (!in.read(modelCount) || modelCount > in.remaining()) return false;
+    group.models.reserve(modelCount);
+    for (uint32_t i = 0; i < modelCount && in.good(); ++i) {
+        Model model;
+        uint32_t meshIndex = 0;
+        in.readString(model.name);
+        if (!in.read(meshIndex) || meshIndex >= meshes.size()) return false;
+        model.mesh = meshes[meshIndex];
+        in.read(model.material);
+        in.readString(model.textureFile);
+        group.models.push_back(std::move(model));
+    }
+
+    uint32_t childCount = 0;
+    if (!in.read(childCount) || childCount > in.remaining() || depth > 256) return false;
+    group.children.reserve(childCount);
+    for (uint32_t i = 0; i < childCount; ++i) {
+        group.children.emplace_back();
+        if (!readSnapshotGroup(in, group.children.back(), meshes, depth + 1)) return false;
+    }
+    return in.good();
+}
+
+// Parses scene, reads every file it names and writes the result to output. Needs no GL context:
+// mip chains are built here and static baking still runs when the snapshot is loaded.
+bool bakeSceneSnapshot(const std::string& scene, const std::string& output) {
+    auto start = std::chrono::steady_clock::now();
+    // Snapshots hold triangles, so patches are tessellated here as without GL 4.0
+    useTessellation = false;
+    if (!parseSceneFile(scene)) return false;
+    World& world = worldConfig;
+    readSceneResources(world);
+
+    SnapshotHeader header = {};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.meshCount = uint32_t(world.meshes.size());
+    header.textureCount = uint32_t(world.textures.size());
+    header.lightCount = uint32_t(world.lights.size());
+    header.groupCount = uint32_t(world.groups.size());
+    header.window = world.window;
+    header.camera = world.camera;
+    header.alfa = alfa;
+    header.beta = beta;
+    header.radius = radius;
+
+    SnapshotWriter out;
+    out.write(header);
+    for (const Light& light : world.lights) {
+        out.writeString(light.type);
+        out.write(light.position);
+        out.write(light.direction);
+        out.write(light.cutoff);
+        out.write(light.ambient);
+        out.write(light.diffuse);
+        out.write(light.specular);
+    }
+
+    std::unordered_map<const Mesh*, uint32_t> meshIndices;
+    for (const auto& entry : world.meshes) {
+        const Mesh& mesh = *entry.second;
+        meshIndices[&mesh] = uint32_t(meshIndices.size());
+        out.writeString(entry.first);
+        out.write(mesh.quantized);
+        out.write(mesh.bounds);
+        out.writeArray(mesh.vertices);
+        out.writeArray(mesh.normals);
+        out.writeArray(mesh.texCoords);
+        out.writeArray(mesh.indices);
+        if (mesh.quantized) {
+            const QuantizedVertices& packed = mesh.packed;
+            out.write(packed.boundsMin);
+            out.write(packed.boundsMax);
+            out.write(packed.uvMin);
+            out.write(packed.uvMax);
+            out.writeArray(packed.positions);
+            out.writeArray(packed.normals);
+            out.writeArray(packed.texCoords);
+        }
+    }
+
+    for (auto& entry : world.textures) {
+        Texture& texture = entry.second;
+        std::vector<unsigned char> chain;
+        int levels = 0;
+        if (texture.pixels) {
+            chain = buildMipChain(texture, levels);
+            stbi_image_free(texture.pixels);
+            texture.pixels = nullptr;
+        }
+        out.writeString(entry.first);
+        out.write(int32_t(texture.width));
+        out.write(int32_t(texture.height));
+        out.write(int32_t(texture.channels));
+        out.write(int32_t(levels));
+        out.writeArray(chain);
+    }
+
+    for (const Group& group : world.groups) {
+        writeSnapshotGroup(out, group, meshIndices);
+    }
+
+    if (!out.save(output)) {
+        std::cerr << "Erro ao escrever o snapshot: " << output << std::endl;
+        return false;
+    }
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Baked " << scene << " into " << output << " (" << out.size() << " bytes, "
+        << world.meshes.size() << " meshes, " << world.textures.size() << " textures) in " << elapsed << " ms" << std::endl;
+    return true;
+}
+
+bool isSceneSnapshot(const std::string& filename) {
+    char magic[sizeof(SNAPSHOT_MAGIC)] = {};
+    std::ifstream file(filename, std::ios::binary);
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+}
+
+// Builds worldConfig from a snapshot and hands it to loadSceneResources. Mesh data is copied out
+// of the mapping; texture levels are uploaded from it directly, before it is unmapped.
+bool loadSceneSnapshot(const std::string& filename) {
+    auto start = std::chrono::steady_clock::now();
+    MappedFile file;
+    if (!file.open(filename)) {
+        std::cerr << "Erro ao mapear o snapshot: " << filename << std::endl;
+        return false;
+    }
+
+    SnapshotReader in(file.data(), file.size());
+    SnapshotHeader header;
+    if (!in.read(header) || std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != SNAPSHOT_VERSION) {
+        std::cerr << "Snapshot invlido ou de outra verso: " << filename << std::endl;
+        return false;
+    }
+
+    World& world = worldConfig;
+    world.window = header.window;
+    world.camera = header.camera;
+    alfa = header.alfa;
+    beta = header.beta;
+    radius = header.radius;
+
+    for (uint32_t i = 0; i < header.lightCount && in.good(); ++i) {
+        Light light;
+        in.readString(light.type);
+        in.read(light.position);
+        in.read(light.direction);
+        in.read(light.cutoff);
+        in.read(light.ambient);
+        in.read(light.diffuse);
+        in.read(light.specular);
+        world.lights.push_back(light);
+    }
+
+    std::vector<std::shared_ptr<Mesh>> meshes;
+    for (uint32_t i = 0; i < header.meshCount && in.good(); ++i) {
+        std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+        in.readString(mesh->name);
+        in.read(mesh->quantized);
+        in.read(mesh->bounds);
+        in.readArray(mesh->vertices);
+        in.readArray(mesh->normals);
+        in.readArray(mesh->texCoords);
+        in.readArray(mesh->indices);
+        if (mesh->quantized) {
+            QuantizedVertices& packed = mesh->packed;
+            in.read(packed.boundsMin);
+            in.read(packed.boundsMax);
+            in.read(packed.uvMin);
+            in.read(packed.uvMax);
+            in.readArray(packed.positions);
+            in.readArray(packed.normals);
+            in.readArray(packed.texCoords);
+        }
+        world.meshes[mesh->name] = mesh;
+        meshes.push_back(mesh);
+    }
+
+    for (uint32_t i = 0; i < header.textureCount && in.good(); ++i) {
+        std::string path;
+        int32_t width = 0, height = 0, channels = 0, levels = 0;
+        uint64_t size = 0;
+        in.readString(path);
+        in.read(width);
+        in.read(height);
+        in.read(channels);
+        in.read(levels);
+        in.read(size);
+        const char* pixels = in.takeBytes(static_cast<size_t>(size));
+        Texture& texture = world.textures[path];
+        if (!pixels || size == 0) continue;
+        texture.width = width;
+        texture.height = height;
+        texture.channels = channels;
+        texture.levels = levels;
+        texture.pixels = reinterpret_cast<unsigned char*>(const_cast<char*>(pixels));
+        texture.mapped = true;
+    }
+
+    world.groups.reserve(std::min<size_t>(header.groupCount, in.remaining()));
+    // A group that fails its own checks leaves the reader mid-record, so nothing after it can be trusted
+    bool groupsRead = true;
+    for (uint32_t i = 0; i < header.groupCount && in.good() && groupsRead; ++i) {
+        world.groups.emplace_back();
+        groupsRead = readSnapshotGroup(in, world.groups.back(), meshes, 0);
+    }
+
+    if (!in.good() || !groupsRead) {
+        std::cerr << "Snapshot truncado ou corrompido: " << filename << std::endl;
+        worldConfig = World();
+        return false;
+    }
+    reportSceneMemory(world);
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Mapped snapshot " << filename << " (" << file.size() << " bytes) in " << elapsed << " ms" << std::endl;
+
+    loadSceneResources(world);
+    return true;
+}
+
+
+// Software rendering, for render nodes without a GPU: the frame display() draws, produced on the
+// CPU into memory. It takes the same sceneObjects and sceneCurves as the instanced path and
+// follows the GL pipeline the other paths use: lighting per vertex from the state initializeLighting
+// and applyMaterial set, perspective-correct interpolation, textures modulated with one mip level
+// per triangle, and a GL_LESS depth test. Objects are transformed and their triangles set up on
+// the job system; the triangles are then binned into screen tiles, which are rasterized in
+// parallel four pixels at a time.
+#ifdef ENGINE_SSE2
+struct Float4 {
+    __m128 v;
+
+    Float4(__m128 v) : v(v) {}
+    explicit Float4(float x) : v(_mm_set1_ps(x)) {}
+
+    static Float4 load(const float* p) { return _mm_loadu_ps(p); }
+    static Float4 ramp() { return _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f); }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+
+    Float4 operator+(const Float4& o) const { return _mm_add_ps(v, o.v); }
+    Float4 operator*(const Float4& o) const { return _mm_mul_ps(v, o.v); }
+    Float4 operator>=(const Float4& o) const { return _mm_cmpge_ps(v, o.v); }
+    Float4 operator<(const Float4& o) const { return _mm_cmplt_ps(v, o.v); }
+    Float4 operator&(const Float4& o) const { return _mm_and_ps(v, o.v); }
+    // One bit per lane where the comparison held
+    int mask() const { return _mm_movemask_ps(v); }
+};
+#else
+struct Float4 {
+    float v[4];
+
+    explicit Float4(float x) : v{ x, x, x, x } {}
+    Float4(float a, float b, float c, float d) : v{ a, b, c, d } {}
+
+    static Float4 load(const float* p) { return Float4(p[0], p[1], p[2], p[3]); }
+    static Float4 ramp() { return Float4(0.0f, 1.0f, 2.0f, 3.0f); }
+    void store(float* p) const { std::memcpy(p, v, sizeof(v)); }
+
+    Float4 operator+(const Float4& o) const { return Float4(v[0] + o.v[0], v[1] + o.v[1], v[2] + o.v[2], v[3] + o.v[3]); }
+    Float4 operator*(const Float4& o) const { return Float4(v[0] * o.v[0], v[1] * o.v[1], v[2] * o.v[2], v[3] * o.v[3]); }
+    Float4 operator>=(const Float4& o) const {
+        return Float4(v[0] >= o.v[0], v[1] >= o.v[1], v[2] >= o.v[2], v[3] >= o.v[3]);
+    }
+    Float4 operator<(const Float4& o) const { return Float4(v[0] < o.v[0], v[1] < o.v[1], v[2] < o.v[2], v[3] < o.v[3]); }
+    Float4 operator&(const Float4& o) const { return *this * o; }
+    int mask() const { return (v[0] != 0) | (v[1] != 0) << 1 | (v[2] != 0) << 2 | (v[3] != 0) << 3; }
+};
+#endif
+
+// A texture kept on the CPU as a mip chain, level 0 first
+struct SoftwareTexture {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    int levels = 0;
+    std::vector<unsigned char> pixels;
+    std::vector<size_t> offsets;
+};
+
+// One GL light as initializeLighting leaves it. Positions are in eye space, since the lights are
+// specified under an identity modelview; point lights keep GL's default (0, 0, 1, 0).
+struct SoftwareLight {
+    float position[4];
+    Color ambient;
+    Color diffuse;
+    Color specular;
+    Point3D spotDirection;
+    float spotCutoff;
+};
+
+std::vector<SoftwareLight> softwareLights(const std::vector<Light>& lights) {
+    std::vector<SoftwareLight> result;
+    for (const Light& light : lights) {
+        if (result.size() == 8) break;
+        SoftwareLight l = { { 0.0f, 0.0f, 1.0f, 0.0f }, light.ambient, light.diffuse, light.specular, { 0.0f, 0.0f, -1.0f }, 180.0f };
+        if (light.type == "spot" || light.type == "directional") {
+            float position[4] = { light.position.x, light.position.y, light.position.z, 1.0f };
+            std::memcpy(l.position, position, sizeof(position));
+        }
+        if (light.type == "spot") {
+            l.spotDirection = { light.direction.x, light.direction.y, light.direction.z };
+            l.spotCutoff = light.cutoff;
+        }
+        result.push_back(l);
+    }
+    return result;
+}
+
+// fixedFunctionLighting on the CPU, for an eye-space position and unit normal
+Color lightVertex(const Point3D& eye, const Point3D& n, const Material& material, const std::vector<SoftwareLight>& lights) {
+    Color color = { material.emissive.r + material.ambient.r * lightModelAmbient,
+        material.emissive.g + material.ambient.g * lightModelAmbient,
+        material.emissive.b + material.ambient.b * lightModelAmbient };
+    for (const SoftwareLight& light : lights) {
+        Point3D l = { light.position[0], light.position[1], light.position[2] };
+        float attenuation = 1.0f;
+        if (light.position[3] != 0.0f) {
+            l = subtract(l, eye);
+            if (light.spotCutoff <= 90.0f) {
+                Point3D direction = light.spotDirection;
+                float spot = -dot(l, direction) / (length(l) * length(direction));
+                if (spot < std::cos(light.spotCutoff * static_cast<float>(M_PI) / 180.0f)) attenuation = 0.0f;
+            }
+        }
+        l = normalize(l);
+
+        float diffuse = std::max(dot(n, l), 0.0f);
+        Color lit = { material.ambient.r * light.ambient.r + diffuse * material.diffuse.r * light.diffuse.r,
+            material.ambient.g * light.ambient.g + diffuse * material.diffuse.g * light.diffuse.g,
+            material.ambient.b * light.ambient.b + diffuse * material.diffuse.b * light.diffuse.b };
+        if (diffuse > 0.0f) {
+            Point3D h = normalize({ l.x, l.y, l.z + 1.0f });
+            float specular = std::pow(std::max(dot(n, h), 0.0f), material.shininess);
+            lit.r += specular * material.specular.r * light.specular.r;
+            lit.g += specular * material.specular.g * light.specular.g;
+            lit.b += specular * material.specular.b * light.specular.b;
+        }
+        color.r += attenuation * lit.r;
+        color.g += attenuation * lit.g;
+        color.b += attenuation * lit.b;
+    }
+    return { std::min(std::max(color.r, 0.0f), 1.0f), std::min(std::max(color.g, 0.0f), 1.0f), std::min(std::max(color.b, 0.0f), 1.0f) };
 }
 
-void drawNormals(const std::vector<Model>& models) {
-    glDisable(GL_LIGHTING);
-    glColor3f(0.0f, 1.0f, 0.0f);
+class SoftwareRenderer {
+public:
+    SoftwareRenderer(int width, int height)
+        : width(std::max(1, width)), height(std::max(1, height)), depthStride((this->width + 3) & ~3),
+        tilesX((this->width + TILE_SIZE - 1) / TILE_SIZE), tilesY((this->height + TILE_SIZE - 1) / TILE_SIZE),
+        color(size_t(this->width) * this->height * 3), depth(size_t(depthStride) * this->height), bins(size_t(tilesX) * tilesY) {}
+
+    void addTexture(unsigned int id, const Texture& texture) {
+        SoftwareTexture& target = textures[id];
+        target.width = texture.width;
+        target.height = texture.height;
+        target.channels = texture.channels;
+        target.pixels = buildMipChain(texture, target.levels);
+        size_t offset = 0;
+        for (int level = 0; level < target.levels; ++level) {
+            target.offsets.push_back(offset);
+            offset += size_t(std::max(1, texture.width >> level)) * std::max(1, texture.height >> level) * texture.channels;
+        }
+    }
 
-    glBegin(GL_LINES);
-    for (const auto& model : models) {
-        for (size_t i = 0; i < model.vertices.size(); ++i) {
-            Point3D vertex = model.vertices[i];
-            Vector3 normal = model.normals[i];
+    size_t triangleCount() const {
+        return triangles.size();
+    }
 
-            glVertex3f(vertex.x, vertex.y, vertex.z);
-            glVertex3f(vertex.x + normal.x * 0.1f, vertex.y + normal.y * 0.1f, vertex.z + normal.z * 0.1f);
+    // Clears the frame and draws the axes, the translate curves and the visible objects
+    void draw(const Mat4& projection, const Mat4& view, const std::vector<size_t>& visible) {
+        std::fill(color.begin(), color.end(), 0);
+        std::fill(depth.begin(), depth.end(), 1.0f);
+        lights = softwareLights(worldConfig.lights);
+
+        Mat4 viewProjection = multiply(projection, view);
+        const unsigned char axisColors[3][3] = { { 255, 0, 0 }, { 0, 255, 0 }, { 0, 0, 255 } };
+        for (int axis = 0; axis < 3; ++axis) {
+            float a[3] = { 0.0f, 0.0f, 0.0f }, b[3] = { 0.0f, 0.0f, 0.0f };
+            a[axis] = -5.0f;
+            b[axis] = 5.0f;
+            drawLine(viewProjection, { a[0], a[1], a[2] }, { b[0], b[1], b[2] }, axisColors[axis]);
+        }
+        const unsigned char white[3] = { 255, 255, 255 };
+        for (const CurveItem& curve : sceneCurves) {
+            Mat4 matrix = multiply(viewProjection, curve.world);
+            std::vector<Point3D> strip = sampleCatmullRom(*curve.controlPoints);
+            for (size_t i = 1; i < strip.size(); ++i) drawLine(matrix, strip[i - 1], strip[i], white);
         }
-    }
-    glEnd();
 
-    glEnable(GL_LIGHTING);
-}
+        for (size_t index : visible) {
+            const Mesh* mesh = sceneObjects[index].model->mesh.get();
+            if (!windings.count(mesh)) windings[mesh] = outsideWinding(*mesh);
+        }
 
-void drawGroupNormals(const Group& group) {
-    drawNormals(group.models);
+        // Chunks keep the objects in order, so triangles are binned and drawn in submission order
+        JobSystem& jobs = getJobSystem();
+        size_t chunkCount = std::max<size_t>(1, std::min<size_t>(visible.size(), jobs.workerCount() * 4));
+        std::vector<std::vector<RasterTriangle>> chunks(chunkCount);
+        for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+            size_t begin = visible.size() * chunk / chunkCount, end = visible.size() * (chunk + 1) / chunkCount;
+            jobs.submit([this, &visible, &chunks, &projection, &view, chunk, begin, end]() {
+                std::vector<ClipVertex> vertices;
+                for (size_t i = begin; i < end; ++i) {
+                    setupObject(sceneObjects[visible[i]], projection, view, vertices, chunks[chunk]);
+                }
+            });
+        }
+        jobs.wait();
+
+        triangles.clear();
+        for (auto& bin : bins) bin.clear();
+        for (const auto& chunk : chunks) {
+            for (const RasterTriangle& triangle : chunk) {
+                uint32_t index = static_cast<uint32_t>(triangles.size());
+                triangles.push_back(triangle);
+                for (int ty = triangle.minY / TILE_SIZE; ty <= triangle.maxY / TILE_SIZE; ++ty) {
+                    for (int tx = triangle.minX / TILE_SIZE; tx <= triangle.maxX / TILE_SIZE; ++tx) {
+                        bins[size_t(ty) * tilesX + tx].push_back(index);
+                    }
+                }
+            }
+        }
 
-    for (const Group& child : group.children) {
-        drawGroupNormals(child);
+        for (size_t tile = 0; tile < bins.size(); ++tile) {
+            if (bins[tile].empty()) continue;
+            jobs.submit([this, tile]() { rasterizeTile(tile); });
+        }
+        jobs.wait();
     }
-}
 
-void display() {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // Binary PPM, top row first
+    bool writeFrame(const std::string& filename) const {
+        std::ofstream file(filename, std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "No foi possvel criar o arquivo: " << filename << std::endl;
+            return false;
+        }
+        file << "P6\n" << width << ' ' << height << "\n255\n";
+        file.write(reinterpret_cast<const char*>(color.data()), color.size());
+        return file.good();
+    }
 
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(worldConfig.camera.projection.fov,
-        (float)worldConfig.window.width / (float)worldConfig.window.height,
-        worldConfig.camera.projection.near,
-        worldConfig.camera.projection.far);
+private:
+    static const int TILE_SIZE = 64;
+
+    struct ClipVertex {
+        float x, y, z, w;
+        float r, g, b;
+        float u, v;
+    };
+
+    // Depth, 1/w and then color and texture coordinates over w: the values interpolated across a triangle
+    static const int VALUES = 7;
+
+    struct ScreenVertex {
+        float x, y;
+        float values[VALUES];
+        float u, v;
+    };
+
+    // Edge functions a x + b y + c, positive inside, and a plane c + dx x + dy y per value
+    struct RasterTriangle {
+        float edges[3][3];
+        float planes[VALUES][3];
+        int minX, minY, maxX, maxY;
+        const SoftwareTexture* texture;
+        int level;
+    };
 
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-    gluLookAt(worldConfig.camera.position.x, worldConfig.camera.position.y, worldConfig.camera.position.z,
-        worldConfig.camera.lookAt.x, worldConfig.camera.lookAt.y, worldConfig.camera.lookAt.z,
-        worldConfig.camera.up.x, worldConfig.camera.up.y, worldConfig.camera.up.z);
+    int width;
+    int height;
+    int depthStride;
+    int tilesX;
+    int tilesY;
+    std::vector<unsigned char> color;
+    std::vector<float> depth;
+    std::vector<std::vector<uint32_t>> bins;
+    std::vector<RasterTriangle> triangles;
+    std::unordered_map<unsigned int, SoftwareTexture> textures;
+    std::unordered_map<const Mesh*, int> windings;
+    std::vector<SoftwareLight> lights;
+
+    // Winding of the outside of a closed mesh: 1 counter-clockwise, -1 clockwise, 0 when some edge
+    // is open or wound inconsistently, or when the pieces of a baked batch disagree. Only a closed
+    // mesh can lose its back faces without the picture changing; the generator's spheres are
+    // wound clockwise and patches are open, which is why the GL path draws models unculled.
+    static int outsideWinding(const Mesh& mesh) {
+        size_t corners = mesh.indices.empty() ? mesh.vertices.size() : mesh.indices.size();
+        if (corners < 3 || mesh.patches) return 0;
+
+        // Vertices split along texture seams are welded back by position
+        std::vector<uint32_t> order(mesh.vertices.size()), ids(mesh.vertices.size());
+        for (uint32_t i = 0; i < order.size(); ++i) order[i] = i;
+        auto less = [&mesh](uint32_t a, uint32_t b) {
+            const Point3D &p = mesh.vertices[a], &q = mesh.vertices[b];
+            return p.x < q.x || (p.x == q.x && (p.y < q.y || (p.y == q.y && p.z < q.z)));
+        };
+        std::sort(order.begin(), order.end(), less);
+        uint32_t unique = 0;
+        for (size_t i = 0; i < order.size(); ++i) {
+            if (i > 0 && less(order[i - 1], order[i])) ++unique;
+            ids[order[i]] = unique;
+        }
 
-    glEnable(GL_LIGHTING);
-    drawAxes();
+        std::vector<uint32_t> parent(unique + 1);
+        for (uint32_t i = 0; i < parent.size(); ++i) parent[i] = i;
+        auto root = [&parent](uint32_t i) {
+            while (parent[i] != i) i = parent[i] = parent[parent[i]];
+            return i;
+        };
+
+        std::unordered_map<uint64_t, int> edges;
+        for (size_t i = 0; i + 2 < corners; i += 3) {
+            uint32_t v[3];
+            for (int k = 0; k < 3; ++k) v[k] = ids[mesh.indices.empty() ? i + k : mesh.indices[i + k]];
+            if (v[0] == v[1] || v[1] == v[2] || v[2] == v[0]) continue;
+            for (int k = 0; k < 3; ++k) {
+                ++edges[uint64_t(v[k]) << 32 | v[(k + 1) % 3]];
+                parent[root(v[k])] = root(v[(k + 1) % 3]);
+            }
+        }
+        for (const auto& edge : edges) {
+            auto twin = edges.find(edge.first << 32 | edge.first >> 32);
+            if (twin == edges.end() || twin->second != edge.second) return 0;
+        }
 
-    for (const auto& group : worldConfig.groups) {
-        renderGroup(group);
+        // Signed volume of each connected piece
+        std::unordered_map<uint32_t, double> volumes;
+        for (size_t i = 0; i + 2 < corners; i += 3) {
+            const Point3D* p[3];
+            uint32_t v[3];
+            for (int k = 0; k < 3; ++k) {
+                uint32_t vertex = mesh.indices.empty() ? uint32_t(i + k) : mesh.indices[i + k];
+                p[k] = &mesh.vertices[vertex];
+                v[k] = ids[vertex];
+            }
+            if (v[0] == v[1] || v[1] == v[2] || v[2] == v[0]) continue;
+            volumes[root(v[0])] +=
+                double(p[0]->x) * (double(p[1]->y) * p[2]->z - double(p[1]->z) * p[2]->y)
+                + double(p[0]->y) * (double(p[1]->z) * p[2]->x - double(p[1]->x) * p[2]->z)
+                + double(p[0]->z) * (double(p[1]->x) * p[2]->y - double(p[1]->y) * p[2]->x);
+        }
+        int winding = 0;
+        for (const auto& volume : volumes) {
+            int sign = volume.second > 1e-12 ? 1 : volume.second < -1e-12 ? -1 : 0;
+            if (sign == 0 || (winding != 0 && sign != winding)) return 0;
+            winding = sign;
+        }
+        return winding;
     }
 
-    glutSwapBuffers();
-}
+    static ClipVertex toClip(const Mat4& matrix, const Point3D& p) {
+        const float* m = matrix.m;
+        return { m[0] * p.x + m[4] * p.y + m[8] * p.z + m[12], m[1] * p.x + m[5] * p.y + m[9] * p.z + m[13],
+            m[2] * p.x + m[6] * p.y + m[10] * p.z + m[14], m[3] * p.x + m[7] * p.y + m[11] * p.z + m[15],
+            0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    }
 
-void initializeVBO(Model& model) {
-    glGenBuffers(1, &model.vboId);
-    glBindBuffer(GL_ARRAY_BUFFER, model.vboId);
+    // Signed distance to one of the six clip planes, inside when not negative
+    static float planeDistance(const ClipVertex& v, int plane) {
+        const float coordinates[3] = { v.x, v.y, v.z };
+        return v.w + (plane & 1 ? -coordinates[plane / 2] : coordinates[plane / 2]);
+    }
 
-    size_t verticesSize = model.vertices.size() * sizeof(Point3D);
-    size_t normalsSize = model.normals.size() * sizeof(Vector3);
-    size_t texCoordsSize = model.texCoords.size() * sizeof(Vector2);
+    static ClipVertex lerp(const ClipVertex& a, const ClipVertex& b, float t) {
+        return { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t,
+            a.r + (b.r - a.r) * t, a.g + (b.g - a.g) * t, a.b + (b.b - a.b) * t, a.u + (b.u - a.u) * t, a.v + (b.v - a.v) * t };
+    }
 
-    glBufferData(GL_ARRAY_BUFFER, verticesSize + normalsSize + texCoordsSize, nullptr, GL_STATIC_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, verticesSize, &model.vertices[0]);
-    glBufferSubData(GL_ARRAY_BUFFER, verticesSize, normalsSize, &model.normals[0]);
-    glBufferSubData(GL_ARRAY_BUFFER, verticesSize + normalsSize, texCoordsSize, &model.texCoords[0]);
+    ScreenVertex toScreen(const ClipVertex& c) const {
+        float invW = 1.0f / c.w;
+        return { (c.x * invW * 0.5f + 0.5f) * width, (0.5f - c.y * invW * 0.5f) * height,
+            { c.z * invW * 0.5f + 0.5f, invW, c.r * invW, c.g * invW, c.b * invW, c.u * invW, c.v * invW }, c.u, c.v };
+    }
 
-    glGenVertexArrays(1, &model.vaoId);
-    glBindVertexArray(model.vaoId);
+    void setupObject(const SceneObject& object, const Mat4& projection, const Mat4& view, std::vector<ClipVertex>& vertices,
+        std::vector<RasterTriangle>& out) const {
+        const Model& model = *object.model;
+        const Mesh& mesh = *model.mesh;
+        size_t count = mesh.vertices.size();
+        if (mesh.normals.size() != count || mesh.texCoords.size() != count) return;
+
+        Mat4 modelView = multiply(view, object.world);
+        Mat4 matrix = multiply(projection, modelView);
+        float normals[9];
+        normalMatrix(modelView, normals);
+
+        vertices.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            const Point3D& p = mesh.vertices[i];
+            const Vector3& n = mesh.normals[i];
+            Point3D normal = { normals[0] * n.x + normals[3] * n.y + normals[6] * n.z,
+                normals[1] * n.x + normals[4] * n.y + normals[7] * n.z,
+                normals[2] * n.x + normals[5] * n.y + normals[8] * n.z };
+            Color lit = lightVertex(transformPoint(modelView, p), normalize(normal), model.material, lights);
+
+            ClipVertex& vertex = vertices[i];
+            vertex = toClip(matrix, p);
+            vertex.r = lit.r;
+            vertex.g = lit.g;
+            vertex.b = lit.b;
+            vertex.u = mesh.texCoords[i].u;
+            vertex.v = mesh.texCoords[i].v;
+        }
 
-    glBindBuffer(GL_ARRAY_BUFFER, model.vboId);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+        // Back faces of a closed mesh are hidden unless the eye is inside it; a mirroring
+        // transform turns the outside winding around on screen
+        int winding = windings.at(&mesh);
+        Point3D eye = transformPoint(affineInverse(modelView), { 0.0f, 0.0f, 0.0f });
+        const Bounds& bounds = mesh.bounds;
+        if (eye.x >= bounds.min.x && eye.y >= bounds.min.y && eye.z >= bounds.min.z
+            && eye.x <= bounds.max.x && eye.y <= bounds.max.y && eye.z <= bounds.max.z) {
+            winding = 0;
+        }
+        float cofactors[9];
+        if (cofactorMatrix(modelView, cofactors) < 0.0f) winding = -winding;
+
+        auto found = textures.find(model.textureId);
+        const SoftwareTexture* texture = found == textures.end() ? nullptr : &found->second;
+        size_t corners = mesh.indices.empty() ? count : mesh.indices.size();
+        for (size_t i = 0; i + 2 < corners; i += 3) {
+            ClipVertex triangle[3];
+            for (int k = 0; k < 3; ++k) triangle[k] = vertices[mesh.indices.empty() ? i + k : mesh.indices[i + k]];
+            clipTriangle(triangle, texture, winding, out);
+        }
+    }
 
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<void*>(verticesSize));
+    // Sutherland-Hodgman against the planes the triangle crosses, then a fan of the polygon left
+    void clipTriangle(const ClipVertex (&triangle)[3], const SoftwareTexture* texture, int winding,
+        std::vector<RasterTriangle>& out) const {
+        ClipVertex polygon[9], scratch[9];
+        std::copy(triangle, triangle + 3, polygon);
+        int count = 3;
+        for (int plane = 0; plane < 6 && count >= 3; ++plane) {
+            float distances[9];
+            bool crossed = false;
+            for (int k = 0; k < count; ++k) {
+                distances[k] = planeDistance(polygon[k], plane);
+                crossed |= distances[k] < 0.0f;
+            }
+            if (!crossed) continue;
+
+            int kept = 0;
+            for (int k = 0; k < count; ++k) {
+                int next = (k + 1) % count;
+                if (distances[k] >= 0.0f) scratch[kept++] = polygon[k];
+                if ((distances[k] >= 0.0f) != (distances[next] >= 0.0f)) {
+                    scratch[kept++] = lerp(polygon[k], polygon[next], distances[k] / (distances[k] - distances[next]));
+                }
+            }
+            std::copy(scratch, scratch + kept, polygon);
+            count = kept;
+        }
 
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<void*>(verticesSize + normalsSize));
+        for (int k = 1; k + 1 < count; ++k) {
+            ScreenVertex screen[3] = { toScreen(polygon[0]), toScreen(polygon[k]), toScreen(polygon[k + 1]) };
+            RasterTriangle raster;
+            if (setupTriangle(screen, texture, winding, raster)) out.push_back(raster);
+        }
+    }
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
-}
+    // A winding other than 0 culls the triangles not wound that way on screen
+    bool setupTriangle(const ScreenVertex (&v)[3], const SoftwareTexture* texture, int winding, RasterTriangle& t) const {
+        // Screen y points down, so counter-clockwise triangles have negative area here
+        float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+        if (!(std::fabs(area) > 1e-8f) || area * winding > 0.0f) return false;
+
+        t.minX = std::max(0, static_cast<int>(std::floor(std::min({ v[0].x, v[1].x, v[2].x }))));
+        t.minY = std::max(0, static_cast<int>(std::floor(std::min({ v[0].y, v[1].y, v[2].y }))));
+        t.maxX = std::min(width - 1, static_cast<int>(std::ceil(std::max({ v[0].x, v[1].x, v[2].x }))));
+        t.maxY = std::min(height - 1, static_cast<int>(std::ceil(std::max({ v[0].y, v[1].y, v[2].y }))));
+        if (t.minX > t.maxX || t.minY > t.maxY) return false;
+
+        // Neighbours evaluate a shared edge with exactly negated terms, so no pixel falls between them
+        float sign = area > 0.0f ? 1.0f : -1.0f;
+        for (int i = 0; i < 3; ++i) {
+            const ScreenVertex& a = v[i];
+            const ScreenVertex& b = v[(i + 1) % 3];
+            t.edges[i][0] = (a.y - b.y) * sign;
+            t.edges[i][1] = (b.x - a.x) * sign;
+            t.edges[i][2] = (a.x * b.y - b.x * a.y) * sign;
+        }
+        for (int k = 0; k < VALUES; ++k) {
+            float d1 = v[1].values[k] - v[0].values[k], d2 = v[2].values[k] - v[0].values[k];
+            float dx = (d1 * (v[2].y - v[0].y) - d2 * (v[1].y - v[0].y)) / area;
+            float dy = (d2 * (v[1].x - v[0].x) - d1 * (v[2].x - v[0].x)) / area;
+            t.planes[k][0] = v[0].values[k] - dx * v[0].x - dy * v[0].y;
+            t.planes[k][1] = dx;
+            t.planes[k][2] = dy;
+        }
 
-Model readModel(const std::string& filename) {
-    std::ifstream file(filename);
-    Model model;
-    if (!file.is_open()) {
-        std::cerr << "No foi possvel abrir o arquivo: " << filename << std::endl;
-        return model;
+        // The level whose texels come closest to one per pixel over the whole triangle
+        t.texture = texture;
+        t.level = 0;
+        if (texture) {
+            float texels = std::fabs((v[1].u - v[0].u) * (v[2].v - v[0].v) - (v[2].u - v[0].u) * (v[1].v - v[0].v))
+                * texture->width * texture->height;
+            float lod = 0.5f * std::log2(std::max(texels / std::fabs(area), 1e-8f));
+            t.level = std::min(std::max(static_cast<int>(std::floor(lod + 0.5f)), 0), texture->levels - 1);
+        }
+        return true;
     }
 
-    std::string line;
-    int totalPoints;
-    if (std::getline(file, line)) {
-        try {
-            totalPoints = std::stoi(line);
-        }
-        catch (const std::exception& e) {
-            std::cerr << "Erro ao converter o nmero total de pontos: " << e.what() << std::endl;
-            return model;
+    void rasterizeTile(size_t tile) {
+        int tileX = static_cast<int>(tile % tilesX) * TILE_SIZE, tileY = static_cast<int>(tile / tilesX) * TILE_SIZE;
+        int tileEndX = std::min(tileX + TILE_SIZE, width), tileEndY = std::min(tileY + TILE_SIZE, height);
+        const Float4 zero(0.0f), ramp = Float4::ramp();
+
+        for (uint32_t index : bins[tile]) {
+            const RasterTriangle& t = triangles[index];
+            int startX = std::max(t.minX, tileX) & ~3;
+            int endX = std::min(t.maxX + 1, tileEndX);
+            int endY = std::min(t.maxY + 1, tileEndY);
+            const Float4 limit(static_cast<float>(endX));
+
+            for (int y = std::max(t.minY, tileY); y < endY; ++y) {
+                float py = y + 0.5f;
+                const Float4 e0(t.edges[0][1] * py + t.edges[0][2]), e1(t.edges[1][1] * py + t.edges[1][2]),
+                    e2(t.edges[2][1] * py + t.edges[2][2]), zRow(t.planes[0][0] + t.planes[0][2] * py);
+                float* depthRow = &depth[size_t(y) * depthStride];
+
+                for (int x = startX; x < endX; x += 4) {
+                    Float4 px = ramp + Float4(x + 0.5f);
+                    Float4 inside = (Float4(t.edges[0][0]) * px + e0 >= zero) & (Float4(t.edges[1][0]) * px + e1 >= zero)
+                        & (Float4(t.edges[2][0]) * px + e2 >= zero) & (px < limit);
+                    int covered = inside.mask();
+                    if (!covered) continue;
+
+                    Float4 z = Float4(t.planes[0][1]) * px + zRow;
+                    covered &= (z < Float4::load(depthRow + x)).mask();
+                    if (!covered) continue;
+
+                    float depths[4];
+                    z.store(depths);
+                    for (int k = 0; k < 4; ++k) {
+                        if (!(covered & (1 << k))) continue;
+                        depthRow[x + k] = depths[k];
+                        shadePixel(t, x + k, y);
+                    }
+                }
+            }
         }
     }
 
-    char comma, semicolon;
-    while (std::getline(file, line)) {
-        std::istringstream iss(line);
-        Point3D vertex;
-        Vector3 normal;
-        Vector2 texCoord;
+    void shadePixel(const RasterTriangle& t, int x, int y) {
+        float px = x + 0.5f, py = y + 0.5f;
+        float values[VALUES];
+        for (int k = 1; k < VALUES; ++k) values[k] = t.planes[k][0] + t.planes[k][1] * px + t.planes[k][2] * py;
+        float w = 1.0f / values[1];
+        float rgb[3] = { values[2] * w, values[3] * w, values[4] * w };
+        if (t.texture) {
+            float texel[3];
+            sampleTexture(*t.texture, t.level, values[5] * w, values[6] * w, texel);
+            for (int c = 0; c < 3; ++c) rgb[c] *= texel[c];
+        }
 
-        if ((iss >> vertex.x >> comma >> vertex.y >> comma >> vertex.z >> semicolon
-            >> normal.x >> comma >> normal.y >> comma >> normal.z >> semicolon
-            >> texCoord.u >> comma >> texCoord.v) &&
-            comma == ',' && semicolon == ';') {
-            texCoord.v = 1.0f - texCoord.v;
-            model.vertices.push_back(vertex);
-            model.normals.push_back(normal);
-            model.texCoords.push_back(texCoord);
+        unsigned char* pixel = &color[(size_t(y) * width + x) * 3];
+        for (int c = 0; c < 3; ++c) {
+            pixel[c] = static_cast<unsigned char>(std::min(std::max(rgb[c], 0.0f), 1.0f) * 255.0f + 0.5f);
         }
-        else {
-            std::cerr << "Erro ao ler a linha do arquivo: " << line << std::endl;
+    }
+
+    // Bilinear with GL_REPEAT wrapping; textures with fewer than 3 channels read as gray
+    static void sampleTexture(const SoftwareTexture& texture, int level, float u, float v, float rgb[3]) {
+        int levelWidth = std::max(1, texture.width >> level), levelHeight = std::max(1, texture.height >> level);
+        const unsigned char* pixels = &texture.pixels[texture.offsets[level]];
+        float x = (u - std::floor(u)) * levelWidth - 0.5f, y = (v - std::floor(v)) * levelHeight - 0.5f;
+        float fx = std::floor(x), fy = std::floor(y);
+        float ax = x - fx, ay = y - fy;
+        int x0 = (static_cast<int>(fx) + levelWidth) % levelWidth, x1 = (x0 + 1) % levelWidth;
+        int y0 = (static_cast<int>(fy) + levelHeight) % levelHeight, y1 = (y0 + 1) % levelHeight;
+
+        for (int c = 0; c < 3; ++c) {
+            int channel = texture.channels >= 3 ? c : 0;
+            auto texel = [&](int tx, int ty) {
+                return pixels[(size_t(ty) * levelWidth + tx) * texture.channels + channel] / 255.0f;
+            };
+            float top = texel(x0, y0) + (texel(x1, y0) - texel(x0, y0)) * ax;
+            float bottom = texel(x0, y1) + (texel(x1, y1) - texel(x0, y1)) * ax;
+            rgb[c] = top + (bottom - top) * ay;
         }
     }
 
-    file.close();
-    if (model.vertices.size() != totalPoints) {
-        std::cerr << "Aviso: o nmero total de pontos lidos no corresponde ao indicador inicial." << std::endl;
+    // One pixel wide and unlit, depth-tested like the triangles; drawn before them, as display() does
+    void drawLine(const Mat4& matrix, const Point3D& from, const Point3D& to, const unsigned char rgb[3]) {
+        ClipVertex a = toClip(matrix, from), b = toClip(matrix, to);
+        float t0 = 0.0f, t1 = 1.0f;
+        for (int plane = 0; plane < 6; ++plane) {
+            float da = planeDistance(a, plane), db = planeDistance(b, plane);
+            if (da < 0.0f && db < 0.0f) return;
+            if (da < 0.0f) t0 = std::max(t0, da / (da - db));
+            if (db < 0.0f) t1 = std::min(t1, da / (da - db));
+        }
+        if (t0 > t1) return;
+
+        ScreenVertex start = toScreen(lerp(a, b, t0)), end = toScreen(lerp(a, b, t1));
+        float dx = end.x - start.x, dy = end.y - start.y, dz = end.values[0] - start.values[0];
+        int steps = std::max(1, static_cast<int>(std::ceil(std::max(std::fabs(dx), std::fabs(dy)))));
+        for (int i = 0; i <= steps; ++i) {
+            float t = static_cast<float>(i) / steps;
+            int x = static_cast<int>(std::floor(start.x + dx * t)), y = static_cast<int>(std::floor(start.y + dy * t));
+            if (x < 0 || y < 0 || x >= width || y >= height) continue;
+            float z = start.values[0] + dz * t;
+            float& stored = depth[size_t(y) * depthStride + x];
+            if (!(z < stored)) continue;
+            stored = z;
+            std::memcpy(&color[(size_t(y) * width + x) * 3], rgb, 3);
+        }
     }
+};
 
-    initializeVBO(model);
+// display() for the software renderer: same camera, scene update and frustum culling
+void renderSoftwareFrame(SoftwareRenderer& renderer) {
+    const Camera& camera = worldConfig.camera;
+    Mat4 projection = perspectiveMatrix(camera.projection.fov, (float)worldConfig.window.width / (float)worldConfig.window.height,
+        camera.projection.near, camera.projection.far);
+    Mat4 view = lookAtMatrix({ camera.position.x, camera.position.y, camera.position.z },
+        { camera.lookAt.x, camera.lookAt.y, camera.lookAt.z }, { camera.up.x, camera.up.y, camera.up.z });
+
+    updateScene();
+    std::vector<size_t> visible;
+    if (useCulling) {
+        sceneBVH.queryFrustum(frustumFromMatrix(multiply(projection, view)), visible, getJobSystem());
+    }
+    else {
+        for (size_t i = 0; i < sceneObjects.size(); ++i) visible.push_back(i);
+    }
+    renderer.draw(projection, view, visible);
+}
 
-    return model;
+// frame.ppm becomes frame_0000.ppm, frame_0001.ppm... when more than one frame is written
+std::string frameFileName(const std::string& output, int frame, int frames) {
+    if (frames == 1) return output;
+    size_t dot = output.find_last_of('.');
+    size_t slash = output.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = output.size();
+    std::ostringstream name;
+    name << output.substr(0, dot) << '_' << std::setw(4) << std::setfill('0') << frame << output.substr(dot);
+    return name.str();
 }
 
-const std::string basePath = "C:/Users/GIGABYTE/Desktop/teste/teste2/src/src/generator/build/Release/";
+// Batch rendering with no window or GL context: loads the scene as --bake does, with patches
+// tessellated on the CPU, then draws frames at targetFrameRate intervals of scene time.
+bool renderSceneSoftware(const std::string& scene, const std::string& output, int frames) {
+    if (isSceneSnapshot(scene)) {
+        std::cerr << "Snapshots no podem ser renderizados sem GPU: " << scene << std::endl;
+        return false;
+    }
+    useTessellation = false;
+    if (!parseSceneFile(scene)) return false;
+    World& world = worldConfig;
+    readSceneResources(world);
+
+    // Stand-in ids, as while streaming: they tell the textures apart for baking and drawing
+    SoftwareRenderer renderer(world.window.width, world.window.height);
+    unsigned int next = 0;
+    for (auto& entry : world.textures) {
+        if (!entry.second.pixels) continue;
+        entry.second.id = ++next;
+        renderer.addTexture(entry.second.id, entry.second);
+        stbi_image_free(entry.second.pixels);
+        entry.second.pixels = nullptr;
+    }
+    std::vector<Mesh*> batches;
+    size_t baked = prepareGroups(world, batches);
+    if (baked > 0) {
+        std::cout << "Baked " << baked << " static models into batched meshes" << std::endl;
+    }
 
-void parseTransform(tinyxml2::XMLElement* element, Transform& transform) {
+    double drawing = 0.0;
+    size_t triangles = 0;
+    float frameRate = targetFrameRate > 0 ? static_cast<float>(targetFrameRate) : 60.0f;
+    for (int frame = 0; frame < frames; ++frame) {
+        auto start = std::chrono::steady_clock::now();
+        frameTime = frame / frameRate;
+        renderSoftwareFrame(renderer);
+        drawing += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        triangles += renderer.triangleCount();
+        if (!renderer.writeFrame(frameFileName(output, frame, frames))) return false;
+    }
+
+    std::cout << "Rendered " << frames << " frames of " << world.window.width << "x" << world.window.height << " in "
+        << drawing << " ms (" << drawing / frames << " ms and " << triangles / frames << " triangles per frame) using "
+        << getJobSystem().workerCount() << " threads" << std::endl;
+    return true;
+}
 
-    for (tinyxml2::XMLElement* child = element->FirstChildElement(); child; child = child->NextSiblingElement()) {
-        std::string type = child->Value();
 
-        if (type == "translate") {
-            transform.translate.active = true;
-            transform.translate.time = child->FloatAttribute("time", 0);
-            transform.translate.align = child->BoolAttribute("align", false);
+// Reports which of the scene's files changed on disk. Linux watches their directories with
+// inotify, which also sees editors that save by writing a new file and renaming it over the old
+// one; other platforms poll modification times.
+class FileWatcher {
+public:
+    FileWatcher() = default;
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
 
-            if (child->NoChildren()) {
-                Point3D p{
-                    child->FloatAttribute("x", 0.0f),
-                    child->FloatAttribute("y", 0.0f),
-                    child->FloatAttribute("z", 0.0f)
-                };
-                transform.translate.controlPoints.push_back(p);
+    ~FileWatcher() {
+#ifdef __linux__
+        if (fd >= 0) close(fd);
+#endif
+    }
+
+    void watch(const std::vector<std::string>& paths) {
+        files.clear();
+        for (const std::string& path : paths) {
+            files[canonical(path)] = path;
+        }
+#ifdef __linux__
+        if (fd < 0) fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0) return;
+        std::unordered_set<std::string> needed;
+        for (const auto& file : files) needed.insert(directoryOf(file.second));
+        for (auto it = directories.begin(); it != directories.end();) {
+            if (needed.count(it->second)) {
+                ++it;
+                continue;
             }
-            else {
+            inotify_rm_watch(fd, it->first);
+            watchedDirectories.erase(it->second);
+            it = directories.erase(it);
+        }
+        for (const std::string& directory : needed) {
+            if (watchedDirectories.count(directory)) continue;
+            int wd = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+            if (wd < 0) continue;
+            directories[wd] = directory;
+            watchedDirectories.insert(directory);
+        }
+#else
+        for (auto it = times.begin(); it != times.end();) {
+            if (files.count(canonical(it->first))) ++it;
+            else it = times.erase(it);
+        }
+        for (const auto& file : files) {
+            if (!times.count(file.second)) times[file.second] = modified(file.second);
+        }
+#endif
+    }
 
-                for (tinyxml2::XMLElement* point = child->FirstChildElement("point"); point; point = point->NextSiblingElement("point")) {
-                    Point3D p{
-                        point->FloatAttribute("x"),
-                        point->FloatAttribute("y"),
-                        point->FloatAttribute("z")
-                    };
-                    transform.translate.controlPoints.push_back(p);
+    // Files changed since the last call, each once; never blocks
+    std::vector<std::string> poll() {
+        std::unordered_set<std::string> changed;
+#ifdef __linux__
+        if (fd < 0) return {};
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+            for (char* cursor = buffer; cursor < buffer + length;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(cursor);
+                auto directory = directories.find(event->wd);
+                if (event->len > 0 && directory != directories.end()) {
+                    auto file = files.find(directory->second + "/" + event->name);
+                    if (file != files.end()) changed.insert(file->second);
                 }
+                cursor += sizeof(inotify_event) + event->len;
             }
         }
-
-        else if (type == "rotate") {
-            transform.rotate.active = true;
-            transform.rotate.time = child->FloatAttribute("time", 0.0f);
-            transform.rotate.angle = child->FloatAttribute("angle", 0.0f);
-            transform.rotate.axis.x = child->FloatAttribute("x", 0.0f);
-            transform.rotate.axis.y = child->FloatAttribute("y", 0.0f);
-            transform.rotate.axis.z = child->FloatAttribute("z", 0.0f);
-        }
-        else if (type == "scale") {
-            transform.scale.x = child->FloatAttribute("x", 1.0f);
-            transform.scale.y = child->FloatAttribute("y", 1.0f);
-            transform.scale.z = child->FloatAttribute("z", 1.0f);
-            transform.hasScale = true;
+#else
+        for (auto& entry : times) {
+            if (!files.count(canonical(entry.first))) continue;
+            std::filesystem::file_time_type time = modified(entry.first);
+            if (time != entry.second) {
+                entry.second = time;
+                changed.insert(entry.first);
+            }
         }
+#endif
+        return std::vector<std::string>(changed.begin(), changed.end());
     }
-}
 
-void parseColor(tinyxml2::XMLElement* colorElement, Model& model) {
-    if (!colorElement) return;
+private:
+    // Watched files by directory + "/" + name, the form events are reported in
+    std::unordered_map<std::string, std::string> files;
+#ifdef __linux__
+    int fd = -1;
+    std::unordered_map<int, std::string> directories;
+    std::unordered_set<std::string> watchedDirectories;
+#else
+    std::unordered_map<std::string, std::filesystem::file_time_type> times;
 
-    tinyxml2::XMLElement* diffuseElement = colorElement->FirstChildElement("diffuse");
-    if (diffuseElement) {
-        model.material.diffuse.r = diffuseElement->IntAttribute("R") / 255.0f;
-        model.material.diffuse.g = diffuseElement->IntAttribute("G") / 255.0f;
-        model.material.diffuse.b = diffuseElement->IntAttribute("B") / 255.0f;
-        std::cout << "Diffuse: " << model.material.diffuse.r << ", " << model.material.diffuse.g << ", " << model.material.diffuse.b << std::endl;
+    static std::filesystem::file_time_type modified(const std::string& path) {
+        std::error_code error;
+        return std::filesystem::last_write_time(path, error);
     }
+#endif
 
-    tinyxml2::XMLElement* ambientElement = colorElement->FirstChildElement("ambient");
-    if (ambientElement) {
-        model.material.ambient.r = ambientElement->IntAttribute("R") / 255.0f;
-        model.material.ambient.g = ambientElement->IntAttribute("G") / 255.0f;
-        model.material.ambient.b = ambientElement->IntAttribute("B") / 255.0f;
-        std::cout << "Ambient: " << model.material.ambient.r << ", " << model.material.ambient.g << ", " << model.material.ambient.b << std::endl;
+    static std::string directoryOf(const std::string& path) {
+        size_t slash = path.find_last_of("/\\");
+        if (slash == std::string::npos) return ".";
+        return slash == 0 ? "/" : path.substr(0, slash);
     }
 
-    tinyxml2::XMLElement* specularElement = colorElement->FirstChildElement("specular");
-    if (specularElement) {
-        model.material.specular.r = specularElement->IntAttribute("R") / 255.0f;
-        model.material.specular.g = specularElement->IntAttribute("G") / 255.0f;
-        model.material.specular.b = specularElement->IntAttribute("B") / 255.0f;
-        std::cout << "Specular: " << model.material.specular.r << ", " << model.material.specular.g << ", " << model.material.specular.b << std::endl;
+    static std::string canonical(const std::string& path) {
+        size_t slash = path.find_last_of("/\\");
+        return directoryOf(path) + "/" + path.substr(slash == std::string::npos ? 0 : slash + 1);
     }
+};
 
-    tinyxml2::XMLElement* emissiveElement = colorElement->FirstChildElement("emissive");
-    if (emissiveElement) {
-        model.material.emissive.r = emissiveElement->IntAttribute("R") / 255.0f;
-        model.material.emissive.g = emissiveElement->IntAttribute("G") / 255.0f;
-        model.material.emissive.b = emissiveElement->IntAttribute("B") / 255.0f;
-        std::cout << "Emissive: " << model.material.emissive.r << ", " << model.material.emissive.g << ", " << model.material.emissive.b << std::endl;
-    }
+bool useHotReload = true;
+std::string sceneFilePath;
+FileWatcher sceneWatcher;
 
-    tinyxml2::XMLElement* shininessElement = colorElement->FirstChildElement("shininess");
-    if (shininessElement) {
-        model.material.shininess = shininessElement->FloatAttribute("value");
-        std::cout << "Shininess: " << model.material.shininess << std::endl;
+void watchSceneFiles() {
+    std::vector<std::string> paths = { sceneFilePath };
+    for (const auto& entry : worldConfig.meshes) {
+        std::string file = meshSourceFile(entry.first);
+        if (!file.empty()) paths.push_back(file);
     }
+    for (const auto& entry : worldConfig.textures) paths.push_back(entry.first);
+    sceneWatcher.watch(paths);
 }
 
-void parseLights(tinyxml2::XMLElement* lightsElement, World& world) {
-    if (!lightsElement) {
-        std::cerr << "Lights element not found." << std::endl;
-        return;
+// Drops a mesh's GPU copy so loadSceneResources reads and uploads its file again. Ranges it had
+// in the geometry pool go back to the pool's free lists.
+void unloadMesh(Mesh& mesh) {
+    if (mesh.pooled) {
+        GeometryPool& pool = geometryPool;
+        releaseRange(pool.freeVertices, pool.vertexCount, mesh.firstVertex, mesh.vertexCount);
+        if (mesh.iboId) releaseRange(pool.freeIndices, pool.indexCount, mesh.firstIndex, mesh.indexCount);
     }
-    for (tinyxml2::XMLElement* lightElement = lightsElement->FirstChildElement("light"); lightElement; lightElement = lightElement->NextSiblingElement("light")) {
-        Light light;
-        light.type = lightElement->Attribute("type");
-
-        if (light.type == "point") {
-            light.position.x = lightElement->FloatAttribute("posx", 0.0f);
-            light.position.y = lightElement->FloatAttribute("posy", 0.0f);
-            light.position.z = lightElement->FloatAttribute("posz", 0.0f);
-        }
-        else if (light.type == "directional") {
-            light.direction.x = lightElement->FloatAttribute("dirx", 0.0f);
-            light.direction.y = lightElement->FloatAttribute("diry", 0.0f);
-            light.direction.z = lightElement->FloatAttribute("dirz", 0.0f);
-        }
-        else if (light.type == "spot") {
-            light.position.x = lightElement->FloatAttribute("posx", 0.0f);
-            light.position.y = lightElement->FloatAttribute("posy", 0.0f);
-            light.position.z = lightElement->FloatAttribute("posz", 0.0f);
-            light.direction.x = lightElement->FloatAttribute("dirx", 0.0f);
-            light.direction.y = lightElement->FloatAttribute("diry", 0.0f);
-            light.direction.z = lightElement->FloatAttribute("dirz", 0.0f);
-            light.cutoff = lightElement->FloatAttribute("cutoff", 180.0f);
-        }
-
-        light.ambient.r = lightElement->FloatAttribute("ambientR", 0.2f);
-        light.ambient.g = lightElement->FloatAttribute("ambientG", 0.2f);
-        light.ambient.b = lightElement->FloatAttribute("ambientB", 0.2f);
-        light.diffuse.r = lightElement->FloatAttribute("diffuseR", 0.8f);
-        light.diffuse.g = lightElement->FloatAttribute("diffuseG", 0.8f);
-        light.diffuse.b = lightElement->FloatAttribute("diffuseB", 0.8f);
-        light.specular.r = lightElement->FloatAttribute("specularR", 1.0f);
-        light.specular.g = lightElement->FloatAttribute("specularG", 1.0f);
-        light.specular.b = lightElement->FloatAttribute("specularB", 1.0f);
-
-        world.lights.push_back(light);
+    else {
+        if (mesh.vboId) glDeleteBuffers(1, &mesh.vboId);
+        if (mesh.iboId) glDeleteBuffers(1, &mesh.iboId);
+        if (mesh.vaoId) glDeleteVertexArrays(1, &mesh.vaoId);
     }
+    mesh = Mesh();
 }
 
-
-void parseCamera(tinyxml2::XMLElement* cameraElement, Camera& camera) {
-    if (!cameraElement) return;
-
-    tinyxml2::XMLElement* posElement = cameraElement->FirstChildElement("position");
-    if (posElement) {
-        camera.position.x = posElement->FloatAttribute("x");
-        camera.position.y = posElement->FloatAttribute("y");
-        camera.position.z = posElement->FloatAttribute("z");
-
-        radius = sqrt(camera.position.x * camera.position.x + camera.position.y * camera.position.y + camera.position.z * camera.position.z);
-        alfa = atan2(camera.position.z, camera.position.x);
-        beta = asin(camera.position.y / radius);
+// Sets GL's lights up for worldConfig after it was replaced. initializeLighting only sets what
+// each light type uses, so the lights the previous scene had go back to GL's defaults first.
+// Positions are taken in eye space, as on the first load.
+void applySceneLights(size_t previousLights) {
+    const GLfloat position[] = { 0.0f, 0.0f, 1.0f, 0.0f };
+    const GLfloat direction[] = { 0.0f, 0.0f, -1.0f };
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    for (size_t i = 0; i < previousLights && i < 8; ++i) {
+        GLenum light = GL_LIGHT0 + static_cast<GLenum>(i);
+        glState.disable(light);
+        glLightfv(light, GL_POSITION, position);
+        glLightfv(light, GL_SPOT_DIRECTION, direction);
+        glLightf(light, GL_SPOT_CUTOFF, 180.0f);
     }
+    initializeLighting();
+    glPopMatrix();
+}
 
-    tinyxml2::XMLElement* lookAtElement = cameraElement->FirstChildElement("lookAt");
-    if (lookAtElement) {
-        camera.lookAt.x = lookAtElement->FloatAttribute("x");
-        camera.lookAt.y = lookAtElement->FloatAttribute("y");
-        camera.lookAt.z = lookAtElement->FloatAttribute("z");
+// Drops the meshes and textures no model of a freshly parsed world names, along with their GPU
+// copies. Groups kept from the live world name the same files, since they parsed identically.
+void pruneUnusedResources(World& world) {
+    std::unordered_set<const Mesh*> meshes;
+    std::unordered_set<std::string> textures;
+    std::function<void(const Group&)> visit = [&](const Group& group) {
+        for (const Model& model : group.models) {
+            meshes.insert(model.mesh.get());
+            if (!model.textureFile.empty()) textures.insert(model.textureFile);
+        }
+        for (const Group& child : group.children) visit(child);
+    };
+    for (const Group& group : world.groups) visit(group);
+
+    for (auto it = world.meshes.begin(); it != world.meshes.end();) {
+        if (meshes.count(it->second.get())) {
+            ++it;
+            continue;
+        }
+        unloadMesh(*it->second);
+        it = world.meshes.erase(it);
     }
-
-    tinyxml2::XMLElement* upElement = cameraElement->FirstChildElement("up");
-    if (upElement) {
-        camera.up.x = upElement->FloatAttribute("x");
-        camera.up.y = upElement->FloatAttribute("y");
-        camera.up.z = upElement->FloatAttribute("z");
+    for (auto it = world.textures.begin(); it != world.textures.end();) {
+        if (textures.count(it->first)) {
+            ++it;
+            continue;
+        }
+        if (it->second.id) glDeleteTextures(1, &it->second.id);
+        if (it->second.pixels && !it->second.mapped) stbi_image_free(it->second.pixels);
+        it = world.textures.erase(it);
     }
+}
 
-    tinyxml2::XMLElement* projElement = cameraElement->FirstChildElement("projection");
-    if (projElement) {
-        camera.projection.fov = projElement->FloatAttribute("fov");
-        camera.projection.near = projElement->FloatAttribute("near");
-        camera.projection.far = projElement->FloatAttribute("far");
+// Applies changes to the scene's files without a restart. Changed meshes and textures are loaded
+// again in place, so every model sharing them follows. A changed XML is parsed again and its
+// top-level groups matched to the live ones by content hash: unchanged groups are kept as they
+// are, with their GPU resources and static batches, and only new or edited ones get loaded.
+// Baked groups hold merged copies of their meshes, so they are rebuilt when one of those changes.
+void reloadScene(const std::vector<std::string>& changed) {
+    auto start = std::chrono::steady_clock::now();
+    std::unordered_set<std::string> changedFiles(changed.begin(), changed.end());
+    bool parse = changedFiles.count(sceneFilePath) > 0;
+
+    size_t meshes = 0, textures = 0;
+    for (auto& entry : worldConfig.meshes) {
+        if (!changedFiles.count(meshSourceFile(entry.first))) continue;
+        unloadMesh(*entry.second);
+        ++meshes;
+    }
+    for (auto& entry : worldConfig.textures) {
+        if (!changedFiles.count(entry.first)) continue;
+        if (entry.second.id) glDeleteTextures(1, &entry.second.id);
+        entry.second = Texture();
+        ++textures;
     }
-}
 
-void parseModels(tinyxml2::XMLElement* modelsElement, Group& group) {
-    if (!modelsElement) return;
+    std::vector<bool> stale(worldConfig.groups.size(), false);
+    for (size_t i = 0; i < worldConfig.groupSources.size(); ++i) {
+        const GroupSource& source = worldConfig.groupSources[i];
+        if (!source.baked) continue;
+        stale[i] = std::any_of(source.files.begin(), source.files.end(),
+            [&](const std::string& file) { return changedFiles.count(file) > 0; });
+        parse = parse || stale[i];
+    }
 
-    for (tinyxml2::XMLElement* modelElement = modelsElement->FirstChildElement("model");
-        modelElement != nullptr;
-        modelElement = modelElement->NextSiblingElement("model")) {
+    size_t kept = 0;
+    World world;
+    world.meshes = worldConfig.meshes;
+    world.textures = worldConfig.textures;
+    if (parse && SceneLoader(world).load(sceneFilePath)) {
+        pruneUnusedResources(world);
 
-        std::string modelFile = modelElement->Attribute("file");
-        if (!modelFile.empty()) {
-            Model model = readModel(basePath + modelFile);
-            tinyxml2::XMLElement* colorElement = modelElement->FirstChildElement("color");
-            parseColor(colorElement, model);
+        std::unordered_multimap<uint64_t, size_t> live;
+        for (size_t i = 0; i < worldConfig.groups.size(); ++i) {
+            if (!stale[i]) live.emplace(worldConfig.groupSources[i].hash, i);
+        }
+        std::vector<bool> moved(worldConfig.groups.size(), false);
+        for (size_t i = 0; i < world.groups.size(); ++i) {
+            auto match = live.find(world.groupSources[i].hash);
+            if (match == live.end()) continue;
+            world.groups[i] = std::move(worldConfig.groups[match->second]);
+            world.groupSources[i] = std::move(worldConfig.groupSources[match->second]);
+            moved[match->second] = true;
+            live.erase(match);
+            ++kept;
+        }
 
-            tinyxml2::XMLElement* textureElement = modelElement->FirstChildElement("texture");
-            if (textureElement) {
-                const char* textureFile = textureElement->Attribute("file");
-                if (textureFile) {
-                    std::string texturePath = basePath + textureFile;
-                    model.textureId = loadTexture(texturePath);
+        // Static batches belong to their group alone, so the dropped groups' go with them
+        std::unordered_set<const Mesh*> fileMeshes;
+        for (const auto& entry : worldConfig.meshes) fileMeshes.insert(entry.second.get());
+        for (size_t i = 0; i < worldConfig.groups.size(); ++i) {
+            if (moved[i]) continue;
+            std::function<void(Group&)> unloadBatches = [&](Group& group) {
+                for (Model& model : group.models) {
+                    if (model.mesh && !fileMeshes.count(model.mesh.get())) unloadMesh(*model.mesh);
                 }
-            }
+                for (Group& child : group.children) unloadBatches(child);
+            };
+            unloadBatches(worldConfig.groups[i]);
+        }
 
-            group.models.push_back(model);
+        // Keep the user's view unless the XML camera itself was edited
+        Camera fileCamera = world.camera;
+        if (std::memcmp(&fileCamera, &parsedCamera, sizeof(Camera)) == 0) {
+            world.camera = worldConfig.camera;
         }
+        else {
+            applyCameraOrbit(world.orbit);
+        }
+        parsedCamera = fileCamera;
+        world.window = worldConfig.window;
+
+        size_t groups = world.groups.size();
+        size_t previousLights = worldConfig.lights.size();
+        worldConfig = std::move(world);
+        applySceneLights(previousLights);
+        std::cout << "Reloaded " << sceneFilePath << ": kept " << kept << " of " << groups << " groups" << std::endl;
     }
+
+    loadSceneResources(worldConfig);
+    glState.invalidate();
+    pendingQueries.clear();
+    updateScene();
+
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Hot reload: " << meshes << " meshes and " << textures << " textures changed, applied in "
+        << elapsed << " ms" << std::endl;
 }
 
-void parseGroup(tinyxml2::XMLElement* element, Group& group) {
-    tinyxml2::XMLElement* transformElement = element->FirstChildElement("transform");
-    if (transformElement) {
-        parseTransform(transformElement, group.transform);
+void pollSceneFiles(int) {
+    std::vector<std::string> changed = sceneWatcher.poll();
+    if (!changed.empty()) {
+        reloadScene(changed);
+        watchSceneFiles();
     }
+    glutTimerFunc(250, pollSceneFiles, 0);
+}
 
-    tinyxml2::XMLElement* modelsElement = element->FirstChildElement("models");
-    if (modelsElement) {
-        parseModels(modelsElement, group);
+// Loads another scene while the current one keeps drawing. A thread parses the file, reads its
+// meshes and textures one at a time, builds the textures' mip chains and bakes it; it stays off
+// the job system, whose wait() the frames use. The GL thread then uploads the results a slice
+// per frame, textures a band of rows at a time, and swaps the finished world in whole, so until
+// then the old scene is drawn untouched.
+class SceneStreamer {
+public:
+    SceneStreamer() = default;
+    SceneStreamer(const SceneStreamer&) = delete;
+    SceneStreamer& operator=(const SceneStreamer&) = delete;
+
+    ~SceneStreamer() {
+        cancelled = true;
+        if (thread.joinable()) thread.join();
     }
 
-    for (tinyxml2::XMLElement* childElement = element->FirstChildElement("group");
-        childElement != nullptr;
-        childElement = childElement->NextSiblingElement("group")) {
-        Group childGroup;
-        parseGroup(childElement, childGroup);
-        group.children.push_back(childGroup);
+    bool active() const {
+        return state != IDLE;
     }
-}
 
-void parseXML(const std::string& filename) {
-    tinyxml2::XMLDocument doc;
-    tinyxml2::XMLError result = doc.LoadFile(filename.c_str());
-    if (result != tinyxml2::XML_SUCCESS) {
-        std::cerr << "Erro ao abrir o arquivo XML: " << filename << std::endl;
-        return;
+    void start(const std::string& filename) {
+        if (active()) return;
+        this->filename = filename;
+        world = std::make_unique<World>();
+        meshes.clear();
+        textures.clear();
+        mipChains.clear();
+        nextMesh = nextTexture = 0;
+        frames = 0;
+        failed = false;
+        prepared = false;
+        state = READING;
+        started = std::chrono::steady_clock::now();
+        thread = std::thread([this]() {
+            failed = !prepare();
+            prepared = true;
+        });
     }
 
-    tinyxml2::XMLElement* root = doc.FirstChildElement("world");
-    if (!root) {
-        std::cerr << "Tag <world> no encontrada." << std::endl;
-        return;
+    // Uploads for about budgetMs, but at least one resource so larger ones still get through.
+    // True once the new world has replaced worldConfig.
+    bool step(double budgetMs) {
+        if (state == READING) {
+            if (!prepared) return false;
+            thread.join();
+            if (failed) {
+                world.reset();
+                state = IDLE;
+                return false;
+            }
+            state = UPLOADING;
+        }
+        if (state != UPLOADING) return false;
+
+        ++frames;
+        auto sliceStart = std::chrono::steady_clock::now();
+        do {
+            if (nextMesh < meshes.size()) {
+                uploadMesh(*meshes[nextMesh++]);
+            }
+            else if (nextTexture < textures.size()) {
+                uploadTextureBand();
+            }
+            else {
+                swapIn();
+                return true;
+            }
+        } while (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sliceStart).count() < budgetMs);
+        return false;
+    }
+
+private:
+    enum State { IDLE, READING, UPLOADING };
+
+    State state = IDLE;
+    std::string filename;
+    std::unique_ptr<World> world;
+    std::vector<Mesh*> meshes;
+    std::vector<std::pair<const std::string*, Texture*>> textures;
+    std::vector<std::vector<unsigned char>> mipChains;
+    size_t nextMesh = 0;
+    size_t nextTexture = 0;
+    // Progress through textures[nextTexture]: its GL name, mip level and first row not sent yet
+    GLuint textureId = 0;
+    int level = 0;
+    int row = 0;
+    size_t levelOffset = 0;
+    size_t baked = 0;
+    int frames = 0;
+    std::chrono::steady_clock::time_point started;
+    std::thread thread;
+    std::atomic<bool> prepared{ false };
+    std::atomic<bool> cancelled{ false };
+    bool failed = false;
+
+    // Runs on the loading thread; touches nothing but world
+    bool prepare() {
+        if (!SceneLoader(*world).load(filename)) return false;
+        for (auto& entry : world->meshes) {
+            if (cancelled) return false;
+            loadMesh(entry.first, *entry.second);
+            meshes.push_back(entry.second.get());
+        }
+        for (auto& entry : world->textures) {
+            if (cancelled) return false;
+            Texture& texture = entry.second;
+            mipChains.emplace_back();
+            if (decodeTexture(entry.first, texture)) {
+                mipChains.back() = buildMipChain(texture, texture.levels);
+                stbi_image_free(texture.pixels);
+                texture.pixels = mipChains.back().data();
+                texture.mapped = true;
+            }
+            textures.push_back(std::make_pair(&entry.first, &texture));
+        }
+
+        // Stand-in ids keep differently textured models apart while baking; resolveTextures
+        // puts the GL ones in after the upload
+        GLuint next = 0;
+        for (auto& entry : world->textures) entry.second.id = ++next;
+        baked = prepareGroups(*world, meshes);
+        for (auto& entry : world->textures) entry.second.id = 0;
+        return true;
     }
 
-    tinyxml2::XMLElement* windowElement = root->FirstChildElement("window");
-    if (windowElement) {
-        worldConfig.window.width = windowElement->IntAttribute("width");
-        worldConfig.window.height = windowElement->IntAttribute("height");
+    void uploadTextureBand() {
+        static const size_t BAND_BYTES = 256 * 1024;
+        Texture& texture = *textures[nextTexture].second;
+        if (!texture.pixels) {
+            ++nextTexture;
+            return;
+        }
+
+        GLenum format = texture.channels == 4 ? GL_RGBA : GL_RGB;
+        if (!textureId) {
+            glGenTextures(1, &textureId);
+            glState.bindTexture(textureId);
+            for (int i = 0; i < texture.levels; ++i) {
+                glTexImage2D(GL_TEXTURE_2D, i, format, std::max(1, texture.width >> i), std::max(1, texture.height >> i), 0,
+                    format, GL_UNSIGNED_BYTE, nullptr);
+            }
+            level = row = 0;
+            levelOffset = 0;
+        }
+        glState.bindTexture(textureId);
+
+        int width = std::max(1, texture.width >> level), height = std::max(1, texture.height >> level);
+        size_t rowBytes = size_t(width) * texture.channels;
+        int rows = std::min(height - row, static_cast<int>(std::max<size_t>(1, BAND_BYTES / rowBytes)));
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, row, width, rows, format, GL_UNSIGNED_BYTE,
+            texture.pixels + levelOffset + row * rowBytes);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glState.bindTexture(0);
+
+        row += rows;
+        if (row < height) return;
+        row = 0;
+        levelOffset += rowBytes * height;
+        if (++level < texture.levels) return;
+
+        texture.id = textureId;
+        texture.pixels = nullptr;
+        textureId = 0;
+        std::vector<unsigned char>().swap(mipChains[nextTexture]);
+        std::cout << "Texture loaded successfully: " << *textures[nextTexture].first << " (ID=" << texture.id << ")" << std::endl;
+        ++nextTexture;
     }
 
-    tinyxml2::XMLElement* lightsElement = root->FirstChildElement("lights");
-    if (lightsElement) {
-        parseLights(lightsElement, worldConfig);
+    void swapIn() {
+        for (Group& group : world->groups) resolveTextures(group, *world);
+        for (Mesh* mesh : collectMeshes(*world)) releaseCpuGeometry(*mesh);
+
+        world->window = worldConfig.window;
+        World old = std::move(worldConfig);
+        worldConfig = std::move(*world);
+        world.reset();
+        state = IDLE;
+
+        parsedCamera = worldConfig.camera;
+        applyCameraOrbit(worldConfig.orbit);
+        applySceneLights(old.lights.size());
+        for (Mesh* mesh : collectMeshes(old)) unloadMesh(*mesh);
+        for (auto& entry : old.textures) {
+            if (entry.second.id) glDeleteTextures(1, &entry.second.id);
+        }
+        glState.invalidate();
+        pendingQueries.clear();
+        sceneAnimated = std::any_of(worldConfig.groups.begin(), worldConfig.groups.end(), isAnimated);
+        updateScene();
+
+        sceneFilePath = filename;
+        if (useHotReload) watchSceneFiles();
+
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+        std::cout << "Streamed " << filename << ": " << meshes.size() << " meshes and " << textures.size()
+            << " textures in " << elapsed << " ms, uploaded over " << frames << " frames" << std::endl;
+        if (baked > 0) {
+            std::cout << "Baked " << baked << " static models into batched meshes" << std::endl;
+        }
+        reportMemory(worldConfig, false);
     }
+};
 
-    tinyxml2::XMLElement* cameraElement = root->FirstChildElement("camera");
-    if (cameraElement) {
-        parseCamera(cameraElement, worldConfig.camera);
+std::vector<std::string> sceneFiles;
+size_t currentScene = 0;
+SceneStreamer sceneStreamer;
+// Upload time allowed per frame while streaming; 0 takes a quarter of the targetFrameRate slot
+double uploadBudgetMs = 0.0;
+
+void stepSceneStream(int) {
+    if (!sceneStreamer.active()) return;
+    double budget = uploadBudgetMs;
+    if (budget <= 0.0) budget = targetFrameRate > 0 ? 250.0 / targetFrameRate : 4.0;
+    if (sceneStreamer.step(budget)) requestRedraw();
+    if (sceneStreamer.active()) {
+        glutTimerFunc(targetFrameRate > 0 ? 1000 / targetFrameRate : 1, stepSceneStream, 0);
     }
+}
 
-    tinyxml2::XMLElement* groupElement = root->FirstChildElement("group");
-    while (groupElement) {
-        Group group;
-        parseGroup(groupElement, group);
-        worldConfig.groups.push_back(group);
-        groupElement = groupElement->NextSiblingElement("group");
+void streamScene(const std::string& filename) {
+    if (isSceneSnapshot(filename)) {
+        std::cerr << "Snapshots no podem ser carregados em segundo plano: " << filename << std::endl;
+        return;
     }
+    std::cout << "Streaming " << filename << std::endl;
+    sceneStreamer.start(filename);
+    glutTimerFunc(0, stepSceneStream, 0);
 }
 
 void processKeys(unsigned char c, int xx, int yy) {
@@ -773,6 +5992,31 @@ void processKeys(unsigned char c, int xx, int yy) {
     case '-':
         radius += 1.0f;
         break;
+    case 'i':
+        useInstancing = !useInstancing && GLEW_VERSION_3_3;
+        std::cout << "Instancing " << (useInstancing ? "on" : "off") << std::endl;
+        break;
+    case 'c':
+        useCulling = !useCulling;
+        std::cout << "Frustum culling " << (useCulling ? "on" : "off") << std::endl;
+        break;
+    case 'o':
+        useOcclusion = !useOcclusion;
+        std::cout << "Occlusion culling " << (useOcclusion ? "on" : "off") << std::endl;
+        break;
+    case 'm':
+        useMultiDraw = !useMultiDraw && useGeometryPool && GLEW_VERSION_4_3;
+        std::cout << "Multi-draw indirect " << (useMultiDraw ? "on" : "off") << std::endl;
+        break;
+    case 'r':
+        reportMemory(worldConfig, true);
+        break;
+    case 'n':
+        if (sceneFiles.size() > 1 && !sceneStreamer.active()) {
+            currentScene = (currentScene + 1) % sceneFiles.size();
+            streamScene(sceneFiles[currentScene]);
+        }
+        break;
     }
 
     spherical2Cartesian();
@@ -780,7 +6024,13 @@ void processKeys(unsigned char c, int xx, int yy) {
     worldConfig.camera.position.y = camY;
     worldConfig.camera.position.z = camZ;
 
-    glutPostRedisplay();
+    requestRedraw();
+}
+
+void processMouse(int button, int state, int x, int y) {
+    if (button == GLUT_LEFT_BUTTON && state == GLUT_DOWN) {
+        pickModel(x, y);
+    }
 }
 
 void processSpecialKeys(int key, int xx, int yy) {
@@ -811,11 +6061,10 @@ void processSpecialKeys(int key, int xx, int yy) {
         break;
     }
     spherical2Cartesian();
-    glutPostRedisplay();
     worldConfig.camera.position.x = camX;
     worldConfig.camera.position.y = camY;
     worldConfig.camera.position.z = camZ;
-    glutPostRedisplay();
+    requestRedraw();
 }
 
 void reshape(int width, int height) {
@@ -838,20 +6087,128 @@ void reshape(int width, int height) {
         worldConfig.camera.up.x, worldConfig.camera.up.y, worldConfig.camera.up.z);
 }
 
-void initializeModels() {
-    for (auto& group : worldConfig.groups) {
-        for (auto& model : group.models) {
-            initializeVBO(model);
-        }
+void runLayoutBenchmark(const std::string& filename, int frames) {
+    const VertexLayout layouts[2] = { LAYOUT_PLANAR, LAYOUT_INTERLEAVED };
+    const char* names[2] = { "planar", "interleaved" };
+    const int drawsPerFrame = 10;
+
+    Model models[2];
+    for (int k = 0; k < 2; ++k) {
+        vertexLayout = layouts[k];
+        models[k].mesh = readModel(filename);
     }
-}
+    if (models[0].mesh->vertices.empty()) return;
 
-void myIdleFunc() {
-    glutPostRedisplay();
+    float extent = 0.0f;
+    for (const Point3D& p : models[0].mesh->vertices) {
+        extent = std::max(extent, std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z));
+    }
+    worldConfig.camera.position = { 0.0f, extent, extent * 3.0f };
+    worldConfig.camera.lookAt = { 0.0f, 0.0f, 0.0f };
+    worldConfig.camera.up = { 0.0f, 1.0f, 0.0f };
+    worldConfig.camera.projection = { 60.0f, extent * 0.1f, extent * 10.0f };
+    setupCamera(worldConfig.camera);
+
+    for (int k = 0; k < 2; ++k) {
+        renderModel(models[k]);
+        glFinish();
+
+        auto start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < frames; ++frame) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            for (int draw = 0; draw < drawsPerFrame; ++draw) {
+                renderModel(models[k]);
+            }
+            glFinish();
+        }
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << names[k] << ": " << elapsed / frames << " ms/frame (" << models[k].mesh->vertices.size() << " vertices x "
+            << drawsPerFrame << " draws, stride " << models[k].mesh->stride << ")" << std::endl;
+    }
 }
 
 int main(int argc, char** argv) {
-    glutInit(&argc, argv);
+    // --bake and --render need no window; their own arguments come first and the flags below follow
+    std::string headless = argc >= 4 ? argv[1] : "";
+    int firstFlag = 1;
+    int renderFrames = 1;
+    if (headless == "--bake" || headless == "--render") {
+        firstFlag = 4;
+        if (headless == "--render" && argc >= 5 && std::isdigit(static_cast<unsigned char>(argv[4][0]))) {
+            renderFrames = std::max(1, std::atoi(argv[firstFlag++]));
+        }
+    }
+    else {
+        headless.clear();
+        glutInit(&argc, argv);
+    }
+
+    std::string benchmarkFile;
+    bool layoutRequested = false;
+    for (int i = firstFlag; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--layout" && i + 1 < argc) {
+            std::string layout = argv[++i];
+            vertexLayout = layout == "interleaved" ? LAYOUT_INTERLEAVED : LAYOUT_PLANAR;
+            layoutRequested = true;
+        }
+        else if (arg == "--no-instancing") {
+            useInstancing = false;
+        }
+        else if (arg == "--no-culling") {
+            useCulling = false;
+        }
+        else if (arg == "--no-occlusion") {
+            useOcclusion = false;
+        }
+        else if (arg == "--no-baking") {
+            useStaticBaking = false;
+        }
+        else if (arg == "--no-tessellation") {
+            useTessellation = false;
+        }
+        else if (arg == "--fps" && i + 1 < argc) {
+            targetFrameRate = std::max(0, atoi(argv[++i]));
+        }
+        else if (arg == "--keep-cpu-geometry") {
+            keepCpuGeometry = true;
+        }
+        else if (arg == "--no-reload") {
+            useHotReload = false;
+        }
+        else if (arg == "--upload-budget" && i + 1 < argc) {
+            uploadBudgetMs = std::max(0.0, atof(argv[++i]));
+        }
+        else if (arg == "--no-ring") {
+            useFrameRing = false;
+        }
+        else if (arg == "--no-multidraw") {
+            useGeometryPool = false;
+            useMultiDraw = false;
+        }
+        else if (arg == "--benchmark-layout" && i + 1 < argc) {
+            benchmarkFile = argv[++i];
+            worldConfig.window = { 512, 512 };
+            useGeometryPool = false;
+        }
+        else {
+            sceneFiles.push_back(arg);
+        }
+    }
+    if (!headless.empty()) {
+        if (!sceneFiles.empty()) {
+            std::cerr << "Argumento desconhecido para " << headless << ": " << sceneFiles[0] << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (headless == "--bake") return bakeSceneSnapshot(argv[2], argv[3]) ? 0 : EXIT_FAILURE;
+        return renderSceneSoftware(argv[2], argv[3], renderFrames) ? 0 : EXIT_FAILURE;
+    }
+    if (sceneFiles.empty()) {
+        sceneFiles.push_back("C:/Users/GIGABYTE/Desktop/teste/teste2/src/src/engine/xml_parte1.xml");
+    }
+    const std::string& sceneFile = sceneFiles[0];
+
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
     glutInitWindowSize(worldConfig.window.width, worldConfig.window.height);
     glutCreateWindow("Engine Application");
@@ -862,20 +6219,57 @@ int main(int argc, char** argv) {
         return EXIT_FAILURE;
     }
 
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
+    if (!GLEW_VERSION_3_3) {
+        useInstancing = false;
+    }
+    if (!GLEW_VERSION_3_2) {
+        useGeometryPool = false;
+    }
+    if (!GLEW_VERSION_4_3 || !useGeometryPool) {
+        useMultiDraw = false;
+    }
+    // Pooled meshes share one interleaved buffer, so a planar layout needs the pool off
+    if (layoutRequested && useGeometryPool && vertexLayout != LAYOUT_INTERLEAVED) {
+        std::cerr << "O layout planar requer --no-multidraw, pois o pool de geometria  intercalado" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!GLEW_VERSION_4_4) {
+        useFrameRing = false;
+    }
+    if (!GLEW_VERSION_4_0) {
+        useTessellation = false;
+    }
+
+    glState.enable(GL_DEPTH_TEST);
+    glState.enable(GL_CULL_FACE);
     glCullFace(GL_BACK);
     glFrontFace(GL_CCW);
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
+    if (!benchmarkFile.empty()) {
+        runLayoutBenchmark(benchmarkFile, 200);
+        return 0;
+    }
+
     glutReshapeFunc(reshape);
     glutDisplayFunc(display);
     glutKeyboardFunc(processKeys);
     glutSpecialFunc(processSpecialKeys);
+    glutMouseFunc(processMouse);
+    glutVisibilityFunc(visibilityChanged);
     glutIdleFunc(myIdleFunc);
 
-    parseXML("C:/Users/GIGABYTE/Desktop/teste/teste2/src/src/engine/xml_parte1.xml");
-    initializeModels();
+    if (isSceneSnapshot(sceneFile)) {
+        loadSceneSnapshot(sceneFile);
+    }
+    else {
+        parseXML(sceneFile);
+        sceneFilePath = sceneFile;
+        if (useHotReload) watchSceneFiles();
+    }
+    if (useHotReload) {
+        glutTimerFunc(250, pollSceneFiles, 0);
+    }
     initializeLighting();
 
     glutMainLoop();
@@ -10,45 +10,16 @@
 #include <iterator>
 #include <algorithm>
 #include <iomanip>
+#include <map>
+#include <array>
+#include <unordered_map>
+#include <limits>
+#include <cstdint>
 
-struct Vector3 {
-    float x, y, z;
+#include "primitives.h"
 
-    Vector3(float x = 0.0f, float y = 0.0f, float z = 0.0f) : x(x), y(y), z(z) {}
-
-    Vector3 normalized() const {
-        float length = std::sqrt(x * x + y * y + z * z);
-        return Vector3(x / length, y / length, z / length);
-    }
-
-    Vector3 operator-(const Vector3& other) const {
-        return Vector3(x - other.x, y - other.y, z - other.z);
-    }
-
-    Vector3 operator+(const Vector3& other) const {
-        return Vector3(x + other.x, y + other.y, z + other.z);
-    }
-
-    Vector3 operator*(float scalar) const {
-        return Vector3(x * scalar, y * scalar, z * scalar);
-    }
-
-    Vector3 cross(const Vector3& other) const {
-        return Vector3(y * other.z - z * other.y, z * other.x - x * other.z, x * other.y - y * other.x);
-    }
-};
-
-struct Vector2 {
-    float u, v;
-
-    Vector2(float u = 0.0f, float v = 0.0f) : u(u), v(v) {}
-};
-
-Vector3 Lerp(const Vector3& a, const Vector3& b, float t) {
-    return Vector3(a.x + (b.x - a.x) * t,
-        a.y + (b.y - a.y) * t,
-        a.z + (b.z - a.z) * t);
-}
+using primitives::Vector3;
+using primitives::Vector2;
 
 std::string formatNumber(float num) {
     if (std::floor(num) == num) {
@@ -79,460 +50,682 @@ void writeToFile(const std::string& filename, const std::vector<Vector3>& vertic
     std::cout << "Written " << vertices.size() << " vertex to archive " << filename << std::endl;
 }
 
-void generatePlane(float length, int divisions, const std::string& filename) {
+void writeToFile(const std::string& filename, const primitives::Shape& shape) {
+    writeToFile(filename, shape.vertices, shape.normals, shape.texCoords);
+}
+
+struct IndexedMesh {
     std::vector<Vector3> vertices;
     std::vector<Vector3> normals;
     std::vector<Vector2> texCoords;
+    std::vector<unsigned int> indices;
+};
 
-    float half_length = length / 2.0f;
-    float step = length / divisions;
-
-    Vector3 normal(0.0f, 1.0f, 0.0f);
-
-    for (int i = 0; i < divisions; ++i) {
-        for (int j = 0; j < divisions; ++j) {
-            float x0 = i * step - half_length;
-            float x1 = (i + 1) * step - half_length;
-            float z0 = j * step - half_length;
-            float z1 = (j + 1) * step - half_length;
-
-            float u0 = float(i) / divisions;
-            float u1 = float(i + 1) / divisions;
-            float v0 = float(j) / divisions;
-            float v1 = float(j + 1) / divisions;
+IndexedMesh indexMesh(const std::vector<Vector3>& vertices, const std::vector<Vector3>& normals, const std::vector<Vector2>& texCoords) {
+    IndexedMesh mesh;
+    std::map<std::array<float, 8>, unsigned int> lookup;
 
-            vertices.push_back(Vector3(x0, 0.0f, z0));
-            normals.push_back(normal);
-            texCoords.push_back(Vector2(u0, v0));
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        std::array<float, 8> key = { vertices[i].x, vertices[i].y, vertices[i].z,
+            normals[i].x, normals[i].y, normals[i].z, texCoords[i].u, texCoords[i].v };
+
+        auto inserted = lookup.emplace(key, static_cast<unsigned int>(mesh.vertices.size()));
+        if (inserted.second) {
+            mesh.vertices.push_back(vertices[i]);
+            mesh.normals.push_back(normals[i]);
+            mesh.texCoords.push_back(texCoords[i]);
+        }
+        mesh.indices.push_back(inserted.first->second);
+    }
 
-            vertices.push_back(Vector3(x0, 0.0f, z1));
-            normals.push_back(normal);
-            texCoords.push_back(Vector2(u0, v1));
+    return mesh;
+}
 
-            vertices.push_back(Vector3(x1, 0.0f, z0));
-            normals.push_back(normal);
-            texCoords.push_back(Vector2(u1, v0));
+bool readFromFile(const std::string& filename, IndexedMesh& mesh) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Erro ao abrir o arquivo: " << filename << std::endl;
+        return false;
+    }
 
-            vertices.push_back(Vector3(x0, 0.0f, z1));
-            normals.push_back(normal);
-            texCoords.push_back(Vector2(u0, v1));
+    // Header is "<vertices>" for a triangle soup or "<vertices> <indices>" for an indexed mesh
+    std::string line;
+    if (!std::getline(file, line)) return false;
+    std::istringstream header(line);
+    size_t totalPoints = 0, totalIndices = 0;
+    std::string layout;
+    header >> totalPoints >> totalIndices >> layout;
+    if (layout == "compact") {
+        std::cerr << "Erro: " << filename << " ja esta quantizado" << std::endl;
+        return false;
+    }
+    bool indexed = totalIndices > 0;
 
-            vertices.push_back(Vector3(x1, 0.0f, z1));
-            normals.push_back(normal);
-            texCoords.push_back(Vector2(u1, v1));
+    std::vector<Vector3> vertices, normals;
+    std::vector<Vector2> texCoords;
+    char comma, semicolon;
+    while (std::getline(file, line)) {
+        std::istringstream iss(line);
+
+        if (indexed && vertices.size() == totalPoints) {
+            unsigned int a, b, c;
+            if ((iss >> a >> comma >> b >> comma >> c) && comma == ',' &&
+                a < totalPoints && b < totalPoints && c < totalPoints) {
+                mesh.indices.push_back(a);
+                mesh.indices.push_back(b);
+                mesh.indices.push_back(c);
+            }
+            continue;
+        }
 
-            vertices.push_back(Vector3(x1, 0.0f, z0));
+        Vector3 vertex, normal;
+        Vector2 texCoord;
+        if ((iss >> vertex.x >> comma >> vertex.y >> comma >> vertex.z >> semicolon
+            >> normal.x >> comma >> normal.y >> comma >> normal.z >> semicolon
+            >> texCoord.u >> comma >> texCoord.v) &&
+            comma == ',' && semicolon == ';') {
+            texCoord.v = 1.0f - texCoord.v;
+            vertices.push_back(vertex);
             normals.push_back(normal);
-            texCoords.push_back(Vector2(u1, v0));
+            texCoords.push_back(texCoord);
         }
     }
 
-    writeToFile(filename, vertices, normals, texCoords);
+    file.close();
+    if (indexed) {
+        mesh.vertices.swap(vertices);
+        mesh.normals.swap(normals);
+        mesh.texCoords.swap(texCoords);
+    }
+    else {
+        mesh = indexMesh(vertices, normals, texCoords);
+    }
+    return !mesh.indices.empty();
 }
 
-void generateBox(float length, int divisions, const std::string& filename) {
-    std::vector<Vector3> vertices;
-    std::vector<Vector3> normals;
-    std::vector<Vector2> texCoords;
+void unindexMesh(const IndexedMesh& mesh, std::vector<Vector3>& vertices, std::vector<Vector3>& normals, std::vector<Vector2>& texCoords) {
+    for (unsigned int index : mesh.indices) {
+        vertices.push_back(mesh.vertices[index]);
+        normals.push_back(mesh.normals[index]);
+        texCoords.push_back(mesh.texCoords[index]);
+    }
+}
 
-    float half_length = length / 2.0f;
-    float step = length / divisions;
-
-    std::vector<Vector3> faceNormals = {
-        Vector3(0, 1, 0),
-        Vector3(0, -1, 0),
-        Vector3(0, 0, 1),
-        Vector3(0, 0, -1),
-        Vector3(-1, 0, 0),
-        Vector3(1, 0, 0)
-    };
-
-    for (int face = 0; face < 6; ++face) {
-        for (int i = 0; i < divisions; ++i) {
-            for (int j = 0; j < divisions; ++j) {
-                Vector3 v0, v1, v2, v3;
-                float u1f = i / static_cast<float>(divisions);
-                float v1f = j / static_cast<float>(divisions);
-                float u2f = (i + 1) / static_cast<float>(divisions);
-                float v2f = (j + 1) / static_cast<float>(divisions);
-
-                switch (face) {
-                case 0:
-                    v0 = Vector3(-half_length + i * step, half_length, -half_length + j * step);
-                    v1 = Vector3(-half_length + (i + 1) * step, half_length, -half_length + j * step);
-                    v2 = Vector3(-half_length + (i + 1) * step, half_length, -half_length + (j + 1) * step);
-                    v3 = Vector3(-half_length + i * step, half_length, -half_length + (j + 1) * step);
-                    break;
-                case 1:
-                    v0 = Vector3(-half_length + i * step, -half_length, -half_length + j * step);
-                    v1 = Vector3(-half_length + (i + 1) * step, -half_length, -half_length + j * step);
-                    v2 = Vector3(-half_length + (i + 1) * step, -half_length, -half_length + (j + 1) * step);
-                    v3 = Vector3(-half_length + i * step, -half_length, -half_length + (j + 1) * step);
-                    v1f = 1 - v1f;
-                    v2f = 1 - v2f;
-                    break;
-                case 2:
-                    v0 = Vector3(-half_length + i * step, -half_length + j * step, half_length);
-                    v1 = Vector3(-half_length + (i + 1) * step, -half_length + j * step, half_length);
-                    v2 = Vector3(-half_length + (i + 1) * step, -half_length + (j + 1) * step, half_length);
-                    v3 = Vector3(-half_length + i * step, -half_length + (j + 1) * step, half_length);
-                    break;
-                case 3:
-                    v0 = Vector3(-half_length + i * step, -half_length + j * step, -half_length);
-                    v1 = Vector3(-half_length + (i + 1) * step, -half_length + j * step, -half_length);
-                    v2 = Vector3(-half_length + (i + 1) * step, -half_length + (j + 1) * step, -half_length);
-                    v3 = Vector3(-half_length + i * step, -half_length + (j + 1) * step, -half_length);
-                    break;
-                case 4:
-                    v0 = Vector3(-half_length, -half_length + j * step, -half_length + i * step);
-                    v1 = Vector3(-half_length, -half_length + (j + 1) * step, -half_length + i * step);
-                    v2 = Vector3(-half_length, -half_length + (j + 1) * step, -half_length + (i + 1) * step);
-                    v3 = Vector3(-half_length, -half_length + j * step, -half_length + (i + 1) * step);
-                    break;
-                case 5: 
-                    v0 = Vector3(half_length, -half_length + j * step, -half_length + i * step);
-                    v1 = Vector3(half_length, -half_length + (j + 1) * step, -half_length + i * step);
-                    v2 = Vector3(half_length, -half_length + (j + 1) * step, -half_length + (i + 1) * step);
-                    v3 = Vector3(half_length, -half_length + j * step, -half_length + (i + 1) * step);
-                    break;
-                }
+void compactMesh(IndexedMesh& mesh) {
+    std::vector<unsigned int> remap(mesh.vertices.size(), ~0u);
+    IndexedMesh result;
 
-                vertices.push_back(v0);
-                vertices.push_back(v1);
-                vertices.push_back(v2);
-                vertices.push_back(v2);
-                vertices.push_back(v3);
-                vertices.push_back(v0);
-
-                normals.push_back(faceNormals[face]);
-                normals.push_back(faceNormals[face]);
-                normals.push_back(faceNormals[face]);
-                normals.push_back(faceNormals[face]);
-                normals.push_back(faceNormals[face]);
-                normals.push_back(faceNormals[face]);
-
-                texCoords.push_back(Vector2(u1f, v1f));
-                texCoords.push_back(Vector2(u2f, v1f));
-                texCoords.push_back(Vector2(u2f, v2f));
-                texCoords.push_back(Vector2(u2f, v2f));
-                texCoords.push_back(Vector2(u1f, v2f));
-                texCoords.push_back(Vector2(u1f, v1f));
-            }
+    for (unsigned int& index : mesh.indices) {
+        if (remap[index] == ~0u) {
+            remap[index] = static_cast<unsigned int>(result.vertices.size());
+            result.vertices.push_back(mesh.vertices[index]);
+            result.normals.push_back(mesh.normals[index]);
+            result.texCoords.push_back(mesh.texCoords[index]);
         }
+        index = remap[index];
     }
 
-    writeToFile(filename, vertices, normals, texCoords);
+    mesh.vertices.swap(result.vertices);
+    mesh.normals.swap(result.normals);
+    mesh.texCoords.swap(result.texCoords);
 }
 
-float theta(int slice, int slices) {
-    return 2.0f * M_PI * slice / slices;
+float dot(const Vector3& a, const Vector3& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
 }
 
-void generateSphere(float radius, int slices, int stacks, const std::string& filename) {
-    std::vector<Vector3> vertices;
-    std::vector<Vector3> normals;
-    std::vector<Vector2> texCoords;
+struct Quadric {
+    double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+    double b0 = 0, b1 = 0, b2 = 0, c = 0;
+    double weight = 0;
 
-    for (int i = 0; i <= stacks; ++i) {
-        float phi = M_PI * i / stacks;
-        float sin_phi = sin(phi);
-        float cos_phi = cos(phi);
+    void addPlane(const Vector3& n, float d, double w) {
+        a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z;
+        a11 += w * n.y * n.y; a12 += w * n.y * n.z; a22 += w * n.z * n.z;
+        b0 += w * n.x * d; b1 += w * n.y * d; b2 += w * n.z * d;
+        c += w * d * d;
+        weight += w;
+    }
 
-        for (int j = 0; j <= slices; ++j) {
-            float theta = 2 * M_PI * j / slices;
-            float sin_theta = sin(theta);
-            float cos_theta = cos(theta);
+    void add(const Quadric& other) {
+        a00 += other.a00; a01 += other.a01; a02 += other.a02;
+        a11 += other.a11; a12 += other.a12; a22 += other.a22;
+        b0 += other.b0; b1 += other.b1; b2 += other.b2;
+        c += other.c;
+        weight += other.weight;
+    }
 
-            float x = radius * sin_phi * cos_theta;
-            float y = radius * cos_phi;
-            float z = radius * sin_phi * sin_theta;
+    // Mean squared distance from p to the accumulated planes
+    double error(const Vector3& p) const {
+        double r = a00 * p.x * p.x + a11 * p.y * p.y + a22 * p.z * p.z
+            + 2 * (a01 * p.x * p.y + a02 * p.x * p.z + a12 * p.y * p.z)
+            + 2 * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+        return weight > 0 ? std::fabs(r) / weight : 0;
+    }
+};
 
-            float u = static_cast<float>(j) / slices;
-            float v = static_cast<float>(i) / stacks;
+enum VertexKind { KIND_MANIFOLD, KIND_CONSTRAINED, KIND_LOCKED };
 
-            Vector3 vertex(x, y, z);
-            Vector3 normal = vertex.normalized();
-            Vector2 texCoord(u, v);
+struct Collapse {
+    unsigned int from, to;
+    double cost;
+};
 
-            vertices.push_back(vertex);
-            normals.push_back(normal);
-            texCoords.push_back(texCoord);
+// Quadric-error-metric decimation using half-edge collapses. Vertices only ever move onto an
+// existing neighbour, so normals and UVs are kept exactly; vertices on UV/normal seams and on
+// open borders may only slide along that seam/border, and corners are locked.
+float simplifyMesh(IndexedMesh& mesh, size_t targetIndexCount, float targetError) {
+    size_t vertexCount = mesh.vertices.size();
+    if (vertexCount == 0) return 0;
+
+    std::vector<unsigned int> remap(vertexCount), wedge(vertexCount);
+    std::map<std::array<float, 3>, unsigned int> positions;
+    for (size_t v = 0; v < vertexCount; ++v) {
+        std::array<float, 3> key = { mesh.vertices[v].x, mesh.vertices[v].y, mesh.vertices[v].z };
+        remap[v] = positions.emplace(key, static_cast<unsigned int>(v)).first->second;
+        wedge[v] = static_cast<unsigned int>(v);
+        if (remap[v] != v) {
+            wedge[v] = wedge[remap[v]];
+            wedge[remap[v]] = static_cast<unsigned int>(v);
         }
     }
 
-    std::vector<Vector3> finalVertices;
-    std::vector<Vector3> finalNormals;
-    std::vector<Vector2> finalTexCoords;
+    Vector3 minP = mesh.vertices[0], maxP = mesh.vertices[0];
+    for (const Vector3& p : mesh.vertices) {
+        minP = Vector3(std::min(minP.x, p.x), std::min(minP.y, p.y), std::min(minP.z, p.z));
+        maxP = Vector3(std::max(maxP.x, p.x), std::max(maxP.y, p.y), std::max(maxP.z, p.z));
+    }
+    float extent = std::max(maxP.x - minP.x, std::max(maxP.y - minP.y, maxP.z - minP.z));
+    if (extent <= 0) extent = 1;
+    double errorLimit = double(targetError) * extent * double(targetError) * extent;
 
-    for (int i = 0; i < stacks; ++i) {
-        for (int j = 0; j < slices; ++j) {
-            int first = (i * (slices + 1)) + j;
-            int second = first + slices + 1;
+    auto edgeKey = [](unsigned int a, unsigned int b) { return (uint64_t(a) << 32) | b; };
 
-            finalVertices.push_back(vertices[first]);
-            finalNormals.push_back(normals[first]);
-            finalTexCoords.push_back(texCoords[first]);
+    std::vector<Quadric> quadrics(vertexCount);
+    std::unordered_map<uint64_t, std::pair<unsigned int, unsigned int>> edges;
+    for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+        for (int k = 0; k < 3; ++k) {
+            unsigned int a = mesh.indices[i + k], b = mesh.indices[i + (k + 1) % 3];
+            edges[edgeKey(remap[a], remap[b])] = std::make_pair(a, b);
+        }
+    }
 
-            finalVertices.push_back(vertices[second]);
-            finalNormals.push_back(normals[second]);
-            finalTexCoords.push_back(texCoords[second]);
+    for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+        const Vector3& p0 = mesh.vertices[mesh.indices[i]];
+        const Vector3& p1 = mesh.vertices[mesh.indices[i + 1]];
+        const Vector3& p2 = mesh.vertices[mesh.indices[i + 2]];
+        Vector3 n = (p1 - p0).cross(p2 - p0);
+        float length = std::sqrt(dot(n, n));
+        if (length == 0) continue;
+        n = n * (1.0f / length);
 
-            finalVertices.push_back(vertices[first + 1]);
-            finalNormals.push_back(normals[first + 1]);
-            finalTexCoords.push_back(texCoords[first + 1]);
+        for (int k = 0; k < 3; ++k) {
+            quadrics[remap[mesh.indices[i + k]]].addPlane(n, -dot(n, p0), length * 0.5);
+        }
 
-            finalVertices.push_back(vertices[second]);
-            finalNormals.push_back(normals[second]);
-            finalTexCoords.push_back(texCoords[second]);
+        // Border and seam edges get an extra plane perpendicular to the face so they keep their shape
+        for (int k = 0; k < 3; ++k) {
+            unsigned int a = mesh.indices[i + k], b = mesh.indices[i + (k + 1) % 3];
+            auto opposite = edges.find(edgeKey(remap[b], remap[a]));
+            if (opposite != edges.end() && opposite->second.first == b && opposite->second.second == a) continue;
+
+            Vector3 edge = mesh.vertices[b] - mesh.vertices[a];
+            Vector3 edgeNormal = edge.cross(n);
+            float edgeLength = std::sqrt(dot(edgeNormal, edgeNormal));
+            if (edgeLength == 0) continue;
+            edgeNormal = edgeNormal * (1.0f / edgeLength);
+            float d = -dot(edgeNormal, mesh.vertices[a]);
+            quadrics[remap[a]].addPlane(edgeNormal, d, dot(edge, edge) * 10.0);
+            quadrics[remap[b]].addPlane(edgeNormal, d, dot(edge, edge) * 10.0);
+        }
+    }
 
-            finalVertices.push_back(vertices[second + 1]);
-            finalNormals.push_back(normals[second + 1]);
-            finalTexCoords.push_back(texCoords[second + 1]);
+    double resultError = 0;
+    while (mesh.indices.size() > targetIndexCount) {
+        size_t triangleCount = mesh.indices.size() / 3;
 
-            finalVertices.push_back(vertices[first + 1]);
-            finalNormals.push_back(normals[first + 1]);
-            finalTexCoords.push_back(texCoords[first + 1]);
+        // Position-space adjacency for this pass
+        edges.clear();
+        std::vector<bool> locked(vertexCount, false), used(vertexCount, false);
+        for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+            for (int k = 0; k < 3; ++k) {
+                unsigned int a = mesh.indices[i + k], b = mesh.indices[i + (k + 1) % 3];
+                used[a] = true;
+                if (!edges.emplace(edgeKey(remap[a], remap[b]), std::make_pair(a, b)).second) {
+                    locked[remap[a]] = locked[remap[b]] = true;
+                }
+            }
         }
-    }
 
-    writeToFile(filename, finalVertices, finalNormals, finalTexCoords);
-}
+        std::vector<std::vector<unsigned int>> constrainedEdges(vertexCount);
+        for (const auto& edge : edges) {
+            unsigned int pa = unsigned(edge.first >> 32), pb = unsigned(edge.first & 0xffffffffu);
+            auto opposite = edges.find(edgeKey(pb, pa));
+            if (opposite == edges.end()) {
+                constrainedEdges[pa].push_back(pb);
+                constrainedEdges[pb].push_back(pa);
+            }
+            else if (pa < pb && (opposite->second.first != edge.second.second || opposite->second.second != edge.second.first)) {
+                constrainedEdges[pa].push_back(pb);
+                constrainedEdges[pb].push_back(pa);
+            }
+        }
 
-void generateCone(float radius, float height, int slices, int stacks, const std::string& filename) {
-    std::vector<Vector3> vertices;
-    std::vector<Vector3> normals;
-    std::vector<Vector2> texCoords;
+        std::vector<VertexKind> kind(vertexCount, KIND_LOCKED);
+        for (size_t v = 0; v < vertexCount; ++v) {
+            if (remap[v] != v || locked[v]) continue;
+            int wedges = 0;
+            unsigned int w = static_cast<unsigned int>(v);
+            do {
+                wedges += used[w] ? 1 : 0;
+                w = wedge[w];
+            } while (w != v);
+
+            if (constrainedEdges[v].empty() && wedges == 1) kind[v] = KIND_MANIFOLD;
+            else if (constrainedEdges[v].size() == 2) {
+                // Only a vertex in the middle of a straight border or seam may slide; corners stay locked
+                Vector3 e0 = mesh.vertices[constrainedEdges[v][0]] - mesh.vertices[v];
+                Vector3 e1 = mesh.vertices[constrainedEdges[v][1]] - mesh.vertices[v];
+                Vector3 c = e0.cross(e1);
+                float scale = dot(e0, e0) * dot(e1, e1);
+                if (dot(e0, e1) < 0 && dot(c, c) <= 1e-6f * scale) kind[v] = KIND_CONSTRAINED;
+            }
+        }
 
-    float stackHeight = height / stacks;
-    float angleStep = (2 * M_PI) / slices;
+        std::vector<std::vector<size_t>> triangles(vertexCount);
+        for (size_t t = 0; t < triangleCount; ++t) {
+            for (int k = 0; k < 3; ++k) {
+                triangles[remap[mesh.indices[t * 3 + k]]].push_back(t);
+            }
+        }
+
+        std::vector<Collapse> candidates;
+        for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+            for (int k = 0; k < 3; ++k) {
+                unsigned int from = remap[mesh.indices[i + k]], to = remap[mesh.indices[i + (k + 1) % 3]];
+                for (int direction = 0; direction < 2; ++direction, std::swap(from, to)) {
+                    bool allowed = kind[from] == KIND_MANIFOLD ||
+                        (kind[from] == KIND_CONSTRAINED &&
+                            std::find(constrainedEdges[from].begin(), constrainedEdges[from].end(), to) != constrainedEdges[from].end());
+                    if (!allowed) continue;
+
+                    Quadric q = quadrics[from];
+                    q.add(quadrics[to]);
+                    candidates.push_back({ from, to, q.error(mesh.vertices[to]) });
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+        std::vector<unsigned int> collapseTo(vertexCount);
+        for (size_t v = 0; v < vertexCount; ++v) collapseTo[v] = static_cast<unsigned int>(v);
+        std::vector<bool> touched(vertexCount, false);
+        size_t removedTriangles = 0, collapses = 0;
+        size_t budget = (triangleCount - targetIndexCount / 3 + 1) / 2 + 1;
+
+        for (const Collapse& collapse : candidates) {
+            if (collapse.cost > errorLimit) break;
+            if (removedTriangles >= budget) break;
+            if (touched[collapse.from] || touched[collapse.to]) continue;
+
+            // Every wedge of the removed vertex must map onto a single wedge of the target
+            std::vector<std::pair<unsigned int, unsigned int>> wedgeMap;
+            bool valid = true;
+            unsigned int w = collapse.from;
+            do {
+                if (used[w]) {
+                    unsigned int target = ~0u;
+                    for (size_t t : triangles[collapse.from]) {
+                        const unsigned int* tri = &mesh.indices[t * 3];
+                        if (tri[0] != w && tri[1] != w && tri[2] != w) continue;
+                        for (int k = 0; k < 3; ++k) {
+                            if (remap[tri[k]] != collapse.to) continue;
+                            if (target != ~0u && target != tri[k]) valid = false;
+                            target = tri[k];
+                        }
+                    }
+                    if (target == ~0u) valid = false;
+                    wedgeMap.push_back(std::make_pair(w, target));
+                }
+                w = wedge[w];
+            } while (w != collapse.from && valid);
+            if (!valid) continue;
+
+            // Reject collapses that flip a surviving triangle
+            size_t removed = 0;
+            for (size_t t : triangles[collapse.from]) {
+                const unsigned int* tri = &mesh.indices[t * 3];
+                Vector3 oldP[3], newP[3];
+                bool degenerate = false;
+                for (int k = 0; k < 3; ++k) {
+                    oldP[k] = newP[k] = mesh.vertices[tri[k]];
+                    if (remap[tri[k]] == collapse.to) degenerate = true;
+                    if (remap[tri[k]] == collapse.from) newP[k] = mesh.vertices[collapse.to];
+                }
+                if (degenerate) {
+                    ++removed;
+                    continue;
+                }
+                Vector3 oldN = (oldP[1] - oldP[0]).cross(oldP[2] - oldP[0]);
+                Vector3 newN = (newP[1] - newP[0]).cross(newP[2] - newP[0]);
+                if (dot(oldN, newN) <= 0) {
+                    valid = false;
+                    break;
+                }
+            }
+            if (!valid) continue;
 
-    for (int i = 0; i < slices; ++i) {
-        float angle = i * angleStep;
-        float nextAngle = (i + 1) * angleStep;
-        Vector3 v0(0, 0, 0);
-        Vector3 v1(radius * cos(angle), 0, radius * sin(angle));
-        Vector3 v2(radius * cos(nextAngle), 0, radius * sin(nextAngle));
+            for (const auto& mapping : wedgeMap) collapseTo[mapping.first] = mapping.second;
+            quadrics[collapse.to].add(quadrics[collapse.from]);
+            resultError = std::max(resultError, collapse.cost);
+            removedTriangles += removed;
+            ++collapses;
 
-        vertices.push_back(v0);
-        vertices.push_back(v1);
-        vertices.push_back(v2);
+            for (size_t t : triangles[collapse.from]) {
+                for (int k = 0; k < 3; ++k) touched[remap[mesh.indices[t * 3 + k]]] = true;
+            }
+        }
 
-        normals.push_back(Vector3(0, -1, 0));
-        normals.push_back(Vector3(0, -1, 0));
-        normals.push_back(Vector3(0, -1, 0));
+        if (collapses == 0) break;
 
-        texCoords.push_back(Vector2(0.5, 0.5));
-        texCoords.push_back(Vector2(cos(angle) * 0.5 + 0.5, sin(angle) * 0.5 + 0.5));
-        texCoords.push_back(Vector2(cos(nextAngle) * 0.5 + 0.5, sin(nextAngle) * 0.5 + 0.5));
+        std::vector<unsigned int> indices;
+        for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+            unsigned int a = collapseTo[mesh.indices[i]], b = collapseTo[mesh.indices[i + 1]], c = collapseTo[mesh.indices[i + 2]];
+            if (remap[a] == remap[b] || remap[b] == remap[c] || remap[a] == remap[c]) continue;
+            indices.push_back(a);
+            indices.push_back(b);
+            indices.push_back(c);
+        }
+        mesh.indices.swap(indices);
     }
 
-    for (int j = 0; j < stacks; ++j) {
-        float currentRadius = radius * (1 - static_cast<float>(j) / stacks);
-        float nextRadius = radius * (1 - static_cast<float>(j + 1) / stacks);
-        float currentHeight = j * stackHeight;
-        float nextHeight = (j + 1) * stackHeight;
+    compactMesh(mesh);
+    return float(std::sqrt(resultError) / extent);
+}
 
-        for (int i = 0; i < slices; ++i) {
-            float angle = i * angleStep;
-            float nextAngle = (i + 1) * angleStep;
+void simplifyModel(const std::string& inputFile, const std::string& target, const std::string& outputFile) {
+    IndexedMesh mesh;
+    if (!readFromFile(inputFile, mesh)) {
+        std::cerr << "Erro: Nenhum vertice encontrado em " << inputFile << std::endl;
+        return;
+    }
 
-            Vector3 v0(currentRadius * cos(angle), currentHeight, currentRadius * sin(angle));
-            Vector3 v1(nextRadius * cos(angle), nextHeight, nextRadius * sin(angle));
-            Vector3 v2(currentRadius * cos(nextAngle), currentHeight, currentRadius * sin(nextAngle));
-            Vector3 v3(nextRadius * cos(nextAngle), nextHeight, nextRadius * sin(nextAngle));
+    // "<ratio>" keeps that fraction of the triangles, "e<error>" stops at a relative error
+    float ratio = 0.0f;
+    float error = std::numeric_limits<float>::max();
+    if (!target.empty() && (target[0] == 'e' || target[0] == 'E')) {
+        error = std::stof(target.substr(1));
+    }
+    else {
+        ratio = std::stof(target);
+    }
 
-            vertices.push_back(v0);
-            vertices.push_back(v1);
-            vertices.push_back(v2);
+    size_t sourceTriangles = mesh.indices.size() / 3;
+    size_t targetIndexCount = size_t(sourceTriangles * std::min(std::max(ratio, 0.0f), 1.0f)) * 3;
+    float resultError = simplifyMesh(mesh, targetIndexCount, error);
 
-            vertices.push_back(v1);
-            vertices.push_back(v3);
-            vertices.push_back(v2);
+    std::cout << "Simplified " << sourceTriangles << " -> " << mesh.indices.size() / 3
+        << " triangles (relative error " << resultError << ")" << std::endl;
 
-            Vector3 normal = (v1 - v0).normalized().cross((v2 - v0).normalized()).normalized();
-            normals.push_back(normal);
-            normals.push_back(normal);
-            normals.push_back(normal);
-            normals.push_back(normal);
-            normals.push_back(normal);
-            normals.push_back(normal);
+    std::vector<Vector3> vertices, normals;
+    std::vector<Vector2> texCoords;
+    unindexMesh(mesh, vertices, normals, texCoords);
+    writeToFile(outputFile, vertices, normals, texCoords);
+}
 
-            texCoords.push_back(Vector2(static_cast<float>(i) / slices, static_cast<float>(j) / stacks));
-            texCoords.push_back(Vector2(static_cast<float>(i) / slices, static_cast<float>(j + 1) / stacks));
-            texCoords.push_back(Vector2(static_cast<float>(i + 1) / slices, static_cast<float>(j) / stacks));
-            texCoords.push_back(Vector2(static_cast<float>(i) / slices, static_cast<float>(j + 1) / stacks));
-            texCoords.push_back(Vector2(static_cast<float>(i + 1) / slices, static_cast<float>(j + 1) / stacks));
-            texCoords.push_back(Vector2(static_cast<float>(i + 1) / slices, static_cast<float>(j) / stacks));
-        }
+void writeIndexedToFile(const std::string& filename, const IndexedMesh& mesh) {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "No foi possvel abrir o arquivo para escrita: " << filename << std::endl;
+        return;
+    }
+
+    file << mesh.vertices.size() << " " << mesh.indices.size() << "\n";
+    for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+        file << formatNumber(mesh.vertices[i].x) << "," << formatNumber(mesh.vertices[i].y) << "," << formatNumber(mesh.vertices[i].z) << " ; "
+            << formatNumber(mesh.normals[i].x) << "," << formatNumber(mesh.normals[i].y) << "," << formatNumber(mesh.normals[i].z) << " ; "
+            << formatNumber(mesh.texCoords[i].u) << "," << formatNumber(1.0f - mesh.texCoords[i].v) << "\n";
+    }
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+        file << mesh.indices[i] << "," << mesh.indices[i + 1] << "," << mesh.indices[i + 2] << "\n";
     }
 
-    writeToFile(filename, vertices, normals, texCoords);
+    file.close();
+    std::cout << "Written " << mesh.vertices.size() << " vertex and " << mesh.indices.size() << " indices to archive " << filename << std::endl;
+}
+
+const unsigned int vertexCacheSize = 16;
+
+// Average cache miss ratio: post-transform cache misses per triangle with a FIFO cache
+float computeACMR(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize) {
+    if (indices.empty()) return 0;
+
+    std::vector<unsigned int> timestamps(vertexCount, 0);
+    unsigned int time = cacheSize + 1;
+    size_t misses = 0;
+    for (unsigned int index : indices) {
+        if (time - timestamps[index] > cacheSize) {
+            timestamps[index] = time++;
+            ++misses;
+        }
+    }
+    return float(misses) / float(indices.size() / 3);
 }
 
-std::vector<std::vector<std::vector<float>>> readPatchesFile(const char* filePath) {
-    std::ifstream file(filePath);
-    std::vector<std::vector<std::vector<float>>> result;
-    if (file.is_open()) {
-        std::string line;
-        if (!std::getline(file, line)) return result;
-        int numPatches = std::stoi(line);
-        std::vector<std::vector<int>> indicesPerPatch;
-
-        for (int i = 0; i < numPatches; i++) {
-            if (!std::getline(file, line)) return result;
-            std::vector<int> indices;
-            std::stringstream ss(line);
-            std::string token;
-            while (std::getline(ss, token, ',')) {
-                indices.push_back(std::stoi(token));
+// Tipsify (Sander, Nehab and Barczak 2007). Fans around the vertex most likely to still be in the
+// cache; every time a dead end forces a jump the current run is closed as an overdraw cluster.
+std::vector<unsigned int> tipsify(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize, std::vector<size_t>& clusters) {
+    size_t triangleCount = indices.size() / 3;
+
+    std::vector<unsigned int> liveTriangles(vertexCount, 0), adjacencyOffset(vertexCount + 1, 0);
+    for (unsigned int index : indices) ++liveTriangles[index];
+    for (size_t v = 0; v < vertexCount; ++v) adjacencyOffset[v + 1] = adjacencyOffset[v] + liveTriangles[v];
+
+    std::vector<unsigned int> adjacency(indices.size()), fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+    for (size_t t = 0; t < triangleCount; ++t) {
+        for (int k = 0; k < 3; ++k) adjacency[fill[indices[t * 3 + k]]++] = static_cast<unsigned int>(t);
+    }
+
+    std::vector<unsigned int> timestamps(vertexCount, 0), deadEnd, result;
+    std::vector<bool> emitted(triangleCount, false);
+    unsigned int time = cacheSize + 1;
+    size_t cursor = 0;
+    int fanning = vertexCount > 0 ? 0 : -1;
+
+    clusters.assign(1, 0);
+    while (fanning >= 0) {
+        std::vector<unsigned int> candidates;
+        for (unsigned int a = adjacencyOffset[fanning]; a < adjacencyOffset[fanning + 1]; ++a) {
+            unsigned int t = adjacency[a];
+            if (emitted[t]) continue;
+
+            for (int k = 0; k < 3; ++k) {
+                unsigned int v = indices[t * 3 + k];
+                result.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                --liveTriangles[v];
+                if (time - timestamps[v] > cacheSize) timestamps[v] = time++;
             }
-            indicesPerPatch.push_back(indices);
+            emitted[t] = true;
         }
 
-        if (!std::getline(file, line)) return result;
-        int numControlPoints = std::stoi(line);
-
-        std::vector<std::vector<float>> controlPoints;
-        for (int i = 0; i < numControlPoints; i++) {
-            if (!std::getline(file, line)) return result;
-            std::vector<float> point;
-            std::stringstream ss(line);
-            std::string token;
-            while (std::getline(ss, token, ',')) {
-                point.push_back(std::stof(token));
+        int next = -1, best = -1;
+        for (unsigned int v : candidates) {
+            if (liveTriangles[v] == 0) continue;
+            int priority = 0;
+            if (time - timestamps[v] + 2 * liveTriangles[v] <= cacheSize) priority = int(time - timestamps[v]);
+            if (priority > best) {
+                best = priority;
+                next = int(v);
             }
-            controlPoints.push_back(point);
         }
 
-        for (const auto& indices : indicesPerPatch) {
-            std::vector<std::vector<float>> patch;
-            for (int indice : indices) {
-                patch.push_back(controlPoints[indice]);
+        if (next == -1) {
+            while (!deadEnd.empty() && next == -1) {
+                unsigned int v = deadEnd.back();
+                deadEnd.pop_back();
+                if (liveTriangles[v] > 0) next = int(v);
+            }
+            while (next == -1 && cursor < vertexCount) {
+                if (liveTriangles[cursor] > 0) next = int(cursor);
+                ++cursor;
             }
-            result.push_back(patch);
+            if (next != -1 && result.size() / 3 != clusters.back()) clusters.push_back(result.size() / 3);
         }
+        fanning = next;
     }
-    else {
-        std::cerr << "Erro ao abrir o arquivo: " << filePath << std::endl;
-    }
+
     return result;
 }
 
-void multiplyMatrices(int la, int ca, const float* A, int lb, int cb, const float* B, float* R) {
-    if (ca == lb) {
-        for (int i = 0; i < la; i++) {
-            for (int j = 0; j < cb; j++) {
-                R[i * cb + j] = 0;
-                for (int k = 0; k < ca; k++) {
-                    R[i * cb + j] += A[i * ca + k] * B[k * cb + j];
-                }
-            }
+// Draw the clusters facing away from the mesh centre first, so occluding surfaces tend to come
+// first and later clusters fail the depth test (the "fast linear clustering" ordering from Tipsify).
+void reorderForOverdraw(std::vector<unsigned int>& indices, const std::vector<Vector3>& vertices, const std::vector<size_t>& clusters) {
+    size_t triangleCount = indices.size() / 3;
+    Vector3 meshCentroid;
+    for (const Vector3& v : vertices) meshCentroid = meshCentroid + v;
+    if (!vertices.empty()) meshCentroid = meshCentroid * (1.0f / vertices.size());
+
+    std::vector<std::pair<float, size_t>> order;
+    for (size_t c = 0; c < clusters.size(); ++c) {
+        size_t begin = clusters[c], end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+        Vector3 centroid, normal;
+        for (size_t t = begin; t < end; ++t) {
+            const Vector3& p0 = vertices[indices[t * 3]];
+            const Vector3& p1 = vertices[indices[t * 3 + 1]];
+            const Vector3& p2 = vertices[indices[t * 3 + 2]];
+            Vector3 n = (p1 - p0).cross(p2 - p0);
+            normal = normal + n;
+            centroid = centroid + (p0 + p1 + p2) * (std::sqrt(dot(n, n)) / 3.0f);
         }
+        float area = std::sqrt(dot(normal, normal));
+        float score = area > 0 ? dot(centroid * (1.0f / area) - meshCentroid, normal * (1.0f / area)) : 0.0f;
+        order.push_back(std::make_pair(-score, c));
     }
+    std::stable_sort(order.begin(), order.end(), [](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) { return a.first < b.first; });
+
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+    for (const auto& entry : order) {
+        size_t c = entry.second;
+        size_t begin = clusters[c], end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+        result.insert(result.end(), indices.begin() + begin * 3, indices.begin() + end * 3);
+    }
+    indices.swap(result);
 }
 
-void surfacePoint(float u, float v, const std::vector<std::vector<float>>& patch, float* res) {
-    float M[16] = { -1, 3, -3, 1, 3, -6, 3, 0, -3, 3, 0, 0, 1, 0, 0, 0 };
-    float U[4] = { u * u * u, u * u, u, 1 };
-    float V[4] = { v * v * v, v * v, v, 1 };
-    float UM[4], MV[4];
+void optimizeModel(const std::string& inputFile, const std::string& outputFile) {
+    IndexedMesh mesh;
+    if (!readFromFile(inputFile, mesh)) {
+        std::cerr << "Erro: Nenhum vertice encontrado em " << inputFile << std::endl;
+        return;
+    }
+
+    float acmrBefore = computeACMR(mesh.indices, mesh.vertices.size(), vertexCacheSize);
 
-    multiplyMatrices(1, 4, U, 4, 4, M, UM);
-    multiplyMatrices(4, 4, M, 4, 1, V, MV);
+    std::vector<size_t> clusters;
+    mesh.indices = tipsify(mesh.indices, mesh.vertices.size(), vertexCacheSize, clusters);
+    float acmrTipsify = computeACMR(mesh.indices, mesh.vertices.size(), vertexCacheSize);
+    reorderForOverdraw(mesh.indices, mesh.vertices, clusters);
 
-    float P[3][16];
-    for (int i = 0; i < 16; ++i) {
-        P[0][i] = patch[i][0];
-        P[1][i] = patch[i][1];
-        P[2][i] = patch[i][2];
-    }
+    // compactMesh renumbers vertices in order of first use, which is also the optimal fetch order
+    compactMesh(mesh);
+    float acmrAfter = computeACMR(mesh.indices, mesh.vertices.size(), vertexCacheSize);
 
-    for (int i = 0; i < 3; ++i) {
-        res[i] = 0;
-        for (int j = 0; j < 4; ++j) {
-            res[i] += UM[j] * P[i][j] * MV[j];
-        }
-    }
+    std::cout << "ACMR (FIFO " << vertexCacheSize << "): " << acmrBefore << " -> " << acmrTipsify
+        << " -> " << acmrAfter << " after overdraw ordering (" << clusters.size() << " clusters)" << std::endl;
+
+    writeIndexedToFile(outputFile, mesh);
 }
 
-void derivativeSurfacePoint(float u, float v, const std::vector<std::vector<float>>& patch, float* dU, float* dV) {
-    float M[16] = { -1.0f,  3.0f, -3.0f, 1.0f,
-                     3.0f, -6.0f,  3.0f, 0.0f,
-                    -3.0f,  3.0f,  0.0f, 0.0f,
-                     1.0f,  0.0f,  0.0f, 0.0f };
-    float Ud[4] = { 3 * u * u, 2 * u, 1, 0 };
-    float Vd[4] = { 3 * v * v, 2 * v, 1, 0 };
-    float U[4] = { u * u * u, u * u, u, 1 };
-    float V[4] = { v * v * v, v * v, v, 1 };
-
-    float UDM[4], VDM[4];
-    multiplyMatrices(1, 4, Ud, 4, 4, M, UDM);
-    multiplyMatrices(4, 4, M, 4, 1, Vd, VDM);
-
-    float P[3][16];
-    for (int i = 0; i < 16; ++i) {
-        P[0][i] = patch[i][0];
-        P[1][i] = patch[i][1];
-        P[2][i] = patch[i][2];
-    }
-
-    for (int i = 0; i < 3; ++i) {
-        dU[i] = 0;
-        dV[i] = 0;
-        for (int j = 0; j < 4; ++j) {
-            dU[i] += UDM[j] * P[i][j];
-            dV[i] += VDM[j] * P[i][j];
-        }
-    }
+float signNotZero(float value) {
+    return value >= 0.0f ? 1.0f : -1.0f;
 }
 
-Vector3 computeNormal(const std::vector<std::vector<float>>& patch, float u, float v) {
-    float dU[3], dV[3];
-    derivativeSurfacePoint(u, v, patch, dU, dV);
-    Vector3 tangentU(dU[0], dU[1], dU[2]);
-    Vector3 tangentV(dV[0], dV[1], dV[2]);
+Vector2 octahedralEncode(const Vector3& normal) {
+    float length = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+    if (length == 0) return Vector2(0.0f, 0.0f);
 
-    Vector3 normal = tangentU.cross(tangentV);
-    if (normal.x == 0 && normal.y == 0 && normal.z == 0) {
-        return Vector3(0, 1, 0);
+    Vector2 result(normal.x / length, normal.y / length);
+    if (normal.z < 0) {
+        result = Vector2((1.0f - std::fabs(result.v)) * signNotZero(result.u),
+            (1.0f - std::fabs(result.u)) * signNotZero(result.v));
     }
-    return normal.normalized();
+    return result;
+}
+
+unsigned int quantizeUnorm16(float value, float minValue, float extent) {
+    float t = extent > 0 ? (value - minValue) / extent : 0.0f;
+    return static_cast<unsigned int>(std::lround(std::min(std::max(t, 0.0f), 1.0f) * 65535.0f));
 }
 
-void buildPatches(const char* filePath, int tessellation, const std::string& outputFile) {
-    std::vector<std::vector<std::vector<float>>> patches = readPatchesFile(filePath);
-    if (patches.empty()) {
-        std::cerr << "Erro: Nenhum patch encontrado." << std::endl;
+int quantizeSnorm16(float value) {
+    return static_cast<int>(std::lround(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f));
+}
+
+// Compact layout: positions as unorm16 inside the mesh AABB, normals as octahedral snorm16x2 and
+// UVs as unorm16 inside the UV bounds. The engine keeps it packed on the GPU (16 bytes per vertex
+// instead of 32) and decodes it in the vertex shader.
+void quantizeModel(const std::string& inputFile, const std::string& outputFile) {
+    IndexedMesh mesh;
+    if (!readFromFile(inputFile, mesh)) {
+        std::cerr << "Erro: Nenhum vertice encontrado em " << inputFile << std::endl;
         return;
     }
 
-    std::vector<Vector3> vertices, normals;
-    std::vector<Vector2> texCoords;
+    Vector3 minP = mesh.vertices[0], maxP = mesh.vertices[0];
+    Vector2 minUV = mesh.texCoords[0], maxUV = mesh.texCoords[0];
+    for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+        const Vector3& p = mesh.vertices[i];
+        const Vector2& t = mesh.texCoords[i];
+        minP = Vector3(std::min(minP.x, p.x), std::min(minP.y, p.y), std::min(minP.z, p.z));
+        maxP = Vector3(std::max(maxP.x, p.x), std::max(maxP.y, p.y), std::max(maxP.z, p.z));
+        minUV = Vector2(std::min(minUV.u, t.u), std::min(minUV.v, t.v));
+        maxUV = Vector2(std::max(maxUV.u, t.u), std::max(maxUV.v, t.v));
+    }
+    Vector3 extent = maxP - minP;
 
-    float delta = 1.0f / tessellation;
-    for (const auto& patch : patches) {
-        for (int i = 0; i <= tessellation; ++i) {
-            float u = i * delta;
-            for (int j = 0; j <= tessellation; ++j) {
-                float v = j * delta;
-                float res[3];
-                surfacePoint(u, v, patch, res);
-                Vector3 point(res[0], res[1], res[2]);
-                Vector3 normal = computeNormal(patch, u, v);
-
-                vertices.push_back(point);
-                normals.push_back(normal);
-                texCoords.push_back(Vector2(u, 1 - v));
-            }
-        }
+    std::ofstream file(outputFile);
+    if (!file.is_open()) {
+        std::cerr << "Erro ao abrir o arquivo para escrita: " << outputFile << std::endl;
+        return;
     }
 
-    writeToFile(outputFile, vertices, normals, texCoords);
+    file << mesh.vertices.size() << " " << mesh.indices.size() << " compact\n";
+    file << std::setprecision(9)
+        << minP.x << "," << minP.y << "," << minP.z << " ; " << maxP.x << "," << maxP.y << "," << maxP.z << " ; "
+        << minUV.u << "," << minUV.v << " ; " << maxUV.u << "," << maxUV.v << "\n";
+
+    float maxError = 0.0f;
+    for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+        const Vector3& p = mesh.vertices[i];
+        unsigned int qx = quantizeUnorm16(p.x, minP.x, extent.x);
+        unsigned int qy = quantizeUnorm16(p.y, minP.y, extent.y);
+        unsigned int qz = quantizeUnorm16(p.z, minP.z, extent.z);
+        Vector2 octahedral = octahedralEncode(mesh.normals[i]);
+
+        Vector3 decoded(minP.x + extent.x * qx / 65535.0f, minP.y + extent.y * qy / 65535.0f, minP.z + extent.z * qz / 65535.0f);
+        Vector3 delta = decoded - p;
+        maxError = std::max(maxError, std::sqrt(dot(delta, delta)));
+
+        file << qx << "," << qy << "," << qz << " ; "
+            << quantizeSnorm16(octahedral.u) << "," << quantizeSnorm16(octahedral.v) << " ; "
+            << quantizeUnorm16(mesh.texCoords[i].u, minUV.u, maxUV.u - minUV.u) << ","
+            << quantizeUnorm16(mesh.texCoords[i].v, minUV.v, maxUV.v - minUV.v) << "\n";
+    }
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+        file << mesh.indices[i] << "," << mesh.indices[i + 1] << "," << mesh.indices[i + 2] << "\n";
+    }
+
+    file.close();
+    std::cout << "Written " << mesh.vertices.size() << " compact vertex (16 bytes each, max position error "
+        << maxError << ") to archive " << outputFile << std::endl;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 5) {
-        std::cerr << "Usage: " << argv[0] << " [sphere|box|cone|plane|patch] <parameters> filename\n";
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " [sphere|box|cone|plane|patch|simplify|optimize|quantize] <parameters> filename\n";
         return 1;
     }
 
@@ -544,19 +737,19 @@ int main(int argc, char* argv[]) {
         int slices = std::stoi(argv[3]);
         int stacks = std::stoi(argv[4]);
         filename = argv[5];
-        generateSphere(radius, slices, stacks, filename);
+        writeToFile(filename, primitives::generateSphere(radius, slices, stacks));
     }
     else if (shapeType == "box" && argc == 5) {
         double length = std::stod(argv[2]);
         int grid = std::stoi(argv[3]);
         filename = argv[4];
-        generateBox(length, grid, filename);
+        writeToFile(filename, primitives::generateBox(length, grid));
     }
     else if (shapeType == "plane" && argc == 5) {
         float length = std::stof(argv[2]);
         int divisions = std::stoi(argv[3]);
         filename = argv[4];
-        generatePlane(length, divisions, filename);
+        writeToFile(filename, primitives::generatePlane(length, divisions));
     }
     else if (shapeType == "cone" && argc == 7) {
         double radius = std::stod(argv[2]);
@@ -564,13 +757,31 @@ int main(int argc, char* argv[]) {
         int slices = std::stoi(argv[4]);
         int stacks = std::stoi(argv[5]);
         filename = argv[6];
-        generateCone(radius, height, slices, stacks, filename);
+        writeToFile(filename, primitives::generateCone(radius, height, slices, stacks));
     }
     else if (shapeType == "patch" && argc == 5) {
         const char* filePath = argv[2];
         int tessellation = std::stoi(argv[3]);
         filename = argv[4];
-        buildPatches(filePath, tessellation, filename);
+        primitives::Shape shape = primitives::buildPatches(filePath, tessellation);
+        if (shape.vertices.empty()) return 1;
+        writeToFile(filename, shape);
+    }
+    else if (shapeType == "simplify" && argc == 5) {
+        std::string inputFile = argv[2];
+        std::string target = argv[3];
+        filename = argv[4];
+        simplifyModel(inputFile, target, filename);
+    }
+    else if (shapeType == "optimize" && argc == 4) {
+        std::string inputFile = argv[2];
+        filename = argv[3];
+        optimizeModel(inputFile, filename);
+    }
+    else if (shapeType == "quantize" && argc == 4) {
+        std::string inputFile = argv[2];
+        filename = argv[3];
+        quantizeModel(inputFile, filename);
     }
     else {
         std::cerr << "Invalid parameters or command\n";
@@ -0,0 +1,532 @@
+#define _USE_MATH_DEFINES 
+#include <math.h>
+#include "primitives.h"
+
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace primitives {
+
+Vector3 Lerp(const Vector3& a, const Vector3& b, float t) {
+    return Vector3(a.x + (b.x - a.x) * t,
+        a.y + (b.y - a.y) * t,
+        a.z + (b.z - a.z) * t);
+}
+
+Shape generatePlane(float length, int divisions) {
+    std::vector<Vector3> vertices;
+    std::vector<Vector3> normals;
+    std::vector<Vector2> texCoords;
+
+    float half_length = length / 2.0f;
+    float step = length / divisions;
+
+    Vector3 normal(0.0f, 1.0f, 0.0f);
+
+    for (int i = 0; i < divisions; ++i) {
+        for (int j = 0; j < divisions; ++j) {
+            float x0 = i * step - half_length;
+            float x1 = (i + 1) * step - half_length;
+            float z0 = j * step - half_length;
+            float z1 = (j + 1) * step - half_length;
+
+            float u0 = float(i) / divisions;
+            float u1 = float(i + 1) / divisions;
+            float v0 = float(j) / divisions;
+            float v1 = float(j + 1) / divisions;
+
+            vertices.push_back(Vector3(x0, 0.0f, z0));
+            normals.push_back(normal);
+            texCoords.push_back(Vector2(u0, v0));
+
+            vertices.push_back(Vector3(x0, 0.0f, z1));
+            normals.push_back(normal);
+            texCoords.push_back(Vector2(u0, v1));
+
+            vertices.push_back(Vector3(x1, 0.0f, z0));
+            normals.push_back(normal);
+            texCoords.push_back(Vector2(u1, v0));
+
+            vertices.push_back(Vector3(x0, 0.0f, z1));
+            normals.push_back(normal);
+            texCoords.push_back(Vector2(u0, v1));
+
+            vertices.push_back(Vector3(x1, 0.0f, z1));
+            normals.push_back(normal);
+            texCoords.push_back(Vector2(u1, v1));
+
+            vertices.push_back(Vector3(x1, 0.0f, z0));
+            normals.push_back(normal);
+            texCoords.push_back(Vector2(u1, v0));
+        }
+    }
+
+    return { std::move(vertices), std::move(normals), std::move(texCoords) };
+}
+
+Shape generateBox(float length, int divisions) {
+    std::vector<Vector3> vertices;
+    std::vector<Vector3> normals;
+    std::vector<Vector2> texCoords;
+
+    float half_length = length / 2.0f;
+    float step = length / divisions;
+
+    std::vector<Vector3> faceNormals = {
+        Vector3(0, 1, 0),
+        Vector3(0, -1, 0),
+        Vector3(0, 0, 1),
+        Vector3(0, 0, -1),
+        Vector3(-1, 0, 0),
+        Vector3(1, 0, 0)
+    };
+
+    for (int face = 0; face < 6; ++face) {
+        for (int i = 0; i < divisions; ++i) {
+            for (int j = 0; j < divisions; ++j) {
+                Vector3 v0, v1, v2, v3;
+                float u1f = i / static_cast<float>(divisions);
+                float v1f = j / static_cast<float>(divisions);
+                float u2f = (i + 1) / static_cast<float>(divisions);
+                float v2f = (j + 1) / static_cast<float>(divisions);
+
+                switch (face) {
+                case 0:
+                    v0 = Vector3(-half_length + i * step, half_length, -half_length + j * step);
+                    v1 = Vector3(-half_length + (i + 1) * step, half_length, -half_length + j * step);
+                    v2 = Vector3(-half_length + (i + 1) * step, half_length, -half_length + (j + 1) * step);
+                    v3 = Vector3(-half_length + i * step, half_length, -half_length + (j + 1) * step);
+                    break;
+                case 1:
+                    v0 = Vector3(-half_length + i * step, -half_length, -half_length + j * step);
+                    v1 = Vector3(-half_length + (i + 1) * step, -half_length, -half_length + j * step);
+                    v2 = Vector3(-half_length + (i + 1) * step, -half_length, -half_length + (j + 1) * step);
+                    v3 = Vector3(-half_length + i * step, -half_length, -half_length + (j + 1) * step);
+                    v1f = 1 - v1f;
+                    v2f = 1 - v2f;
+                    break;
+                case 2:
+                    v0 = Vector3(-half_length + i * step, -half_length + j * step, half_length);
+                    v1 = Vector3(-half_length + (i + 1) * step, -half_length + j * step, half_length);
+                    v2 = Vector3(-half_length + (i + 1) * step, -half_length + (j + 1) * step, half_length);
+                    v3 = Vector3(-half_length + i * step, -half_length + (j + 1) * step, half_length);
+                    break;
+                case 3:
+                    v0 = Vector3(-half_length + i * step, -half_length + j * step, -half_length);
+                    v1 = Vector3(-half_length + (i + 1) * step, -half_length + j * step, -half_length);
+                    v2 = Vector3(-half_length + (i + 1) * step, -half_length + (j + 1) * step, -half_length);
+                    v3 = Vector3(-half_length + i * step, -half_length + (j + 1) * step, -half_length);
+                    break;
+                case 4:
+                    v0 = Vector3(-half_length, -half_length + j * step, -half_length + i * step);
+                    v1 = Vector3(-half_length, -half_length + (j + 1) * step, -half_length + i * step);
+                    v2 = Vector3(-half_length, -half_length + (j + 1) * step, -half_length + (i + 1) * step);
+                    v3 = Vector3(-half_length, -half_length + j * step, -half_length + (i + 1) * step);
+                    break;
+                case 5: 
+                    v0 = Vector3(half_length, -half_length + j * step, -half_length + i * step);
+                    v1 = Vector3(half_length, -half_length + (j + 1) * step, -half_length + i * step);
+                    v2 = Vector3(half_length, -half_length + (j + 1) * step, -half_length + (i + 1) * step);
+                    v3 = Vector3(half_length, -half_length + j * step, -half_length + (i + 1) * step);
+                    break;
+                }
+
+                vertices.push_back(v0);
+                vertices.push_back(v1);
+                vertices.push_back(v2);
+                vertices.push_back(v2);
+                vertices.push_back(v3);
+                vertices.push_back(v0);
+
+                normals.push_back(faceNormals[face]);
+                normals.push_back(faceNormals[face]);
+                normals.push_back(faceNormals[face]);
+                normals.push_back(faceNormals[face]);
+                normals.push_back(faceNormals[face]);
+                normals.push_back(faceNormals[face]);
+
+                texCoords.push_back(Vector2(u1f, v1f));
+                texCoords.push_back(Vector2(u2f, v1f));
+                texCoords.push_back(Vector2(u2f, v2f));
+                texCoords.push_back(Vector2(u2f, v2f));
+                texCoords.push_back(Vector2(u1f, v2f));
+                texCoords.push_back(Vector2(u1f, v1f));
+            }
+        }
+    }
+
+    return { std::move(vertices), std::move(normals), std::move(texCoords) };
+}
+
+float theta(int slice, int slices) {
+    return 2.0f * M_PI * slice / slices;
+}
+
+Shape generateSphere(float radius, int slices, int stacks) {
+    std::vector<Vector3> vertices;
+    std::vector<Vector3> normals;
+    std::vector<Vector2> texCoords;
+
+    for (int i = 0; i <= stacks; ++i) {
+        float phi = M_PI * i / stacks;
+        float sin_phi = sin(phi);
+        float cos_phi = cos(phi);
+
+        for (int j = 0; j <= slices; ++j) {
+            float theta = 2 * M_PI * j / slices;
+            float sin_theta = sin(theta);
+            float cos_theta = cos(theta);
+
+            float x = radius * sin_phi * cos_theta;
+            float y = radius * cos_phi;
+            float z = radius * sin_phi * sin_theta;
+
+            float u = static_cast<float>(j) / slices;
+            float v = static_cast<float>(i) / stacks;
+
+            Vector3 vertex(x, y, z);
+            Vector3 normal = vertex.normalized();
+            Vector2 texCoord(u, v);
+
+            vertices.push_back(vertex);
+            normals.push_back(normal);
+            texCoords.push_back(texCoord);
+        }
+    }
+
+    std::vector<Vector3> finalVertices;
+    std::vector<Vector3> finalNormals;
+    std::vector<Vector2> finalTexCoords;
+
+    for (int i = 0; i < stacks; ++i) {
+        for (int j = 0; j < slices; ++j) {
+            int first = (i * (slices + 1)) + j;
+            int second = first + slices + 1;
+
+            finalVertices.push_back(vertices[first]);
+            finalNormals.push_back(normals[first]);
+            finalTexCoords.push_back(texCoords[first]);
+
+            finalVertices.push_back(vertices[second]);
+            finalNormals.push_back(normals[second]);
+            finalTexCoords.push_back(texCoords[second]);
+
+            finalVertices.push_back(vertices[first + 1]);
+            finalNormals.push_back(normals[first + 1]);
+            finalTexCoords.push_back(texCoords[first + 1]);
+
+            finalVertices.push_back(vertices[second]);
+            finalNormals.push_back(normals[second]);
+            finalTexCoords.push_back(texCoords[second]);
+
+            finalVertices.push_back(vertices[second + 1]);
+            finalNormals.push_back(normals[second + 1]);
+            finalTexCoords.push_back(texCoords[second + 1]);
+
+            finalVertices.push_back(vertices[first + 1]);
+            finalNormals.push_back(normals[first + 1]);
+            finalTexCoords.push_back(texCoords[first + 1]);
+        }
+    }
+
+    return { std::move(finalVertices), std::move(finalNormals), std::move(finalTexCoords) };
+}
+
+Shape generateCone(float radius, float height, int slices, int stacks) {
+    std::vector<Vector3> vertices;
+    std::vector<Vector3> normals;
+    std::vector<Vector2> texCoords;
+
+    float stackHeight = height / stacks;
+    float angleStep = (2 * M_PI) / slices;
+
+    for (int i = 0; i < slices; ++i) {
+        float angle = i * angleStep;
+        float nextAngle = (i + 1) * angleStep;
+        Vector3 v0(0, 0, 0);
+        Vector3 v1(radius * cos(angle), 0, radius * sin(angle));
+        Vector3 v2(radius * cos(nextAngle), 0, radius * sin(nextAngle));
+
+        vertices.push_back(v0);
+        vertices.push_back(v1);
+        vertices.push_back(v2);
+
+        normals.push_back(Vector3(0, -1, 0));
+        normals.push_back(Vector3(0, -1, 0));
+        normals.push_back(Vector3(0, -1, 0));
+
+        texCoords.push_back(Vector2(0.5, 0.5));
+        texCoords.push_back(Vector2(cos(angle) * 0.5 + 0.5, sin(angle) * 0.5 + 0.5));
+        texCoords.push_back(Vector2(cos(nextAngle) * 0.5 + 0.5, sin(nextAngle) * 0.5 + 0.5));
+    }
+
+    for (int j = 0; j < stacks; ++j) {
+        float currentRadius = radius * (1 - static_cast<float>(j) / stacks);
+        float nextRadius = radius * (1 - static_cast<float>(j + 1) / stacks);
+        float currentHeight = j * stackHeight;
+        float nextHeight = (j + 1) * stackHeight;
+
+        for (int i = 0; i < slices; ++i) {
+            float angle = i * angleStep;
+            float nextAngle = (i + 1) * angleStep;
+
+            Vector3 v0(currentRadius * cos(angle), currentHeight, currentRadius * sin(angle));
+            Vector3 v1(nextRadius * cos(angle), nextHeight, nextRadius * sin(angle));
+            Vector3 v2(currentRadius * cos(nextAngle), currentHeight, currentRadius * sin(nextAngle));
+            Vector3 v3(nextRadius * cos(nextAngle), nextHeight, nextRadius * sin(nextAngle));
+
+            vertices.push_back(v0);
+            vertices.push_back(v1);
+            vertices.push_back(v2);
+
+            vertices.push_back(v1);
+            vertices.push_back(v3);
+            vertices.push_back(v2);
+
+            Vector3 normal = (v1 - v0).normalized().cross((v2 - v0).normalized()).normalized();
+            normals.push_back(normal);
+            normals.push_back(normal);
+            normals.push_back(normal);
+            normals.push_back(normal);
+            normals.push_back(normal);
+            normals.push_back(normal);
+
+            texCoords.push_back(Vector2(static_cast<float>(i) / slices, static_cast<float>(j) / stacks));
+            texCoords.push_back(Vector2(static_cast<float>(i) / slices, static_cast<float>(j + 1) / stacks));
+            texCoords.push_back(Vector2(static_cast<float>(i + 1) / slices, static_cast<float>(j) / stacks));
+            texCoords.push_back(Vector2(static_cast<float>(i) / slices, static_cast<float>(j + 1) / stacks));
+            texCoords.push_back(Vector2(static_cast<float>(i + 1) / slices, static_cast<float>(j + 1) / stacks));
+            texCoords.push_back(Vector2(static_cast<float>(i + 1) / slices, static_cast<float>(j) / stacks));
+        }
+    }
+
+    return { std::move(vertices), std::move(normals), std::move(texCoords) };
+}
+
+// Whole-token conversions, surrounding spaces allowed; they never throw, since patch files are
+// also read on the engine's worker threads
+static bool parseInt(const std::string& token, int& value) {
+    const char* text = token.c_str();
+    char* end = nullptr;
+    errno = 0;
+    long parsed = std::strtol(text, &end, 10);
+    if (end == text || errno == ERANGE || parsed < INT_MIN || parsed > INT_MAX) return false;
+    while (std::isspace(static_cast<unsigned char>(*end))) ++end;
+    value = static_cast<int>(parsed);
+    return *end == '\0';
+}
+
+static bool parseFloat(const std::string& token, float& value) {
+    const char* text = token.c_str();
+    char* end = nullptr;
+    errno = 0;
+    value = std::strtof(text, &end);
+    if (end == text || errno == ERANGE) return false;
+    while (std::isspace(static_cast<unsigned char>(*end))) ++end;
+    return *end == '\0';
+}
+
+// Empty when the file is malformed: a bad number, a patch without 16 indices, an index with no
+// control point or a point without 3 coordinates
+std::vector<Patch> readPatchesFile(const char* filePath) {
+    std::ifstream file(filePath);
+    if (!file.is_open()) {
+        std::cerr << "Erro ao abrir o arquivo: " << filePath << std::endl;
+        return {};
+    }
+    auto fail = [&](const std::string& line) {
+        std::cerr << "Erro ao ler o arquivo de patches " << filePath << ": " << line << std::endl;
+        return std::vector<Patch>();
+    };
+
+    std::string line;
+    int numPatches = 0;
+    if (!std::getline(file, line) || !parseInt(line, numPatches) || numPatches < 0) return fail(line);
+    std::vector<std::vector<int>> indicesPerPatch;
+
+    for (int i = 0; i < numPatches; i++) {
+        if (!std::getline(file, line)) return fail("fim do arquivo");
+        std::vector<int> indices;
+        std::stringstream ss(line);
+        std::string token;
+        while (std::getline(ss, token, ',')) {
+            int index;
+            if (!parseInt(token, index) || index < 0) return fail(line);
+            indices.push_back(index);
+        }
+        if (indices.size() != 16) return fail(line);
+        indicesPerPatch.push_back(indices);
+    }
+
+    int numControlPoints = 0;
+    if (!std::getline(file, line) || !parseInt(line, numControlPoints) || numControlPoints < 0) return fail(line);
+
+    std::vector<std::vector<float>> controlPoints;
+    for (int i = 0; i < numControlPoints; i++) {
+        if (!std::getline(file, line)) return fail("fim do arquivo");
+        std::vector<float> point;
+        std::stringstream ss(line);
+        std::string token;
+        while (std::getline(ss, token, ',')) {
+            float coordinate;
+            if (!parseFloat(token, coordinate)) return fail(line);
+            point.push_back(coordinate);
+        }
+        if (point.size() != 3) return fail(line);
+        controlPoints.push_back(point);
+    }
+
+    std::vector<Patch> result;
+    for (const auto& indices : indicesPerPatch) {
+        Patch patch;
+        for (int indice : indices) {
+            if (static_cast<size_t>(indice) >= controlPoints.size()) return fail("indice " + std::to_string(indice));
+            patch.push_back(controlPoints[indice]);
+        }
+        result.push_back(patch);
+    }
+    return result;
+}
+
+void multiplyMatrices(int la, int ca, const float* A, int lb, int cb, const float* B, float* R) {
+    if (ca == lb) {
+        for (int i = 0; i < la; i++) {
+            for (int j = 0; j < cb; j++) {
+                R[i * cb + j] = 0;
+                for (int k = 0; k < ca; k++) {
+                    R[i * cb + j] += A[i * ca + k] * B[k * cb + j];
+                }
+            }
+        }
+    }
+}
+
+void surfacePoint(float u, float v, const Patch& patch, float* res) {
+    float M[16] = { -1, 3, -3, 1, 3, -6, 3, 0, -3, 3, 0, 0, 1, 0, 0, 0 };
+    float U[4] = { u * u * u, u * u, u, 1 };
+    float V[4] = { v * v * v, v * v, v, 1 };
+    float UM[4], MV[4];
+
+    multiplyMatrices(1, 4, U, 4, 4, M, UM);
+    multiplyMatrices(4, 4, M, 4, 1, V, MV);
+
+    float P[3][16];
+    for (int i = 0; i < 16; ++i) {
+        P[0][i] = patch[i][0];
+        P[1][i] = patch[i][1];
+        P[2][i] = patch[i][2];
+    }
+
+    // P(u, v) = U M P M V, with the control points as a 4x4 grid, row by row
+    for (int i = 0; i < 3; ++i) {
+        res[i] = 0;
+        for (int a = 0; a < 4; ++a) {
+            for (int b = 0; b < 4; ++b) {
+                res[i] += UM[a] * P[i][a * 4 + b] * MV[b];
+            }
+        }
+    }
+}
+
+void derivativeSurfacePoint(float u, float v, const Patch& patch, float* dU, float* dV) {
+    float M[16] = { -1.0f,  3.0f, -3.0f, 1.0f,
+                     3.0f, -6.0f,  3.0f, 0.0f,
+                    -3.0f,  3.0f,  0.0f, 0.0f,
+                     1.0f,  0.0f,  0.0f, 0.0f };
+    float Ud[4] = { 3 * u * u, 2 * u, 1, 0 };
+    float Vd[4] = { 3 * v * v, 2 * v, 1, 0 };
+    float U[4] = { u * u * u, u * u, u, 1 };
+    float V[4] = { v * v * v, v * v, v, 1 };
+
+    float UDM[4], VDM[4], UM[4], MV[4];
+    multiplyMatrices(1, 4, Ud, 4, 4, M, UDM);
+    multiplyMatrices(4, 4, M, 4, 1, Vd, VDM);
+    multiplyMatrices(1, 4, U, 4, 4, M, UM);
+    multiplyMatrices(4, 4, M, 4, 1, V, MV);
+
+    float P[3][16];
+    for (int i = 0; i < 16; ++i) {
+        P[0][i] = patch[i][0];
+        P[1][i] = patch[i][1];
+        P[2][i] = patch[i][2];
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        dU[i] = 0;
+        dV[i] = 0;
+        for (int a = 0; a < 4; ++a) {
+            for (int b = 0; b < 4; ++b) {
+                dU[i] += UDM[a] * P[i][a * 4 + b] * MV[b];
+                dV[i] += UM[a] * P[i][a * 4 + b] * VDM[b];
+            }
+        }
+    }
+}
+
+Vector3 computeNormal(const Patch& patch, float u, float v) {
+    float dU[3], dV[3];
+    derivativeSurfacePoint(u, v, patch, dU, dV);
+    Vector3 tangentU(dU[0], dU[1], dU[2]);
+    Vector3 tangentV(dV[0], dV[1], dV[2]);
+
+    Vector3 normal = tangentU.cross(tangentV);
+    if (normal.x == 0 && normal.y == 0 && normal.z == 0) {
+        return Vector3(0, 1, 0);
+    }
+    return normal.normalized();
+}
+
+Shape buildPatches(const char* filePath, int tessellation) {
+    std::vector<Patch> patches = readPatchesFile(filePath);
+    if (patches.empty()) {
+        std::cerr << "Erro: Nenhum patch encontrado." << std::endl;
+        return Shape();
+    }
+
+    std::vector<Vector3> vertices, normals;
+    std::vector<Vector2> texCoords;
+
+    float delta = 1.0f / tessellation;
+    for (const auto& patch : patches) {
+        std::vector<Vector3> gridPoints, gridNormals;
+        std::vector<Vector2> gridTexCoords;
+
+        for (int i = 0; i <= tessellation; ++i) {
+            float u = i * delta;
+            for (int j = 0; j <= tessellation; ++j) {
+                float v = j * delta;
+                float res[3];
+                surfacePoint(u, v, patch, res);
+                gridPoints.push_back(Vector3(res[0], res[1], res[2]));
+                gridNormals.push_back(computeNormal(patch, u, v));
+                gridTexCoords.push_back(Vector2(u, 1 - v));
+            }
+        }
+
+        // Two triangles per grid cell, wound to match dU x dV
+        for (int i = 0; i < tessellation; ++i) {
+            for (int j = 0; j < tessellation; ++j) {
+                int p00 = i * (tessellation + 1) + j;
+                int p10 = p00 + tessellation + 1;
+                int p01 = p00 + 1;
+                int p11 = p10 + 1;
+                int corners[6] = { p00, p10, p01, p10, p11, p01 };
+
+                for (int corner : corners) {
+                    vertices.push_back(gridPoints[corner]);
+                    normals.push_back(gridNormals[corner]);
+                    texCoords.push_back(gridTexCoords[corner]);
+                }
+            }
+        }
+    }
+
+    return { std::move(vertices), std::move(normals), std::move(texCoords) };
+}
+
+}
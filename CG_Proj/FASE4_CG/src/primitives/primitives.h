@@ -0,0 +1,68 @@
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+#include <string>
+#include <vector>
+#include <cmath>
+
+// Built-in shapes, shared by the generator, which writes them to .3d files, and the engine, which
+// builds them straight into meshes when a scene names a primitive instead of a file.
+namespace primitives {
+
+struct Vector3 {
+    float x, y, z;
+
+    Vector3(float x = 0.0f, float y = 0.0f, float z = 0.0f) : x(x), y(y), z(z) {}
+
+    Vector3 normalized() const {
+        float length = std::sqrt(x * x + y * y + z * z);
+        return Vector3(x / length, y / length, z / length);
+    }
+
+    Vector3 operator-(const Vector3& other) const {
+        return Vector3(x - other.x, y - other.y, z - other.z);
+    }
+
+    Vector3 operator+(const Vector3& other) const {
+        return Vector3(x + other.x, y + other.y, z + other.z);
+    }
+
+    Vector3 operator*(float scalar) const {
+        return Vector3(x * scalar, y * scalar, z * scalar);
+    }
+
+    Vector3 cross(const Vector3& other) const {
+        return Vector3(y * other.z - z * other.y, z * other.x - x * other.z, x * other.y - y * other.x);
+    }
+};
+
+struct Vector2 {
+    float u, v;
+
+    Vector2(float u = 0.0f, float v = 0.0f) : u(u), v(v) {}
+};
+
+// Triangle list with one normal and texture coordinate per vertex. Texture v is as the engine
+// samples it; .3d files store 1 - v.
+struct Shape {
+    std::vector<Vector3> vertices;
+    std::vector<Vector3> normals;
+    std::vector<Vector2> texCoords;
+};
+
+// One Bezier patch: 16 control points of 3 coordinates, row by row
+typedef std::vector<std::vector<float>> Patch;
+
+Vector3 Lerp(const Vector3& a, const Vector3& b, float t);
+
+Shape generatePlane(float length, int divisions);
+Shape generateBox(float length, int divisions);
+Shape generateSphere(float radius, int slices, int stacks);
+Shape generateCone(float radius, float height, int slices, int stacks);
+
+std::vector<Patch> readPatchesFile(const char* filePath);
+Shape buildPatches(const char* filePath, int tessellation);
+
+}
+
+#endif